@@ -0,0 +1,32 @@
+#include "kxemu/difftest.h"
+#include <stdint.h>
+#include <stdio.h>
+
+int main(void) {
+    if (kxemu_difftest_version() < KXEMU_DIFFTEST_VERSION) {
+        printf("The shared object is older than difftest.h\n");
+        return 1;
+    }
+    if (kxemu_difftest_init(1, 0x80000000, 0x1000) != 0) {
+        return 1;
+    }
+
+    uint32_t program[] = {
+        0x00100093, // addi x1, x0, 1
+        0x00108093, // addi x1, x1, 1
+        0x00108093, // addi x1, x1, 1
+    };
+    kxemu_difftest_memcpy(0x80000000, program, sizeof(program), KXEMU_DIFFTEST_TO_REF);
+
+    uint64_t n = kxemu_difftest_exec(0, 3);
+
+    kxemu_difftest_regs_t regs;
+    kxemu_difftest_regcpy(0, &regs, KXEMU_DIFFTEST_TO_DUT);
+    printf("executed=%lu x1=%lu pc=0x%lx\n", (unsigned long)n, (unsigned long)regs.gpr[1], (unsigned long)regs.pc);
+
+    // Codes out of [0, XLEN) are rejected
+    printf("raise_intr(64)=%d\n", kxemu_difftest_raise_intr(0, 64));
+
+    kxemu_difftest_deinit();
+    return 0;
+}
@@ -1,8 +1,13 @@
 #ifndef __KXEMU_CPU_CORE_HPP__
 #define __KXEMU_CPU_CORE_HPP__
 
+#include "cpu/perf.hpp"
+#include "cpu/profile.hpp"
+#include "cpu/trace.hpp"
+
 #include <optional>
 #include <string>
+#include <vector>
 
 namespace kxemu::cpu {
 
@@ -35,6 +40,41 @@ public:
         valid = true;
         return vaddr;
     }
+
+    // The performance counters of the core, nullptr if the core does not have them
+    virtual CorePerf *get_perf() {
+        return nullptr;
+    }
+
+    // The instruction mix of the core, empty if it is not counted
+    virtual std::vector<InstMixEntry> get_inst_mix() {
+        return {};
+    }
+    virtual void reset_inst_mix() {}
+
+    // Sample the PC every `interval` instructions into the buffer, with at most `depth` frames
+    // walked by the frame pointer. Stop sampling if the buffer is nullptr.
+    // Return false if the core does not support sampling.
+    virtual bool set_profile(ProfileBuffer *, unsigned int, unsigned int) {
+        return false;
+    }
+
+    // Record every retired instruction and trap into the buffer. Stop if the buffer is nullptr.
+    // Return false if the core does not support tracing.
+    virtual bool set_trace(TraceBuffer *) {
+        return false;
+    }
+
+    // The steps run by the core, counted from 0 again when recording or replaying starts
+    virtual uint64_t get_step_count() {
+        return 0;
+    }
+
+    // Stop running at a breakpoint soon, it can be called from other threads while the core runs.
+    // The request is checked every few thousand steps.
+    virtual void request_stop() {}
+    // Stop running at a breakpoint after n more steps, rounded up to the next check of request_stop
+    virtual void set_step_limit(uint64_t n) {}
 };
 
 } // namespace kxemu::cpu
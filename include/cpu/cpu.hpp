@@ -10,6 +10,8 @@
 
 #include "cpu/core.hpp"
 #include "device/bus.hpp"
+#include "utils/replay-log.hpp"
+#include "utils/snapshot.hpp"
 
 namespace kxemu::cpu {
 
@@ -26,9 +28,19 @@ public:
 
     virtual void set_debug_mode(bool debug) {}
 
+    // Record the nondeterministic inputs of the cores to the log, or replay them from it,
+    // by the mode of the log. Stop if the log is nullptr.
+    // Return false if the cpu does not support record and replay.
+    virtual bool set_replay(utils::ReplayLog *log) { return false; }
+
     virtual unsigned int core_count() = 0;
     virtual Core<word_t> *get_core(unsigned int coreID) = 0;
 
+    // Save and restore the state of all cores for machine snapshot.
+    // The cpu must not be running.
+    virtual bool save_state(utils::SnapshotWriter &writer) { return false; }
+    virtual bool load_state(utils::SnapshotReader &reader) { return false; }
+
     virtual ~CPU() = default;
 };
 
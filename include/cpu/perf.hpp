@@ -0,0 +1,46 @@
+#ifndef __KXEMU_CPU_PERF_HPP__
+#define __KXEMU_CPU_PERF_HPP__
+
+#include "utils/perf.hpp"
+
+#include <cstdint>
+
+namespace kxemu::cpu {
+
+// The performance counters of a hart, only written by the thread running the hart
+struct CorePerf {
+    static constexpr unsigned int CAUSE_COUNT = 64;
+
+    utils::PerfCounter instret;    // Instructions executed without a trap
+    utils::PerfCounter icacheHit;
+    utils::PerfCounter icacheMiss;
+    utils::PerfCounter tlbHit;
+    utils::PerfCounter tlbMiss;
+    utils::PerfCounter pageWalk;   // Page table walks, by TLB misses or without TLB
+    utils::PerfCounter trap[CAUSE_COUNT];      // By the exception code
+    utils::PerfCounter interrupt[CAUSE_COUNT]; // By the interrupt code
+
+    void reset() {
+        instret.reset();
+        icacheHit.reset();
+        icacheMiss.reset();
+        tlbHit.reset();
+        tlbMiss.reset();
+        pageWalk.reset();
+        for (unsigned int i = 0; i < CAUSE_COUNT; i++) {
+            trap[i].reset();
+            interrupt[i].reset();
+        }
+    }
+};
+
+// The executions of an instruction handler in one form
+struct InstMixEntry {
+    const char *name;
+    unsigned int length; // Instruction length in bytes, 2 for the compressed form
+    uint64_t count;
+};
+
+} // namespace kxemu::cpu
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __KXEMU_CPU_PROFILE_HPP__
+#define __KXEMU_CPU_PROFILE_HPP__
+
+#include "utils/spsc-ring.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+namespace kxemu::cpu {
+
+struct ProfileSample {
+    static constexpr unsigned int MAX_DEPTH = 30;
+
+    uint64_t pc;
+    uint8_t privMode;
+    uint8_t depth;
+    uint64_t stack[MAX_DEPTH]; // Return addresses walked by the frame pointer, the innermost first
+};
+
+// The samples of a hart, pushed by the thread running the hart and drained by KDB.
+// A sample is dropped if the ring is full, the hart never waits for the consumer.
+struct ProfileBuffer {
+    static constexpr unsigned int CAPACITY = 4096;
+
+    utils::SPSCRing<ProfileSample, CAPACITY> ring;
+    std::atomic<uint64_t> dropped = 0;
+};
+
+} // namespace kxemu::cpu
+
+#endif
@@ -55,11 +55,15 @@ public:
     void register_stimer(unsigned int coreID, uint64_t stimecmp);
 
     const char *get_type_name() const override;
+
+    bool save_state(utils::SnapshotWriter &writer) override;
+    bool load_state(utils::SnapshotReader &reader) override;
 private:
     unsigned int coreCount;
 
     bool timerRunning;
     uint64_t bootTime;
+    uint64_t pausedUptime; // uptime when the timer is stopped, keep mtime monotonic between runs
 
     utils::TaskTimer taskTimer;
     void update_core_mtimecmp(unsigned int coreID);
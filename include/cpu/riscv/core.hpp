@@ -11,15 +11,24 @@
 #include "cpu/riscv/csr.hpp"
 #include "cpu/riscv/config.hpp"
 #include "device/bus.hpp"
+#include "difftest.h"
+#include "utils/replay-log.hpp"
+#include "utils/snapshot.hpp"
 
+#include <atomic>
 #include <expected>
+#include <memory>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace kxemu::cpu {
 
 class RVCore : public Core<word_t>{
 private:
+    friend class RVCoreBench; // The microbenchmarks in tools/bench
+
     unsigned int coreID;
 
     bool debugMode = false;
@@ -87,8 +96,11 @@ private:
     using VMResult = std::expected<word_t, VMFault>;
     VMResult vaddr_translate_core(addr_t addr, MemType type) noexcept;
     
-    template<unsigned int LEVELS, unsigned int PTESIZE, unsigned int VPNBITS>
+    template<unsigned int LEVELS, unsigned int PTESIZE, unsigned int VPNBITS, bool PROBE = false>
     VMResult vaddr_translate_sv(addr_t vaddr, MemType type) noexcept; // The template function for sv32, sv39, sv48, sv57
+
+    // Walk the page table without touching the TLB, the A and D bits, the perf counters or MMIO
+    VMResult vaddr_probe(word_t vaddr) noexcept;
     
     VMResult vaddr_translate_bare(word_t vaddr, MemType type);
     #ifdef KXEMU_ISA32
@@ -149,7 +161,56 @@ private:
     word_t pc;
     word_t npc;
     void execute();
-    void run_step(unsigned int &counter);
+    void run_step();
+    uint64_t stepCount = 0; // The devices are updated every 0x1000 steps
+    // Checked with the device updates, stop at a breakpoint if either is hit
+    uint64_t stepLimit = UINT64_MAX;
+    std::atomic<bool> stopRequest = false;
+    void stop_run();
+
+    // Sampling profiler
+    ProfileBuffer *profileBuffer = nullptr;
+    unsigned int profileInterval = 0;
+    unsigned int profileCountdown = 0; // 0 if not sampling
+    unsigned int profileDepth = 0;
+    void profile_sample();
+    bool profile_read_word(word_t vaddr, word_t &data);
+
+    // Execution trace, the ICache is bypassed while tracing to fetch the raw instruction
+    TraceBuffer *traceBuffer = nullptr;
+    word_t traceMemAddr;
+    bool traceMem;
+    unsigned int tracePrivMode;
+    void trace_push(const TraceRecord &record);
+    void trace_inst();
+    void trace_trap(word_t pc, word_t cause, word_t value);
+
+    // Record and replay. The changes of the pending interrupts made by the devices are kept
+    // in irqMask and irqValue, and taken by the hart only at the points below, so the hart sees them
+    // at the same steps when replaying. While replaying the devices are not updated or read,
+    // the values are taken from the log instead.
+    enum ReplayPoint : uint8_t {
+        REPLAY_UPDATE = 0, // The devices are updated
+        REPLAY_WFI    = 1, // wfi waits for an interrupt
+        REPLAY_WRITE  = 2, // The hart writes a device register or stimecmp
+    };
+    utils::ReplayLog *replay = nullptr;
+    word_t irqMask;
+    word_t irqValue;
+    void replay_update_device(ReplayPoint point);
+    void replay_take_interrupt(ReplayPoint point);
+    void replay_device_interrupt(InterruptCode code, bool pending);
+    const utils::ReplayEvent *replay_expect(utils::ReplayEvent::Type type, word_t addr = 0, unsigned int len = 0);
+    word_t replay_mmio_read(word_t paddr, unsigned int len);
+    uint64_t replay_uptime();
+
+    // The harts take turns to run a slice on one thread while recording or replaying,
+    // the one with the fewest slices goes first.
+    static constexpr unsigned int REPLAY_SLICE = 0x1000;
+    unsigned int sliceLeft;
+    uint64_t sliceCount;
+    bool sliceYield; // The rest of the slice is given up by wfi
+    bool end_slice_step();
 
     // Trap
     void enter_trap(TrapCode code, word_t value = 0);
@@ -166,6 +227,17 @@ private:
     void do_invalid_inst(const DecodeInfo &decodeInfo);
     #include "./local-include/inst-list.h"
 
+    // Instruction mix, one counter for each handler in inst-list.h and each instruction length
+    #ifdef CONFIG_INST_MIX
+    struct InstMixHandler {
+        do_inst_t do_inst;
+        const char *name;
+    };
+    static const std::vector<InstMixHandler> &inst_mix_handlers();
+    static unsigned int inst_mix_index(do_inst_t do_inst, unsigned int instLen);
+    std::unique_ptr<utils::PerfCounter[]> instMix;
+    #endif
+
     // Zicsr and Privilleged
     RVCSR csr;
     unsigned int &privMode = csr.privMode; // Priviledge mode
@@ -223,11 +295,14 @@ private:
         do_inst_t do_inst;
         DecodeInfo decodeInfo;
         unsigned int instLen;
+        #ifdef CONFIG_INST_MIX
+        unsigned int mixIndex;
+        #endif
         bool valid = false;
     };
     ICacheBlock icache[1 << config::ICACHE_SET_BITS];
     #endif
-    void icache_push(do_inst_t do_inst, unsigned int instLen, const DecodeInfo &decodeInfo);
+    void icache_push(do_inst_t do_inst, unsigned int instLen, const DecodeInfo &decodeInfo, unsigned int mixIndex);
     bool icache_decode_and_exec();
     void icache_fence();
 
@@ -274,6 +349,39 @@ public:
     word_t get_halt_code() override;
 
     word_t vaddr_translate(word_t vaddr, bool &valid) override;
+
+    CorePerf perf;
+    CorePerf *get_perf() override {
+        return &this->perf;
+    }
+
+    std::vector<InstMixEntry> get_inst_mix() override;
+    void reset_inst_mix() override;
+
+    bool set_profile(ProfileBuffer *buffer, unsigned int interval, unsigned int depth) override;
+    bool set_trace(TraceBuffer *buffer) override;
+
+    void request_stop() override;
+    void set_step_limit(uint64_t n) override;
+
+    void set_replay(utils::ReplayLog *log);
+    uint64_t get_step_count() override;
+    uint64_t get_slice_count() const {
+        return this->sliceCount;
+    }
+    void run_slice(const std::unordered_set<word_t> &breakpoints, bool first);
+
+    // Differential testing, see difftest.h.
+    // The devices are not updated and interrupts are only taken when raised.
+    uint64_t difftest_exec(uint64_t n);
+    bool difftest_skip();
+    void difftest_raise_interrupt(InterruptCode code);
+    void difftest_get_regs(kxemu_difftest_regs_t &regs);
+    void difftest_set_regs(const kxemu_difftest_regs_t &regs);
+    void difftest_fence();
+
+    bool save_state(utils::SnapshotWriter &writer);
+    bool load_state(utils::SnapshotReader &reader);
     
     void   set_timer_interrupt_m();
     void   set_timer_interrupt_s();
@@ -17,6 +17,11 @@ private:
     unsigned int coreCount;
     std::thread *coreThread;
     void core_thread_worker(unsigned int coreID, const word_t *breakpoints, unsigned int n);
+
+    // Run the harts on the calling thread by turns while recording or replaying
+    utils::ReplayLog *replay;
+    void run_serialized(const word_t *breakpoints, unsigned int n);
+    RVCore *next_slice_core(bool started[]);
     
     device::AClint aclint;
     device::PLIC plic;
@@ -33,8 +38,13 @@ public:
     void join() override;
     bool is_running() override;
 
+    bool set_replay(utils::ReplayLog *log) override;
+
     unsigned int core_count() override;
     RVCore *get_core(unsigned int coreID) override;
+
+    bool save_state(utils::SnapshotWriter &writer) override;
+    bool load_state(utils::SnapshotReader &reader) override;
 };
 
 } // namespace kxemu::cpu
@@ -3,6 +3,7 @@
 
 #include "cpu/riscv/def.hpp"
 #include "cpu/word.hpp"
+#include "utils/snapshot.hpp"
 
 #include <functional>
 #include <optional>
@@ -110,6 +111,10 @@ public:
     bool pmp_check_r(word_t addr, int len);
     bool pmp_check_w(word_t addr, int len);
     bool pmp_check_x(word_t addr, int len);
+
+    // Save and restore privilege mode and values of all CSRs, without calling callback functions
+    bool save_state(utils::SnapshotWriter &writer) const;
+    bool load_state(utils::SnapshotReader &reader);
 }; // class RVCSR
 
 } // namespace kxemu::cpu
@@ -1,6 +1,9 @@
 #include "config/config.h"
 
+// Define _INST before including to expand the list in another way
+#ifndef _INST
 #define _INST(name) void do_##name(const DecodeInfo &);
+#endif
 
 _INST(add)
 _INST(sub)
@@ -5,27 +5,57 @@
 #include "cpu/riscv/def.hpp"
 
 #include <cstdint>
+#include <mutex>
+#include <vector>
 
 namespace kxemu::device {
 
 class PLIC : public device::MMIODev {
+public:
+    // The whole address space of the PLIC. Source 0 does not exist.
+    static constexpr unsigned int SOURCE_COUNT  = 1024;
+    static constexpr unsigned int CONTEXT_COUNT = 15872;
+
 private:
     Bus *bus;
-    
-    // We only support 32 targets context and 32 interrput sources.
-    struct InterruptSource {
-        uint32_t priority;
-        bool pending;
-        bool enable[32];
-    };
-    InterruptSource interruptSources[32];
 
+    static constexpr unsigned int WORD_COUNT = SOURCE_COUNT / 32;
+
+    // Harts claim and complete while the device update latches the sources
+    std::mutex mtx;
+
+    uint32_t priority[SOURCE_COUNT];
+    uint32_t pending[WORD_COUNT]; // Bitmap of the pending sources
+    uint32_t pendingWords;        // Bit i is set if pending[i] is not zero
+    uint32_t claimed[WORD_COUNT]; // Bitmap of the sources claimed but not completed
+
+    // Only the contexts of the harts are kept,
+    // context 2 * i is the M-mode of hart i and context 2 * i + 1 is the S-mode.
     struct TargetContext {
+        uint32_t enable[WORD_COUNT];
         uint32_t threshold;
-        uint32_t claim;
         cpu::RVCore *core;
+        // The result of best_source, kept up to date by every change of the pending bits,
+        // priorities, enable bits and threshold, so the harts do not scan the sources.
+        unsigned int best;
+        bool interrupt; // The external interrupt of the hart is raised by this context
     };
-    TargetContext targetContexts[32];
+    std::vector<TargetContext> targetContexts;
+
+    void set_pending(unsigned int source, bool value);
+    void latch_sources();
+
+    // The pending and enabled source with the highest priority above the threshold,
+    // the lowest ID wins a tie. Return 0 if there is none.
+    unsigned int best_source(const TargetContext &target) const;
+    bool better_source(unsigned int source, const TargetContext &target) const;
+    void update_context(unsigned int contextID);
+    void update_all_contexts();
+    void set_context_best(unsigned int contextID, unsigned int best);
+    void push_interrupt(unsigned int contextID);
+
+    uint32_t claim(unsigned int contextID);
+    void complete(unsigned int contextID, uint32_t source);
 
 public:
     void init(cpu::RVCore *cores, unsigned int coreCount);
@@ -34,7 +64,10 @@ public:
     bool write(word_t offset, word_t data, word_t size) override;
     void connect_to_bus(Bus *bus) override;
 
-    void scan_and_set_interrupt(unsigned int hartid, int privMode);
+    void scan_and_set_interrupt();
+
+    bool save_state(utils::SnapshotWriter &writer) override;
+    bool load_state(utils::SnapshotReader &reader) override;
 
     const char *get_type_name() const override {
         return "PLIC";
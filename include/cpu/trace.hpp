@@ -0,0 +1,38 @@
+#ifndef __KXEMU_CPU_TRACE_HPP__
+#define __KXEMU_CPU_TRACE_HPP__
+
+#include "utils/spsc-ring.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+namespace kxemu::cpu {
+
+// A retired instruction, or a trap taken by the hart
+struct TraceRecord {
+    enum Flag : uint8_t {
+        MEM  = 1 << 0, // memAddr is valid
+        TRAP = 1 << 1, // A trap is taken at pc instead of retiring an instruction
+    };
+
+    uint64_t pc;
+    uint64_t value;   // The value written to rd, or the cause of a trap in the format of mcause
+    uint64_t memAddr; // The virtual address of the load or store, or the tval of a trap
+    uint32_t inst;
+    uint8_t rd;       // 0 if no GPR is written
+    uint8_t privMode; // The privilege mode before the instruction or the trap
+    uint8_t flags;
+};
+
+// The records of a hart, pushed by the thread running the hart and drained by the trace writer.
+// Unlike the samples of the profiler, a record is never dropped, the hart waits if the ring is full.
+struct TraceBuffer {
+    static constexpr unsigned int CAPACITY = 1 << 16;
+
+    utils::SPSCRing<TraceRecord, CAPACITY> ring;
+    std::atomic<uint64_t> stalls = 0; // Times the hart found the ring full
+};
+
+} // namespace kxemu::cpu
+
+#endif
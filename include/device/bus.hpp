@@ -3,8 +3,12 @@
 
 #include "device/mmio.hpp"
 #include "device/def.hpp"
+#include "utils/perf.hpp"
 
+#include <atomic>
+#include <cstddef>
 #include <optional>
+#include <string>
 #include <vector>
 #include <iostream>
 #include <cstdint>
@@ -15,22 +19,61 @@ class Bus {
 public:
     ~Bus();
 
+    // How the host memory behind a MemoryBlock is allocated.
+    // ANON     - private anonymous mapping with 4 KiB pages
+    // HUGEPAGE - private anonymous mapping, advised to use transparent huge pages
+    // HUGETLB  - private mapping from the hugetlbfs pool (MAP_HUGETLB)
+    // MEMFD    - shared mapping of a memfd, other processes can map it by the fd
+    enum class MemoryBacking {
+        ANON,
+        HUGEPAGE,
+        HUGETLB,
+        MEMFD,
+    };
+
     class MemoryBlock {
     private:
         word_t start;
         word_t end;
         uint8_t *data;
+
+        MemoryBacking backing;
+        std::size_t mapLength;
+        int fd = -1;
+
+        // One bit for each page, nullptr when dirty tracking is disabled
+        std::atomic<uint64_t> *dirtyBitmap = nullptr;
+        std::size_t dirtyBitmapLength = 0;
     public:
-        MemoryBlock(word_t start, word_t size);
+        MemoryBlock(word_t start, word_t size, MemoryBacking backing = MemoryBacking::ANON);
         ~MemoryBlock();
 
+        bool is_valid() const { return data != nullptr; }
+
         word_t get_start() const { return start; }
         word_t get_end()   const { return end; }
+        MemoryBacking get_backing() const { return backing; }
+        int get_fd() const { return fd; } // Only valid for MEMFD, -1 for others
 
         bool in_range(word_t addr, word_t length = 0) const;
         void *get_ptr(word_t addr) const;
         word_t get_ptr_length(word_t addr) const;
         
+        // Map [offset, offset + length) of fd copy-on-write at addr.
+        // Only whole pages inside the file are mapped, return the mapped length.
+        word_t map_file_private(word_t addr, int fd, word_t offset, word_t length);
+
+        // Dirty page tracking for incremental snapshot.
+        // Stores, AMOs and DMA through Bus::get_ptr(addr, length) mark the pages dirty.
+        static constexpr unsigned int DIRTY_PAGE_SHIFT = 12;
+        static constexpr word_t DIRTY_PAGE_SIZE = 1 << DIRTY_PAGE_SHIFT;
+        void set_dirty_tracking(bool enable);
+        bool is_dirty_tracking() const { return dirtyBitmap != nullptr; }
+        void mark_dirty(word_t addr, word_t length);
+        // Return the start address of pages written since last call, and clear the bitmap.
+        // The caller marks the pages dirty again if it fails to save them.
+        std::vector<word_t> take_dirty_pages();
+
         word_t read(word_t addr, unsigned int length = 0) const;
         bool write(word_t addr, word_t data, unsigned int length = 0);
         word_t do_atomic(word_t addr, word_t data, unsigned int length, AMO amo);
@@ -43,6 +86,7 @@ public:
         word_t size;
         unsigned int id = 0;
         MMIODev *dev;
+        utils::PerfCounter accesses; // Reads and writes dispatched to the device
     };
     std::vector<MMIOMapBlock *> mmioMaps;
 
@@ -50,11 +94,16 @@ public:
     MemoryBlock  *match_memory(word_t addr, word_t length = 0) const;
     bool add_mmio_map  (unsigned int id, word_t start, word_t length, MMIODev *map);
     bool add_mmio_map  (word_t start, word_t size, MMIODev *map);
-    bool add_memory_map(word_t start, word_t size);
+    bool add_memory_map(word_t start, word_t size, MemoryBacking backing = MemoryBacking::ANON);
 
     word_t read (word_t addr, word_t length, bool &valid) const;
     bool   write(word_t addr, word_t data, word_t length);
     void update();
+    utils::PerfCounter updateCount; // Calls of update
+
+    // Enable or disable dirty page tracking of all memory blocks
+    void set_dirty_tracking(bool enable);
+    void mark_dirty(word_t addr, word_t length) const;
 
     std::optional<word_t> do_atomic(word_t addr, word_t data, unsigned int length, AMO amo);
     std::optional<bool> compare_and_swap(word_t addr, void *expected, word_t desired, unsigned int length);
@@ -62,12 +111,22 @@ public:
     bool load_from_stream(std::istream &stream, word_t addr);
     bool load_from_stream(std::istream &stream, word_t addr, word_t length);
     bool load_from_memory(void *src, word_t addr, word_t length);
+    // Read file content straight into the guest memory without bounce buffer.
+    // If cow is set, whole pages are mapped copy-on-write from the file when possible.
+    bool load_from_file(const std::string &filename, word_t addr, bool cow = false);
+    bool load_from_fd(int fd, word_t addr, word_t offset, word_t length, bool cow = false);
     
     bool dump(std::ostream &stream, word_t addr, word_t length) const;
+    bool dump_to_fd(int fd, word_t addr, word_t length) const;
+    bool dump_to_file(const std::string &filename, word_t addr, word_t length) const;
     
     bool memset(word_t addr, word_t length, uint8_t byte);
     bool memcpy(word_t addr, word_t length, void *dest);
+    // Get the host pointer of addr to read, the pages are not marked dirty.
+    // Use it for the guest memory only read by the device, like the descriptors and the avail ring.
     void *get_ptr(word_t addr) const;
+    // Get the host pointer of [addr, addr + length) to read or write,
+    // the pages are marked dirty if dirty tracking is enabled.
     void *get_ptr(word_t addr, word_t length) const;
     word_t get_ptr_length(word_t addr) const;
 };
@@ -0,0 +1,133 @@
+#ifndef __KXEMU_DEVICE_IMAGE_HPP__
+#define __KXEMU_DEVICE_IMAGE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+namespace kxemu::device {
+
+// Backend of the block devices. read and write may be called by several threads
+// at the same time, the iov passed in is consumed.
+class DiskImage {
+protected:
+    uint64_t size = 0;
+
+public:
+    virtual ~DiskImage() = default;
+
+    virtual bool read (struct iovec *iov, std::size_t iovcnt, uint64_t offset) = 0;
+    virtual bool write(struct iovec *iov, std::size_t iovcnt, uint64_t offset) = 0;
+    virtual bool flush() = 0;
+
+    virtual bool is_read_only() const {
+        return false;
+    }
+
+    uint64_t get_size() const {
+        return this->size;
+    }
+};
+
+// A raw image file, read and written in place.
+class RawImage : public DiskImage {
+private:
+    int fd = -1;
+
+public:
+    ~RawImage();
+
+    bool open(const std::string &filepath);
+
+    bool read (struct iovec *iov, std::size_t iovcnt, uint64_t offset) override;
+    bool write(struct iovec *iov, std::size_t iovcnt, uint64_t offset) override;
+    bool flush() override;
+};
+
+// A read-only image file mapped into the host memory, reads are copied from the mapping.
+// The mapping is shared, so the instances running the same image share one copy in the page cache.
+// The file must not be truncated while mapped, or the access raises SIGBUS.
+class MappedImage : public DiskImage {
+private:
+    const uint8_t *data = nullptr;
+
+public:
+    ~MappedImage();
+
+    bool open(const std::string &filepath);
+
+    bool read (struct iovec *iov, std::size_t iovcnt, uint64_t offset) override;
+    bool write(struct iovec *iov, std::size_t iovcnt, uint64_t offset) override;
+    bool flush() override;
+
+    bool is_read_only() const override {
+        return true;
+    }
+};
+
+// A read-only base image with a sparse copy-on-write delta file.
+// The delta file is split into clusters:
+//   header   - OverlayHeader
+//   L1 table - file offsets of the L2 tables, 0 if not allocated
+//   L2 table - one cluster of file offsets of the data clusters, 0 if not allocated
+//   data     - clusters written by the guest, the unallocated clusters are read from the base
+// The whole index is kept in memory, the delta file is only read for data.
+class OverlayImage : public DiskImage {
+private:
+    struct OverlayHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t clusterBits;
+        uint64_t size;     // size of the base image
+        uint64_t l1Offset;
+        uint64_t l1Size;   // number of L1 entries
+    };
+
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t CLUSTER_BITS = 16;
+    static constexpr uint64_t CLUSTER_SIZE = 1ULL << CLUSTER_BITS;
+    static constexpr uint64_t L2_ENTRIES = CLUSTER_SIZE / sizeof(uint64_t);
+
+    std::string basePath;
+    int baseFd  = -1;
+    int deltaFd = -1;
+
+    std::vector<uint64_t> l1;
+    std::vector<std::unique_ptr<uint64_t[]>> l2; // index of l1
+    uint64_t dataStart; // offset of the first cluster after the L1 table
+    uint64_t fileEnd;   // where the next cluster is allocated
+    std::shared_mutex indexMtx;
+
+    bool create_delta();
+    bool load_delta();
+    bool clear_delta();
+
+    uint64_t lookup(uint64_t cluster);
+    uint64_t allocate(uint64_t cluster);
+    bool set_l2_entry(uint64_t cluster, uint64_t clusterOffset);
+
+public:
+    ~OverlayImage();
+
+    // The delta file is created if it does not exist or is empty
+    bool open(const std::string &basePath, const std::string &deltaPath);
+
+    bool read (struct iovec *iov, std::size_t iovcnt, uint64_t offset) override;
+    bool write(struct iovec *iov, std::size_t iovcnt, uint64_t offset) override;
+    bool flush() override;
+
+    // Write the clusters of the delta back to the base image, then discard the delta
+    bool commit();
+    // Drop all the clusters of the delta
+    bool discard();
+
+    uint64_t allocated_clusters();
+};
+
+} // namespace kxemu::device
+
+#endif
@@ -2,6 +2,7 @@
 #define __KXEMU_DEVICE_MMIO_HPP__
 
 #include "device/def.hpp"
+#include "utils/snapshot.hpp"
 
 namespace kxemu::device {
 
@@ -23,6 +24,11 @@ public:
     virtual void clear_interrupt() {}
 
     virtual void connect_to_bus(Bus *bus) {}
+
+    // Complete the requests in the MMIO access which starts them, rather than on a background thread,
+    // so the guest memory and the interrupts change at the same instruction every run.
+    // It is set while recording or replaying.
+    virtual void set_synchronous(bool synchronous) {}
             
     virtual word_t do_atomic(word_t addr, word_t data, int size, AMO amo, bool &valid) {
         valid = false;
@@ -36,6 +42,15 @@ public:
     virtual const char *get_type_name() const {
         return "MMIO";
     }
+
+    // Save and restore the device registers for machine snapshot.
+    // A device without internal state does not need to override them.
+    virtual bool save_state(utils::SnapshotWriter &writer) {
+        return true;
+    }
+    virtual bool load_state(utils::SnapshotReader &reader) {
+        return true;
+    }
 };
 
 } // namespace kxemu::device
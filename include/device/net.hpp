@@ -0,0 +1,126 @@
+#ifndef __KXEMU_DEVICE_NET_HPP__
+#define __KXEMU_DEVICE_NET_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+namespace kxemu::device {
+
+// Fill a received ethernet frame into the buffers, return the length of the frame or -1
+using NetFill = std::function<ssize_t(const struct iovec *iov, std::size_t iovcnt)>;
+
+// The network device side of a backend
+class NetPort {
+public:
+    virtual ~NetPort() = default;
+
+    // Deliver one frame to the device. If the device has no receive buffer, wait for one
+    // for a while if wait is set, or drop the frame. Return false if the frame is dropped.
+    virtual bool receive(const NetFill &fill, bool wait) = 0;
+};
+
+// The host side of a network device, which carries the ethernet frames
+class NetBackend {
+protected:
+    NetPort *port = nullptr;
+
+public:
+    virtual ~NetBackend() = default;
+
+    virtual void attach(NetPort *port) {
+        this->port = port;
+    }
+
+    // Send one frame, the buffers are only used during the call
+    virtual void send(const struct iovec *iov, std::size_t iovcnt) = 0;
+};
+
+// Exchange frames with a peer by a unix datagram socket, one datagram for each frame.
+// The peer is another instance with the same backend, or a NetSwitch.
+class UnixDgramBackend : public NetBackend {
+private:
+    std::string localPath;
+    struct sockaddr_un peer;
+    int fd = -1;
+    int stopPipe[2] = {-1, -1};
+    std::thread reader;
+    void reader_thread();
+
+public:
+    ~UnixDgramBackend();
+
+    // Bind to localPath and send to peerPath
+    bool open(const std::string &localPath, const std::string &peerPath);
+    void attach(NetPort *port) override;
+    void send(const struct iovec *iov, std::size_t iovcnt) override;
+};
+
+// A learning ethernet switch running in this process. The devices of this process are
+// attached directly, and other instances join by sending to the unix datagram socket
+// of the switch with UnixDgramBackend. Frames to unknown or broadcast addresses are flooded.
+class NetSwitch {
+public:
+    using MAC = std::array<uint8_t, 6>;
+
+private:
+    // A port is a device of this process or a remote instance
+    struct Port {
+        NetPort *local = nullptr;
+        struct sockaddr_un remote;
+        socklen_t remoteLength = 0;
+    };
+
+    std::string path;
+    std::mutex mtx;
+    std::vector<std::unique_ptr<Port>> ports;
+    std::map<MAC, Port *> table;
+
+    int fd = -1;
+    int stopPipe[2] = {-1, -1};
+    std::thread reader;
+    void reader_thread();
+
+    Port *find_remote(const struct sockaddr_un &addr, socklen_t length);
+    void forward(Port *from, const struct iovec *iov, std::size_t iovcnt);
+    void deliver(Port *to, const struct iovec *iov, std::size_t iovcnt);
+
+    // The machines in one process share the switches
+    static std::map<std::string, std::unique_ptr<NetSwitch>> switches;
+    static std::mutex switchesMtx;
+
+public:
+    ~NetSwitch();
+
+    bool listen(const std::string &path);
+
+    // The backend of a device attached to the switch directly
+    class LocalBackend : public NetBackend {
+    private:
+        NetSwitch *sw;
+        Port *self = nullptr;
+
+    public:
+        explicit LocalBackend(NetSwitch *sw) : sw(sw) {}
+        ~LocalBackend();
+        void attach(NetPort *port) override;
+        void send(const struct iovec *iov, std::size_t iovcnt) override;
+    };
+
+    // Get the switch listening at path, which is created on the first call
+    static NetSwitch *get(const std::string &path);
+};
+
+} // namespace kxemu::device
+
+#endif
@@ -2,11 +2,15 @@
 #define __KXEMU_DEVICE_UART_HPP__
 
 #include "device/mmio.hpp"
+#include "utils/mpsc-ring.hpp"
+#include "utils/spsc-ring.hpp"
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <ostream>
-#include <queue>
 #include <mutex>
+#include <thread>
 
 #define UART_LENGTH 8
 
@@ -22,6 +26,9 @@ public:
     
     const char *get_type_name() const override;
 
+    bool save_state(utils::SnapshotWriter &writer) override;
+    bool load_state(utils::SnapshotReader &reader) override;
+
     bool putch(uint8_t data);
     void set_output_stream(std::ostream &os);    // send data to stream
     bool open_socket(const std::string &ip, int port); // open socket to send and receive data
@@ -41,12 +48,28 @@ private:
     int sendSocket = -1;
     int recvSocket = -1;
 
-    std::mutex queueMtx;
-    std::queue<uint8_t> queue; // FIFO buffer
+    // Host to guest. Produced by the device update or kdb, consumed by the RBR reads of the guest.
+    // Both sides may be on any thread, so a push or pop is under rxMtx, but the RBR read
+    // checks the ring is empty before taking it, and a polling guest never locks.
+    static constexpr std::size_t RX_BUFFER_SIZE = 1024;
+    utils::SPSCRing<uint8_t, RX_BUFFER_SIZE> rxRing;
+    std::mutex rxMtx;
     void recv_byte(uint8_t c);
-    
-    std::mutex senderMtx;
+
+    // Guest to host. Produced by the THR writes of the guest, consumed by the writer thread,
+    // which writes all the bytes in the ring by one call to the stream or socket.
+    // Any hart may write THR, the harts claim the slots by CAS and none takes a lock.
+    static constexpr std::size_t TX_BUFFER_SIZE = 4096;
+    utils::MPSCRing<uint8_t, TX_BUFFER_SIZE> txRing;
+    std::thread writer;
+    std::mutex writerMtx;
+    std::condition_variable writerCV;
+    std::atomic<bool> writerSleeping = false;
+    bool stopWriter = false;
+    void start_writer();
+    void writer_thread();
     void send_byte(uint8_t c);
+    bool flush_output(const uint8_t *data, std::size_t length);
 
     // Divisor Latch Register
     // [0-7] RW - Divisor Latch
@@ -94,7 +117,10 @@ private:
     // [5] R - Transmitter Holding Register Empty
     // [6] R - Transmitter Empty
     // [7] R - FIFO Data Error
+    // Data Ready is decided by the RX ring when read, and Transmitter Holding Register Empty
+    // is cleared when the TX ring is full.
     uint8_t lsr = 0b00100000; // reset value
+    uint8_t read_lsr();
 
     // NOTE: The following registers are not implemented
     // Modem Status Register
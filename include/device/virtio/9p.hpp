@@ -0,0 +1,79 @@
+#ifndef __KXEMU_DEVICE_VIRTIO_9P_HPP__
+#define __KXEMU_DEVICE_VIRTIO_9P_HPP__
+
+#include "device/def.hpp"
+#include "device/virtio/virtio.hpp"
+#include <cstdint>
+#include <dirent.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace kxemu::device {
+
+// Export a host directory to the guest by 9P2000.L, mounted in a Linux guest by
+//   mount -t 9p -o trans=virtio,version=9p2000.L <tag> <dir>
+// The requests are handled synchronously, Tread and Twrite transfer the data
+// straight between the file and the guest buffers by preadv/pwritev.
+// The paths are resolved component by component beneath the exported directory,
+// a symbolic link is never followed by the host, the guest reads it and walks the target.
+class VirtIO9P : public VirtIO {
+private:
+    struct Fid {
+        std::string path; // relative to the root, empty for the root
+        int fd = -1;
+        DIR *dir = nullptr;
+        int openFlags = 0;
+    };
+
+    std::string root;
+    int rootFd;
+    std::unordered_map<uint32_t, Fid> fids;
+    uint32_t msize = 8192;
+
+    std::vector<uint8_t> configBuffer; // struct virtio_9p_config
+
+    // Scratch buffers of a request, only used under the notifyMtx of the queue
+    std::vector<struct iovec> reqIov;
+    std::vector<struct iovec> respIov;
+    std::vector<struct iovec> dataIov;
+    std::vector<uint8_t> reqBuffer;
+    std::vector<uint8_t> respBuffer;
+
+    bool virtio_handle_req(const std::vector<Buffer> &buffer, uint32_t &len) override;
+    bool get_device_features_bit(unsigned int bit) override;
+
+    // Handle one message, the response is put in respBuffer, or written to respIov directly
+    uint32_t handle_message();
+    uint32_t finish_response();
+
+    Fid *get_fid(uint32_t fid);
+    void clunk(uint32_t fid);
+    void clunk_all();
+    bool reopen(Fid &fid);
+
+    // Open the directory at path, or the directory containing path and set name to
+    // the last component. The fd is closed by the caller, -1 with errno on failure.
+    int open_dir(const std::string &path) const;
+    int open_parent(const std::string &path, std::string &name) const;
+
+public:
+    VirtIO9P(const std::string &root, const std::string &tag);
+    ~VirtIO9P();
+
+    bool is_valid() const;
+
+    void reset() override;
+    bool save_state(utils::SnapshotWriter &writer) override;
+    bool load_state(utils::SnapshotReader &reader) override;
+
+    const char *get_type_name() const override {
+        return "virtio-9p";
+    }
+};
+
+} // namespace kxemu::device
+
+#endif
@@ -2,23 +2,50 @@
 #define __KXEMU_DEVICE_VIRTIO_BLOCK_HPP__
 
 #include "device/def.hpp"
+#include "device/image.hpp"
 #include "device/virtio/virtio.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
-#include <fstream>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
 
 namespace kxemu::device {
 
+// Each virtqueue is served by its own worker thread, so the vCPU does not
+// wait for the host I/O in the QueueNotify write, and the harts of an SMP guest
+// submit to their own queues (VIRTIO_BLK_F_MQ) without contending for one lock.
+// The data is transferred by preadv/pwritev straight between the image file
+// and the guest memory, the positioned I/O shares no file offset between workers.
 class VirtIOBlock : public VirtIO {
 private:
-    bool virtio_handle_req(const std::vector<Buffer> &buffer, uint32_t &len) override;
-
-    bool blk_read (uint32_t sector, uint32_t len, word_t bufferAddr, uint8_t *status);
-    bool blk_write(uint32_t sector, uint32_t len, word_t bufferAddr, uint8_t *status);
-
-    std::fstream fstream;
-    std::size_t imgSize;
-    std::mutex streamMtx;
+    // struct virtio_blk_config, only capacity and num_queues are used
+    struct Config {
+        uint64_t capacity; // in 512-byte sectors
+        uint32_t size_max;
+        uint32_t seg_max;
+        struct {
+            uint16_t cylinders;
+            uint8_t heads;
+            uint8_t sectors;
+        } geometry;
+        uint32_t blk_size;
+        struct {
+            uint8_t physical_block_exp;
+            uint8_t alignment_offset;
+            uint16_t min_io_size;
+            uint32_t opt_io_size;
+        } topology;
+        uint8_t writeback;
+        uint8_t unused0;
+        uint16_t num_queues;
+    } config;
+    static_assert(offsetof(Config, num_queues) == 34, "Layout of struct virtio_blk_config mismatch");
 
     struct BufferHead {
         uint32_t type;
@@ -26,11 +53,67 @@ private:
         uint64_t sector;
     };
 
+    struct Request {
+        unsigned int queueIndex;
+        unsigned int descIndex;
+        uint32_t type;
+        uint64_t sector;
+        std::vector<struct iovec> iov; // data buffers in the guest memory
+        uint8_t *status;
+    };
+
+    void virtio_submit_req(unsigned int queueIndex, unsigned int descIndex, const std::vector<Buffer> &buffer) override;
+    bool get_device_features_bit(unsigned int bit) override;
+
+    uint8_t blk_execute(Request &req, uint32_t &len);
+    bool blk_read (uint64_t sector, std::vector<struct iovec> &iov, uint32_t &len);
+    bool blk_write(uint64_t sector, std::vector<struct iovec> &iov);
+
+    std::unique_ptr<DiskImage> image;
+
+    // One worker thread per virtqueue
+    static constexpr unsigned int BATCH_MAX = 32;
+    static constexpr unsigned int SPARE_IOV_MAX = 64;
+    struct Worker {
+        std::thread thread;
+        std::mutex reqMtx;
+        std::condition_variable reqCV;  // notify the worker new requests
+        std::condition_variable idleCV; // notify all requests of the queue are completed
+        std::deque<Request> reqQueue;
+        std::vector<std::vector<struct iovec>> spareIov; // iov storage of the completed requests
+        unsigned int inflight = 0;      // submitted but not completed requests
+        bool stop = false;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    void worker_thread(Worker *worker);
+    void wait_idle();
+    std::atomic<bool> synchronous = false; // Wait for the worker in the notify
+
 public:
-    VirtIOBlock();
+    // Each queue has a host thread, so the count is capped
+    static constexpr unsigned int MAX_QUEUES = 64;
+
+    VirtIOBlock(unsigned int queueCount = 1);
     ~VirtIOBlock();
 
     bool open_raw_img(const std::string &filepath);
+    bool open_mapped_img(const std::string &filepath);
+    bool open_overlay_img(const std::string &basePath, const std::string &deltaPath);
+
+    // Only for the overlay image, nullptr otherwise
+    OverlayImage *get_overlay();
+    // Wait for the requests in flight, then commit or discard the delta of the overlay image
+    bool commit_overlay();
+    bool discard_overlay();
+
+    void reset() override;
+    void set_synchronous(bool synchronous) override;
+    bool save_state(utils::SnapshotWriter &writer) override;
+    bool load_state(utils::SnapshotReader &reader) override;
+
+    const char *get_type_name() const override {
+        return "virtio-blk";
+    }
 };
 
 } // namepace kxemu::device
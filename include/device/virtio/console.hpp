@@ -0,0 +1,53 @@
+#ifndef __KXEMU_DEVICE_VIRTIO_CONSOLE_HPP__
+#define __KXEMU_DEVICE_VIRTIO_CONSOLE_HPP__
+
+#include "device/def.hpp"
+#include "device/virtio/virtio.hpp"
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kxemu::device {
+
+// A single port virtio console. The transmitq is written to the output by one writev
+// for each descriptor chain, instead of one MMIO access for each byte as the UART.
+// The receiveq is filled by a reader thread when the output is a socket.
+class VirtIOConsole : public VirtIO {
+private:
+    static constexpr unsigned int RECEIVEQ  = 0;
+    static constexpr unsigned int TRANSMITQ = 1;
+
+    void virtio_submit_req(unsigned int queueIndex, unsigned int descIndex, const std::vector<Buffer> &buffer) override;
+
+    void transmit(unsigned int descIndex, const std::vector<Buffer> &buffer);
+
+    int fd = -1;
+    bool ownFd = false;
+    bool isSocket = false;
+
+    // The receiveq is held in rxChains until input comes
+    std::thread reader;
+    int stopPipe[2] = {-1, -1};
+    bool stopReader = false;
+    void reader_thread();
+
+public:
+    VirtIOConsole();
+    ~VirtIOConsole();
+
+    // The output is the standard output
+    void open_stdout();
+    // The output is appended to the file
+    bool open_file(const std::string &filepath);
+    // Connect to a unix stream socket, the input is also read from it
+    bool open_unix_socket(const std::string &path);
+
+    const char *get_type_name() const override {
+        return "virtio-console";
+    }
+};
+
+} // namespace kxemu::device
+
+#endif
@@ -20,6 +20,16 @@
 #define VIRTQ_DESC_F_INDIRECT 4
 
 #define VIRTQ_USED_F_NO_NOTIFY 1
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+
+// Transport feature bits
+#define VIRTIO_F_INDIRECT_DESC 28
+#define VIRTIO_F_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1     32
+
+// InterruptStatus bits
+#define VIRTIO_INT_USED_BUFFER 1
+#define VIRTIO_INT_CONFIG      2
 
 // Virtio BLOCK
 #define VIRTIO_BLK_DEVICE_ID 2
@@ -32,6 +42,7 @@
 #define VIRTIO_BLK_F_FLUSH         9
 #define VIRTIO_BLK_F_TOPOLOGY     10
 #define VIRTIO_BLK_F_CONFIG_WCE   11
+#define VIRTIO_BLK_F_MQ           12
 #define VIRTIO_BLK_F_DISCARD      13
 #define VIRTIO_BLK_F_WRITE_ZEROES 14
 
@@ -44,5 +55,25 @@
 #define VIRTIO_BLK_T_WRITE_ZEROES 13
 #define VIRTIO_BLK_T_SECURE_ERASE 14
 
+#define VIRTIO_BLK_S_OK     0
+#define VIRTIO_BLK_S_IOERR  1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+// Virtio Network
+#define VIRTIO_NET_DEVICE_ID 1
+
+#define VIRTIO_NET_F_MAC     5
+#define VIRTIO_NET_F_STATUS 16
+
+#define VIRTIO_NET_S_LINK_UP 1
+
+// Virtio Console
+#define VIRTIO_CONSOLE_DEVICE_ID 3
+
+// Virtio 9P Transport
+#define VIRTIO_9P_DEVICE_ID 9
+
+#define VIRTIO_9P_F_MOUNT_TAG 0
+
 
 #endif
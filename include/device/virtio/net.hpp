@@ -0,0 +1,66 @@
+#ifndef __KXEMU_DEVICE_VIRTIO_NET_HPP__
+#define __KXEMU_DEVICE_VIRTIO_NET_HPP__
+
+#include "device/def.hpp"
+#include "device/net.hpp"
+#include "device/virtio/virtio.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <sys/uio.h>
+
+namespace kxemu::device {
+
+// A virtio network device with one pair of receiveq and transmitq.
+// The frames are passed between the guest buffers and the backend without a copy in between,
+// the backend reads from or writes into the guest memory from Bus::get_ptr.
+class VirtIONet : public VirtIO, public NetPort {
+private:
+    static constexpr unsigned int RECEIVEQ  = 0;
+    static constexpr unsigned int TRANSMITQ = 1;
+
+    // struct virtio_net_hdr of VIRTIO_F_VERSION_1, every frame is prefixed by it
+    struct NetHeader {
+        uint8_t  flags;
+        uint8_t  gso_type;
+        uint16_t hdr_len;
+        uint16_t gso_size;
+        uint16_t csum_start;
+        uint16_t csum_offset;
+        uint16_t num_buffers;
+    };
+
+    struct Config {
+        uint8_t mac[6];
+        uint16_t status;
+    } config;
+
+    void virtio_submit_req(unsigned int queueIndex, unsigned int descIndex, const std::vector<Buffer> &buffer) override;
+    bool get_device_features_bit(unsigned int bit) override;
+
+    void transmit(unsigned int descIndex, const std::vector<Buffer> &buffer);
+    std::vector<struct iovec> txIov; // Only used under the notifyMtx of the transmitq
+
+    std::unique_ptr<NetBackend> backend;
+
+    // The receiveq is held in rxChains until frames come
+    std::vector<struct iovec> rxIov;  // Only used under the rxMtx
+    std::vector<struct iovec> rxData;
+
+public:
+    VirtIONet(const uint8_t mac[6]);
+    ~VirtIONet();
+
+    // The device owns the backend
+    void set_backend(std::unique_ptr<NetBackend> backend);
+
+    bool receive(const NetFill &fill, bool wait) override;
+
+    const char *get_type_name() const override {
+        return "virtio-net";
+    }
+};
+
+} // namespace kxemu::device
+
+#endif
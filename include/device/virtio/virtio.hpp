@@ -3,7 +3,10 @@
 
 #include "device/bus.hpp"
 #include "device/def.hpp"
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <mutex>
 #include <vector>
 
@@ -45,9 +48,16 @@ protected:
     virtual bool update_configuration(const void *newConfig) { return true; };
 
     // Device Features
+    // The transport features (indirect descriptors, event index and version 1) are handled here,
+    // the device specific features are handled by the get_device_features_bit and set_driver_features_bit.
+    static constexpr unsigned int FEATURES_NUM_MAX = 64;
     unsigned int featuresNumMax;
     virtual bool get_device_features_bit(unsigned int bit) { return false; }
     virtual void set_driver_features_bit(unsigned int bit, bool value) {}
+    bool get_features_bit(unsigned int bit);
+    void set_features_bit(unsigned int bit, bool value);
+    bool indirectDesc = false; // VIRTIO_F_INDIRECT_DESC is negotiated
+    bool eventIdx = false;     // VIRTIO_F_EVENT_IDX is negotiated
 
     // Virtqueue
     struct VirtQueueDescriptor {
@@ -76,6 +86,12 @@ protected:
         uint32_t len;
     };
 
+    struct Buffer {
+        word_t addr;
+        word_t len;
+        bool write;
+    };
+
     unsigned int queueCount = 0;
     struct VirtQueue {
         uint64_t p_desc  = 0;  // 0x80, 0x84 Pointer to Descriptor Table
@@ -84,20 +100,44 @@ protected:
         uint32_t queueNum = 12;
         bool ready = false;
         uint16_t lastAvailIndex = 0;
+        std::vector<Buffer> buffer; // Scratch buffer for the chain being parsed
+        std::mutex notifyMtx;       // Harts may notify the same queue at the same time
     };
     VirtQueue *virtQueues;
 
-    struct Buffer {
-        word_t addr;
-        word_t len;
-        bool write;
-    };
+    // The host pointer of [addr, addr + length) in the guest memory, nullptr if it is not all in one region.
+    // Only the memory written by the device is marked dirty.
+    void *get_guest_ptr(word_t addr, word_t length, bool write);
+
+    // Read the descriptor chain starting at descIdx into queue.buffer, following the indirect table.
+    // An invalid chain is returned to the used ring with no bytes written.
+    bool virtq_read_chain(VirtQueue &queue, const VirtQueueDescriptor *descriptors, uint16_t descIdx);
 
-    virtual bool virtio_handle_req(const std::vector<Buffer> &buffer, uint32_t &len) = 0;
+    // Handle a request synchronously, len is set to the bytes written to the device-writable buffers.
+    virtual bool virtio_handle_req(const std::vector<Buffer> &buffer, uint32_t &len) { return false; }
+
+    // Called for each available descriptor chain, handle it by virtio_handle_req by default.
+    // Devices with an asynchronous backend override it and call virtio_handle_done
+    // with the mtx locked when the request is completed.
+    virtual void virtio_submit_req(unsigned int queueIndex, unsigned int descIndex, const std::vector<Buffer> &buffer);
 
     void virtio_handle_done(uint32_t len, unsigned int queueIndex, unsigned int descIndex);
 
-    bool interrupt = false;
+    // Chains of a receive queue held until the device has data for them, like the input of
+    // the console and the frames of the network. They are taken from the avail ring but not
+    // in the used ring yet, so they are dropped by reset and kept in the snapshot.
+    struct RxChain {
+        unsigned int descIndex;
+        std::vector<Buffer> buffer;
+    };
+    static constexpr uint32_t RX_CHAIN_MAX = 1024;
+    std::mutex rxMtx; // Locked before mtx
+    std::condition_variable rxCV; // Notified when a chain is held
+    std::deque<RxChain> rxChains;
+    void hold_rx_chain(unsigned int descIndex, const std::vector<Buffer> &buffer);
+
+    std::atomic<bool> interrupt = false;
+    std::atomic<uint32_t> interruptStatus = 0; // 0x60 InterruptStatus
     bool interrupt_pending() override;
     void clear_interrupt() override;
 
@@ -111,6 +151,9 @@ public:
     word_t read(word_t offset, word_t size, bool &valid) override;
     bool write(word_t offset, word_t data, word_t size) override;
     void connect_to_bus(Bus *bus) override;
+
+    bool save_state(utils::SnapshotWriter &writer) override;
+    bool load_state(utils::SnapshotReader &reader) override;
 };
 
 } // namespace kxemu::device
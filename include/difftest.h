@@ -0,0 +1,95 @@
+#ifndef __KXEMU_DIFFTEST_H__
+#define __KXEMU_DIFFTEST_H__
+
+// The C interface to use KXemu as the reference model (REF) of differential testing,
+// exported by the shared object built with CONFIG_TARGET_SHARE.
+//
+// The design under test (DUT) copies its memory and registers to the REF once, then for each batch
+// of instructions it retires, calls kxemu_difftest_exec and compares the registers copied back.
+// The REF does not update the devices or take interrupts by itself, the DUT skips the instructions
+// accessing devices and raises the interrupts it takes.
+//
+// The interface only grows: the functions are not changed once released, and the register file
+// only gets new fields at the end. Check kxemu_difftest_version before using the new ones.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KXEMU_DIFFTEST_VERSION 1
+
+#define KXEMU_DIFFTEST_EXPORT __attribute__((visibility("default")))
+
+enum {
+    KXEMU_DIFFTEST_TO_DUT = 0,
+    KXEMU_DIFFTEST_TO_REF = 1,
+};
+
+enum {
+    KXEMU_DIFFTEST_RUNNING = 0,
+    KXEMU_DIFFTEST_HALT    = 1, // ebreak when CONFIG_HALT_WHEN_BREAK is set, see kxemu_difftest_halt_code
+    KXEMU_DIFFTEST_ERROR   = 2,
+};
+
+// The registers of a hart, the fields are 64-bit on RV32 too
+typedef struct {
+    uint64_t gpr[32];
+    uint64_t pc;
+    uint64_t fpr[32];  // The raw bits, single-precision values are NaN-boxed
+    uint64_t fcsr;
+    uint64_t priv;     // 0 U-mode, 1 S-mode, 3 M-mode
+    uint64_t mstatus;
+    uint64_t mtvec;
+    uint64_t mepc;
+    uint64_t mcause;
+    uint64_t mtval;
+    uint64_t mscratch;
+    uint64_t medeleg;
+    uint64_t mideleg;
+    uint64_t mie;
+    uint64_t mip;
+    uint64_t stvec;
+    uint64_t sepc;
+    uint64_t scause;
+    uint64_t stval;
+    uint64_t sscratch;
+    uint64_t satp;
+} kxemu_difftest_regs_t;
+
+KXEMU_DIFFTEST_EXPORT unsigned int kxemu_difftest_version(void);
+
+// Create the harts and the memory of [memBase, memBase + memSize), the harts start at memBase.
+// Return 0 on success.
+KXEMU_DIFFTEST_EXPORT int  kxemu_difftest_init(unsigned int hartCount, uint64_t memBase, uint64_t memSize);
+KXEMU_DIFFTEST_EXPORT void kxemu_difftest_deinit(void);
+
+// Copy n bytes between buf and the memory of the REF
+KXEMU_DIFFTEST_EXPORT void kxemu_difftest_memcpy(uint64_t addr, void *buf, size_t n, int direction);
+// Mirror a store of the DUT which the REF does not execute, like a DMA of a DUT device.
+// len is 1, 2, 4 or 8, return 0 on success.
+KXEMU_DIFFTEST_EXPORT int  kxemu_difftest_mem_write(uint64_t addr, uint64_t data, unsigned int len);
+
+KXEMU_DIFFTEST_EXPORT void kxemu_difftest_regcpy(unsigned int hart, kxemu_difftest_regs_t *regs, int direction);
+
+// Execute at most n instructions or traps on the hart, stop early if it halts.
+// Return the number executed.
+KXEMU_DIFFTEST_EXPORT uint64_t kxemu_difftest_exec(unsigned int hart, uint64_t n);
+// Step over the instruction at the pc without executing it, as the DUT has executed it with
+// side effects the REF cannot reproduce, like a load from a device. Copy the registers
+// written by it from the DUT afterwards. Return 0 on success.
+KXEMU_DIFFTEST_EXPORT int  kxemu_difftest_skip(unsigned int hart);
+// Take the interrupt before the instruction at the pc, cause is the code without the top bit
+// and less than XLEN. Return 0 on success.
+KXEMU_DIFFTEST_EXPORT int  kxemu_difftest_raise_intr(unsigned int hart, uint64_t cause);
+
+KXEMU_DIFFTEST_EXPORT int      kxemu_difftest_state(unsigned int hart);
+KXEMU_DIFFTEST_EXPORT uint64_t kxemu_difftest_halt_code(unsigned int hart);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,8 +20,7 @@ namespace kxemu::isa {
     const char *get_isa_name();
     int get_elf_expected_machine();
     const char *get_gdb_target_desc();
-
-    cpu::CPU<word_t> *new_cpu();
+    const char *get_priv_name(unsigned int mode); // Name of a privilege mode of the core
 
     // Register
     unsigned int get_gpr_count();
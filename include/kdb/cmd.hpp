@@ -46,6 +46,10 @@ namespace kxemu::kdb::cmd {
     int gdb     (const args_t &); // run gdb rsp
     int device  (const args_t &); // device command
     int set     (const args_t &); // set command
+    int snapshot(const args_t &); // save or load machine snapshot
+    int profile (const args_t &); // sampling profiler
+    int trace   (const args_t &); // binary execution trace
+    int replay  (const args_t &); // record and replay
 
     // do command return code
     enum Code {
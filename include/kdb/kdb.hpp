@@ -6,6 +6,7 @@
 #include "cpu/cpu.hpp"
 #include "device/bus.hpp"
 #include "isa/isa.hpp"
+#include "machine.hpp"
 
 #include <cstddef>
 #include <optional>
@@ -26,34 +27,19 @@ namespace kxemu::kdb {
     // GDB connection
     bool run_gdb(const std::string &addr);
 
-    // CPU execution
+    // The machine debugged, cpu and bus are its parts
+    extern Machine *machine;
     extern cpu::CPU<word_t> *cpu;
+    extern device::Bus *bus;
+
+    // CPU execution
     extern int returnCode; // set when a core halt
     void reset_cpu();
     void reset_cpu(word_t entry);
     int run_cpu();
     int step_core(unsigned int coreID);
 
-    // Device
-    extern device::Bus *bus;
-    namespace device {
-        void init();
-        void add(kxemu::device::MMIODev *dev);
-        void deinit();
-    }
-
-    // Uart
-    namespace uart{
-        extern std::vector<kxemu::device::Uart16650 *> list;
-        bool add(unsigned int id, word_t base, std::ostream &os);
-        bool add(unsigned int id, word_t base, const std::string &ip, int port);
-        bool puts(std::size_t index, const std::string &s);
-
-        void deinit();
-    };
-
     // Breakpoint
-    extern std::unordered_set<word_t> breakpointSet;
     extern bool brkTriggered;
     void add_breakpoint(word_t addr);
     bool remove_breakpoint(word_t addr);
@@ -62,10 +48,64 @@ namespace kxemu::kdb {
     std::optional<word_t> load_elf(const std::string &filename);
     std::optional<std::string> addr_match_symbol(word_t addr, word_t &offset);
     bool load_symbol(const std::string &filename);
-    extern std::map<word_t, std::string> symbolTable;
-    extern word_t programEntry;
+
+    // Snapshot
+    bool save_snapshot(const std::string &dir);
+    bool save_snapshot_delta(const std::string &dir); // pages written since the previous snapshot
+    bool load_snapshot(const std::string &dir, const std::vector<std::string> &deltas = {});
+
+    // Performance counters of the emulator
+    namespace perf {
+        extern std::string jsonFile; // Dumped at exit if not empty
+        void print(std::ostream &os);
+        void print_inst_mix(std::ostream &os, unsigned int coreID); // Sorted by the count
+        void write_json(std::ostream &os);
+        bool dump_json(const std::string &filename);
+        void reset();
+    }
+
+    // Sampling profiler, the samples are folded into stacks for flamegraph tools
+    namespace profile {
+        bool start(unsigned int interval, unsigned int depth);
+        void stop();
+        bool is_running();
+        uint64_t sample_count();
+        uint64_t dropped_count();
+        bool dump(const std::string &filename); // Write the folded stacks
+        void write_folded(std::ostream &os);
+    }
+
+    // Binary execution trace, the format is described in docs/trace.md
+    namespace trace {
+        bool start(const std::string &filename);
+        bool stop(); // false if the trace is not fully written
+        bool is_running();
+        uint64_t record_count();
+        uint64_t byte_count();
+        uint64_t stall_count(); // Times a hart waited for the writer
+    }
+
+    // Headless run, the summary is described in docs/kdb.md
+    namespace batch {
+        // Load an ELF file, or a raw binary at the entry. Create the memory if there is none.
+        bool load_kernel(const std::string &filename);
+        // Run until all harts stop, after at most maxInsns steps of each hart and timeout seconds if not 0.
+        // Write the summary as JSON to os and return the exit code of the process.
+        int run(uint64_t maxInsns, double timeout, std::ostream &os);
+    }
+
+    // Record and replay the nondeterministic inputs, the format is described in docs/replay.md
+    namespace replay {
+        bool record(const std::string &filename);
+        bool play(const std::string &filename);
+        void stop();
+        bool is_running();
+        bool is_recording();
+        uint64_t event_count(); // Events recorded or replayed
+    }
 
     word_t string_to_addr(const std::string &s, bool &success);
+    std::optional<kxemu::device::Bus::MemoryBacking> string_to_memory_backing(const std::string &s);
 } // kdb
 
 #endif
@@ -0,0 +1,93 @@
+#ifndef __KXEMU_MACHINE_HPP__
+#define __KXEMU_MACHINE_HPP__
+
+#include "cpu/cpu.hpp"
+#include "device/bus.hpp"
+#include "device/mmio.hpp"
+#include "device/uart.hpp"
+#include "isa/isa.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace kxemu {
+
+// A guest: the harts with their interrupt controllers and timers, the bus, the memory and the devices.
+// Machines share no state, so a process can create several of them and run each on its own thread.
+class Machine {
+public:
+    using word_t = isa::word_t;
+    static constexpr word_t DEFAULT_ENTRY = 0x80000000;
+
+private:
+    device::Bus *bus;
+    cpu::CPU<word_t> *cpu;
+    std::vector<device::MMIODev *> devices; // Deleted with the machine
+    std::vector<device::Uart16650 *> uarts;
+
+    word_t entry;
+    std::unordered_set<word_t> breakpoints;
+    std::vector<word_t> runBreakpoints; // Read by the harts until they stop
+    std::map<word_t, std::string> symbolTable;
+
+    bool add_uart_map(unsigned int id, word_t base, device::Uart16650 *uart);
+
+public:
+    explicit Machine(unsigned int coreCount = 1);
+    ~Machine();
+    Machine(const Machine &) = delete;
+    Machine &operator=(const Machine &) = delete;
+
+    device::Bus *get_bus() const { return this->bus; }
+    cpu::CPU<word_t> *get_cpu() const { return this->cpu; }
+
+    // Memory and devices
+    bool add_memory(word_t base, word_t size, device::Bus::MemoryBacking backing = device::Bus::MemoryBacking::ANON);
+    // Map dev to [base, base + size) and take it, dev is deleted if it cannot be mapped
+    bool add_device(unsigned int id, word_t base, word_t size, device::MMIODev *dev);
+    // Take a device mapped by the caller
+    void add_device(device::MMIODev *dev);
+    bool add_uart(unsigned int id, word_t base, std::ostream &os);
+    bool add_uart(unsigned int id, word_t base, const std::string &ip, int port);
+    bool uart_puts(std::size_t index, const std::string &s);
+
+    // Program
+    bool load_image(const std::string &filename, word_t addr);
+    word_t get_entry() const { return this->entry; }
+    void set_entry(word_t entry) { this->entry = entry; }
+    void reset();
+    void reset(word_t entry);
+
+    // Breakpoints
+    void add_breakpoint(word_t addr);
+    bool remove_breakpoint(word_t addr);
+    const std::unordered_set<word_t> &get_breakpoints() const { return this->breakpoints; }
+
+    // Symbols of the loaded program, by address
+    std::map<word_t, std::string> &get_symbol_table() { return this->symbolTable; }
+
+    // Run all harts on the calling thread until they halt, stop at a breakpoint or fail
+    void run();
+    void step(unsigned int coreID);
+    // Run all harts in the background, join waits until they stop
+    void start();
+    void join();
+    bool is_running() const;
+    // Stop the harts at a breakpoint soon, it can be called from other threads
+    void stop();
+    // Stop each hart at a breakpoint after about n more steps
+    void set_step_limit(uint64_t n);
+
+    // The first error or non-zero halt code of the harts, 0 if all halt with 0.
+    // A non-zero halt code is truncated to 8 bits as the exit status, 1 if its low 8 bits are 0.
+    int get_exit_code() const;
+};
+
+} // namespace kxemu
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __KXEMU_UTILS_MPSC_RING_HPP__
+#define __KXEMU_UTILS_MPSC_RING_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+namespace kxemu::utils {
+
+// A fixed capacity ring buffer for several producer threads and one consumer thread.
+// A producer claims a slot by a CAS on the reserve index, fills it, and publishes it by
+// moving the tail after the producers claimed before it have published theirs, so the
+// consumer always sees the elements in the order claimed. Neither side takes a lock.
+template<typename T, std::size_t Capacity>
+class MPSCRing {
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+private:
+    static constexpr std::size_t MASK = Capacity - 1;
+
+    alignas(64) std::atomic<std::size_t> head = 0;
+    alignas(64) std::atomic<std::size_t> reserve = 0;
+    alignas(64) std::atomic<std::size_t> tail = 0;
+    alignas(64) T data[Capacity];
+
+public:
+    // Producer side, any thread
+    bool push(const T &value) {
+        std::size_t r = this->reserve.load(std::memory_order_relaxed);
+        do {
+            if (r - this->head.load(std::memory_order_acquire) >= Capacity) {
+                return false;
+            }
+        } while (!this->reserve.compare_exchange_weak(r, r + 1, std::memory_order_relaxed));
+
+        this->data[r & MASK] = value;
+        // Only waits for a producer which claimed an earlier slot and is still filling it
+        while (this->tail.load(std::memory_order_acquire) != r) {
+            std::this_thread::yield();
+        }
+        this->tail.store(r + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, get the readable elements which are contiguous in memory
+    std::size_t front_span(const T *&p) const {
+        std::size_t h = this->head.load(std::memory_order_relaxed);
+        std::size_t n = this->tail.load(std::memory_order_acquire) - h;
+        p = &this->data[h & MASK];
+        return n < Capacity - (h & MASK) ? n : Capacity - (h & MASK);
+    }
+
+    // Consumer side, drop n elements got by front_span
+    void consume(std::size_t n) {
+        this->head.store(this->head.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    std::size_t size() const {
+        return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return this->size() == 0;
+    }
+
+    // Counts the slots claimed but not published yet, a push now would fail
+    bool full() const {
+        return this->reserve.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire) >= Capacity;
+    }
+
+    static constexpr std::size_t capacity() {
+        return Capacity;
+    }
+};
+
+} // namespace kxemu::utils
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __KXEMU_UTILS_PERF_HPP__
+#define __KXEMU_UTILS_PERF_HPP__
+
+#include "config/config.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace kxemu::utils {
+
+// A counter of the emulator itself, read by kdb at any time.
+// inc() is for the counters written by only one thread, such as the counters of a hart,
+// it is a relaxed load and store instead of a locked read-modify-write.
+// inc_shared() is for the counters written by several threads.
+class PerfCounter {
+private:
+    std::atomic<uint64_t> value = 0;
+
+public:
+    void inc() {
+        this->value.store(this->value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void inc_shared() {
+        this->value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return this->value.load(std::memory_order_relaxed);
+    }
+
+    void reset() {
+        this->value.store(0, std::memory_order_relaxed);
+    }
+};
+
+} // namespace kxemu::utils
+
+// The counters are compiled out without CONFIG_PERF
+#ifdef CONFIG_PERF
+#define PERF_INC(counter) (counter).inc()
+#define PERF_INC_SHARED(counter) (counter).inc_shared()
+#else
+#define PERF_INC(counter) ((void)0)
+#define PERF_INC_SHARED(counter) ((void)0)
+#endif
+
+#endif
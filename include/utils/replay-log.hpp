@@ -0,0 +1,88 @@
+#ifndef __KXEMU_UTILS_REPLAY_LOG_HPP__
+#define __KXEMU_UTILS_REPLAY_LOG_HPP__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace kxemu::utils {
+
+// A nondeterministic input seen by a hart, at the step count of the hart when it was delivered
+struct ReplayEvent {
+    enum Type : uint8_t {
+        TIME      = 0, // The value of the wall clock read by the hart
+        MMIO      = 1, // The value of a device register loaded by the hart
+        INTERRUPT = 2, // The pending interrupt bits after the hart took the changes of the devices
+    };
+
+    uint8_t type;
+    uint8_t arg;    // MMIO: the access length, INTERRUPT: where the hart took the changes
+    unsigned int hart;
+    uint64_t step;
+    uint64_t value;
+    uint64_t addr;  // MMIO: the physical address
+};
+
+// The events of all harts in the order they happen, written while recording and read back while replaying.
+// The harts are run one after another on a single thread in both modes, so the log has no lock.
+// The format is described in docs/replay.md.
+class ReplayLog {
+public:
+    enum Mode {
+        RECORD,
+        REPLAY,
+    };
+
+private:
+    Mode mode;
+    std::FILE *file = nullptr;
+    unsigned int hartCount;
+    uint64_t eventCount;
+
+    // The state of the delta encoding of a hart
+    struct HartState {
+        uint64_t step = 0;
+        uint64_t time = 0;
+    };
+    std::vector<HartState> states;
+
+    ReplayEvent nextEvent; // REPLAY: the event returned by peek
+    bool hasNext;
+
+    void put_varint(uint64_t v);
+    bool get_varint(uint64_t &v);
+    bool read_event();
+
+public:
+    ~ReplayLog();
+
+    bool open_record(const std::string &filename, unsigned int hartCount);
+    bool open_replay(const std::string &filename, unsigned int hartCount);
+    void close();
+
+    bool is_open() const {
+        return this->file != nullptr;
+    }
+    Mode get_mode() const {
+        return this->mode;
+    }
+
+    // RECORD
+    void write(const ReplayEvent &event);
+
+    // REPLAY, the next event or nullptr at the end of the log
+    const ReplayEvent *peek() const {
+        return this->hasNext ? &this->nextEvent : nullptr;
+    }
+    void next();
+
+    // The events written or consumed
+    uint64_t event_count() const {
+        return this->eventCount;
+    }
+};
+
+} // namespace kxemu::utils
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __KXEMU_UTILS_SNAPSHOT_HPP__
+#define __KXEMU_UTILS_SNAPSHOT_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+namespace kxemu::utils {
+
+// Serialize the plain state of the cpu and devices into a machine snapshot.
+// Values are written in host byte order, so a snapshot can only be restored
+// on a host with the same endianness and by the same build configuration.
+class SnapshotWriter {
+private:
+    std::ostream &os;
+
+public:
+    explicit SnapshotWriter(std::ostream &os) : os(os) {}
+
+    void write_bytes(const void *data, std::size_t size) {
+        os.write((const char *)data, size);
+    }
+
+    template<typename T>
+    void write(const T &value) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be written to snapshot");
+        write_bytes(&value, sizeof(T));
+    }
+
+    void write_string(const std::string &s) {
+        write<uint32_t>(s.size());
+        write_bytes(s.data(), s.size());
+    }
+
+    bool good() const {
+        return os.good();
+    }
+};
+
+class SnapshotReader {
+private:
+    std::istream &is;
+
+    // Refuse strings longer than this, the snapshot is corrupted
+    static constexpr uint32_t STRING_MAX_LENGTH = 4096;
+
+public:
+    explicit SnapshotReader(std::istream &is) : is(is) {}
+
+    bool read_bytes(void *data, std::size_t size) {
+        is.read((char *)data, size);
+        return is.good();
+    }
+
+    template<typename T>
+    bool read(T &value) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be read from snapshot");
+        return read_bytes(&value, sizeof(T));
+    }
+
+    bool read_string(std::string &s) {
+        uint32_t size;
+        if (!read(size) || size > STRING_MAX_LENGTH) {
+            return false;
+        }
+        s.resize(size);
+        return read_bytes(s.data(), size);
+    }
+
+    // Read a string and check if it is equal to the expected one
+    bool expect_string(const std::string &expected) {
+        std::string s;
+        return read_string(s) && s == expected;
+    }
+
+    bool good() const {
+        return is.good();
+    }
+};
+
+} // namespace kxemu::utils
+
+#endif
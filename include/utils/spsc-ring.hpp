@@ -0,0 +1,89 @@
+#ifndef __KXEMU_UTILS_SPSC_RING_HPP__
+#define __KXEMU_UTILS_SPSC_RING_HPP__
+
+#include <atomic>
+#include <cstddef>
+
+namespace kxemu::utils {
+
+// A fixed capacity ring buffer for one producer thread and one consumer thread.
+// The head is only written by the consumer and the tail only by the producer,
+// so neither side takes a lock. The indexes grow without wrapping and are masked on access.
+// A side with several threads must serialize them by its own lock.
+template<typename T, std::size_t Capacity>
+class SPSCRing {
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+private:
+    static constexpr std::size_t MASK = Capacity - 1;
+
+    alignas(64) std::atomic<std::size_t> head = 0;
+    alignas(64) std::atomic<std::size_t> tail = 0;
+    alignas(64) T data[Capacity];
+
+public:
+    // Producer side
+    bool push(const T &value) {
+        std::size_t t = this->tail.load(std::memory_order_relaxed);
+        if (t - this->head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        this->data[t & MASK] = value;
+        this->tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T &value) {
+        std::size_t h = this->head.load(std::memory_order_relaxed);
+        if (h == this->tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = this->data[h & MASK];
+        this->head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, get the readable elements which are contiguous in memory
+    std::size_t front_span(const T *&p) const {
+        std::size_t h = this->head.load(std::memory_order_relaxed);
+        std::size_t n = this->tail.load(std::memory_order_acquire) - h;
+        p = &this->data[h & MASK];
+        return n < Capacity - (h & MASK) ? n : Capacity - (h & MASK);
+    }
+
+    // Consumer side, drop n elements got by front_span
+    void consume(std::size_t n) {
+        this->head.store(this->head.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    // Consumer side, the i-th element from the head, i < size()
+    const T &at(std::size_t i) const {
+        return this->data[(this->head.load(std::memory_order_relaxed) + i) & MASK];
+    }
+
+    // Consumer side
+    void clear() {
+        this->head.store(this->tail.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    std::size_t size() const {
+        return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return this->size() == 0;
+    }
+
+    bool full() const {
+        return this->size() == Capacity;
+    }
+
+    static constexpr std::size_t capacity() {
+        return Capacity;
+    }
+};
+
+} // namespace kxemu::utils
+
+#endif
@@ -58,5 +58,5 @@ progress_dir(srcDir, destDir)
 destDir = 'export/' + isaName + '/include/kxemu'
 srcDir = 'include'
 mkdir(destDir)
-for name in ("macro.h", "log.h", "debug.h"):
+for name in ("macro.h", "log.h", "debug.h", "difftest.h"):
     progress_file(srcDir + '/' + name, destDir + '/' + name)
@@ -5,6 +5,7 @@ file(
     ${PROJECT_SOURCE_DIR}/src/utils/**.cpp
 )
 list(APPEND EMU_SRCS ${PROJECT_SOURCE_DIR}/src/log.cpp)
+list(APPEND EMU_SRCS ${PROJECT_SOURCE_DIR}/src/machine.cpp)
 
 file(
     GLOB_RECURSE KDB_SRCS CONFIGURE_DEPENDS
@@ -12,3 +13,8 @@ file(
     ${PROJECT_SOURCE_DIR}/src/isa/${CONFIG_BASE_ISA}/**.cpp
 )
 list(APPEND KDB_SRCS ${PROJECT_SOURCE_DIR}/src/main.cpp)
+
+file(
+    GLOB_RECURSE BENCH_SRCS CONFIGURE_DEPENDS
+    ${PROJECT_SOURCE_DIR}/tools/bench/**.cpp
+)
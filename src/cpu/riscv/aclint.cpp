@@ -19,6 +19,8 @@ static inline constexpr AddrSpace SSWI     = {0xc000, 0x4000};
 AClint::AClint() {
     this->coreCount = 0;
     this->coreObjects = nullptr;
+    this->timerRunning = false;
+    this->pausedUptime = 0;
 }
 
 AClint::~AClint() {
@@ -58,6 +60,7 @@ void AClint::reset() {
         this->coreObjects[i].stip = false;
     }
     this->timerRunning = false;
+    this->pausedUptime = 0;
 }
 
 word_t AClint::read(word_t addr, word_t size, bool &valid) {
@@ -290,7 +293,7 @@ void AClint::start_timer() {
         return ;
     }
     this->timerRunning = true;
-    this->bootTime = utils::get_current_time();
+    this->bootTime = utils::get_current_time() - this->pausedUptime;
     this->taskTimer.start_timer();
 }
 
@@ -299,13 +302,14 @@ void AClint::stop_timer() {
         PANIC("Timer is not running.");
         return ;
     }
+    this->pausedUptime = utils::get_current_time() - this->bootTime;
     this->timerRunning = false;
     this->taskTimer.stop_timer();
 }
 
 uint64_t AClint::get_uptime() {
     if (!this->timerRunning) {
-        return 0;
+        return this->pausedUptime;
     }
     uint64_t uptime = utils::get_current_time() - this->bootTime;
     return uptime;
@@ -364,6 +368,58 @@ void AClint::update_core_mtimecmp(unsigned int coreID) {
     });
 }
 
+bool AClint::save_state(utils::SnapshotWriter &writer) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    writer.write<uint32_t>(this->coreCount);
+    for (unsigned int i = 0; i < this->coreCount; i++) {
+        const CoreObject &coreObj = this->coreObjects[i];
+        writer.write(coreObj.msip);
+        writer.write(coreObj.ssip);
+        writer.write(coreObj.mtimecmp);
+    }
+    writer.write<uint64_t>(this->get_uptime());
+    return writer.good();
+}
+
+bool AClint::load_state(utils::SnapshotReader &reader) {
+    if (this->timerRunning) {
+        WARN("Cannot restore CLINT when the timer is running.");
+        return false;
+    }
+
+    uint32_t coreCount;
+    if (!reader.read(coreCount) || coreCount != this->coreCount) {
+        WARN("Core count of snapshot mismatch.");
+        return false;
+    }
+
+    for (unsigned int i = 0; i < this->coreCount; i++) {
+        CoreObject &coreObj = this->coreObjects[i];
+        reader.read(coreObj.msip);
+        reader.read(coreObj.ssip);
+        reader.read(coreObj.mtimecmp);
+        coreObj.mtip = false;
+        coreObj.stip = false;
+    }
+    if (!reader.read(this->pausedUptime)) {
+        return false;
+    }
+
+    // The timer tasks are based on the host time, register them again.
+    // The supervisor timers are registered when the cores restore stimecmp.
+    for (unsigned int i = 0; i < this->coreCount; i++) {
+        CoreObject &coreObj = this->coreObjects[i];
+        if (coreObj.mtimecmp != (uint64_t)-1) {
+            this->update_core_mtimecmp(i);
+        } else if (coreObj.mtimerID != (unsigned int)-1) {
+            this->taskTimer.remove_task(coreObj.mtimerID);
+            coreObj.mtimerID = -1;
+        }
+    }
+
+    return true;
+}
+
 const char *AClint::get_type_name() const {
     return "AClint";
 }
@@ -24,6 +24,10 @@ RVCore::RVCore() {
 
     this->vaddr_translate_func = &RVCore::vaddr_translate_bare;
 
+#ifdef CONFIG_INST_MIX
+    this->instMix = std::make_unique<utils::PerfCounter[]>(2 * (inst_mix_handlers().size() + 1));
+#endif
+
     this->deviceMtx = nullptr;
 }
 
@@ -54,6 +58,9 @@ void RVCore::reset(word_t entry) {
 }
 
 uint64_t RVCore::get_uptime() {
+    if (unlikely(this->replay != nullptr)) {
+        return this->replay_uptime();
+    }
     return this->aclint->get_uptime();
 }
 
@@ -2,7 +2,9 @@
 #include "device/bus.hpp"
 #include "log.h"
 
+#include <memory>
 #include <thread>
+#include <unordered_set>
 
 using namespace kxemu::cpu;
 using namespace kxemu::device;
@@ -11,6 +13,7 @@ RVCPU::RVCPU() {
     this->cores = nullptr;
     this->coreCount = 0;
     this->coreThread = nullptr;
+    this->replay = nullptr;
 }
 
 void RVCPU::init(Bus *bus, int flags, unsigned int coreCount) {
@@ -32,9 +35,26 @@ void RVCPU::reset(word_t pc) {
         cores[i].reset(pc);
     }
     aclint.reset();
+    // The cores cleared their mip, the PLIC drops its claimed sources and pushes its contexts again
+    plic.reset();
 }
 
 void RVCPU::step() {
+    if (this->replay != nullptr) {
+        // Step the hart whose turn it is
+        RVCore *core = nullptr;
+        for (unsigned int i = 0; i < coreCount; i++) {
+            if (!cores[i].is_halt() && !cores[i].is_error() &&
+                (core == nullptr || cores[i].get_slice_count() < core->get_slice_count())) {
+                core = &cores[i];
+            }
+        }
+        if (core != nullptr) {
+            core->step();
+        }
+        return;
+    }
+
     for (unsigned int i = 0; i < coreCount; i++) {
         cores[i].step();
     }
@@ -46,7 +66,10 @@ void RVCPU::core_thread_worker(unsigned int coreID, const word_t *breakpoints, u
 
 void RVCPU::run(bool blocked, const word_t *breakpoints, unsigned int n) {
     aclint.start_timer();
-    if (this->coreCount == 1) {
+    if (this->replay != nullptr) {
+        this->run_serialized(breakpoints, n);
+        aclint.stop_timer();
+    } else if (this->coreCount == 1) {
         cores[0].set_device_mtx(nullptr);
         cores[0].run(breakpoints, n);
         aclint.stop_timer();
@@ -63,6 +86,47 @@ void RVCPU::run(bool blocked, const word_t *breakpoints, unsigned int n) {
     }
 }
 
+RVCore *RVCPU::next_slice_core(bool started[]) {
+    RVCore *next = nullptr;
+    for (unsigned int i = 0; i < coreCount; i++) {
+        if ((!started[i] || cores[i].is_running()) &&
+            (next == nullptr || cores[i].get_slice_count() < next->get_slice_count())) {
+            next = &cores[i];
+        }
+    }
+    return next;
+}
+
+// The order of the slices only depends on the slices run by the harts, not on the host threads,
+// so a replay runs the harts in the same order as the record, even if it stops at breakpoints.
+// A breakpoint or an error of a hart stops all harts.
+void RVCPU::run_serialized(const word_t *breakpoints_, unsigned int n) {
+    std::unordered_set<word_t> breakpoints(breakpoints_, breakpoints_ + n);
+    std::unique_ptr<bool[]> started = std::make_unique<bool[]>(coreCount);
+    for (unsigned int i = 0; i < coreCount; i++) {
+        cores[i].set_device_mtx(nullptr);
+        started[i] = false;
+    }
+
+    RVCore *core;
+    while ((core = this->next_slice_core(started.get())) != nullptr) {
+        unsigned int coreID = core - cores;
+        core->run_slice(breakpoints, !started[coreID]);
+        started[coreID] = true;
+        if (core->is_break() || core->is_error()) {
+            break;
+        }
+    }
+}
+
+bool RVCPU::set_replay(utils::ReplayLog *log) {
+    this->replay = log;
+    for (unsigned int i = 0; i < coreCount; i++) {
+        cores[i].set_replay(log);
+    }
+    return true;
+}
+
 void RVCPU::join() {
     if (coreThread == nullptr) {
         return ;
@@ -71,6 +135,7 @@ void RVCPU::join() {
         coreThread[i].join();
     }
     delete []coreThread;
+    coreThread = nullptr;
     aclint.stop_timer();
 }
 
@@ -89,6 +154,30 @@ RVCore *RVCPU::get_core(unsigned int coreID) {
     return &cores[coreID];
 }
 
+bool RVCPU::save_state(utils::SnapshotWriter &writer) {
+    writer.write<uint32_t>(this->coreCount);
+    for (unsigned int i = 0; i < coreCount; i++) {
+        if (!cores[i].save_state(writer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RVCPU::load_state(utils::SnapshotReader &reader) {
+    uint32_t coreCount;
+    if (!reader.read(coreCount) || coreCount != this->coreCount) {
+        WARN("Core count of snapshot mismatch.");
+        return false;
+    }
+    for (unsigned int i = 0; i < coreCount; i++) {
+        if (!cores[i].load_state(reader)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 RVCPU::~RVCPU() {
     delete []cores;
 }
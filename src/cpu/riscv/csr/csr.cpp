@@ -298,3 +298,43 @@ bool RVCSR::write_csr(unsigned int addr, word_t value) {
     }
     return valid;
 }
+
+bool RVCSR::save_state(utils::SnapshotWriter &writer) const {
+    writer.write<uint32_t>(this->privMode);
+    writer.write<uint32_t>(this->csr.size());
+    for (const auto &iter : this->csr) {
+        writer.write<uint32_t>(iter.first);
+        writer.write(iter.second.value);
+    }
+    return writer.good();
+}
+
+bool RVCSR::load_state(utils::SnapshotReader &reader) {
+    uint32_t privMode;
+    uint32_t count;
+    reader.read(privMode);
+    if (!reader.read(count) || count != this->csr.size()) {
+        WARN("CSR count of snapshot mismatch.");
+        return false;
+    }
+    this->privMode = privMode;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t addr;
+        word_t value;
+        reader.read(addr);
+        if (!reader.read(value)) {
+            return false;
+        }
+        
+        auto iter = this->csr.find(addr);
+        if (iter == this->csr.end()) {
+            WARN("CSR 0x%03x of snapshot not exists.", addr);
+            return false;
+        }
+        iter->second.value = value;
+    }
+
+    this->reload_pmpcfg();
+    return true;
+}
@@ -0,0 +1,249 @@
+#include "cpu/riscv/core.hpp"
+#include "cpu/riscv/cpu.hpp"
+#include "cpu/riscv/def.hpp"
+#include "cpu/word.hpp"
+#include "device/bus.hpp"
+#include "difftest.h"
+#include "log.h"
+#include "macro.h"
+
+#include <cstdint>
+#include <cstring>
+
+using namespace kxemu;
+using namespace kxemu::cpu;
+
+// The CSRs in kxemu_difftest_regs_t, copied as the raw values
+static const struct {
+    CSRAddr addr;
+    uint64_t kxemu_difftest_regs_t::*field;
+} difftestCSRs[] = {
+    {CSRAddr::MSTATUS,  &kxemu_difftest_regs_t::mstatus },
+    {CSRAddr::MTVEC,    &kxemu_difftest_regs_t::mtvec   },
+    {CSRAddr::MEPC,     &kxemu_difftest_regs_t::mepc    },
+    {CSRAddr::MCAUSE,   &kxemu_difftest_regs_t::mcause  },
+    {CSRAddr::MTVAL,    &kxemu_difftest_regs_t::mtval   },
+    {CSRAddr::MSCRATCH, &kxemu_difftest_regs_t::mscratch},
+    {CSRAddr::MEDELEG,  &kxemu_difftest_regs_t::medeleg },
+    {CSRAddr::MIDELEG,  &kxemu_difftest_regs_t::mideleg },
+    {CSRAddr::MIE,      &kxemu_difftest_regs_t::mie     },
+    {CSRAddr::MIP,      &kxemu_difftest_regs_t::mip     },
+    {CSRAddr::STVEC,    &kxemu_difftest_regs_t::stvec   },
+    {CSRAddr::SEPC,     &kxemu_difftest_regs_t::sepc    },
+    {CSRAddr::SCAUSE,   &kxemu_difftest_regs_t::scause  },
+    {CSRAddr::STVAL,    &kxemu_difftest_regs_t::stval   },
+    {CSRAddr::SSCRATCH, &kxemu_difftest_regs_t::sscratch},
+    {CSRAddr::SATP,     &kxemu_difftest_regs_t::satp    },
+};
+
+uint64_t RVCore::difftest_exec(uint64_t n) {
+    if (this->state == BREAKPOINT) {
+        this->state = RUNNING;
+    }
+
+    // Unlike step(), the devices are not updated and the interrupts are not scanned,
+    // the DUT raises the interrupts it takes by difftest_raise_interrupt.
+    uint64_t i = 0;
+    while (i < n && this->state == RUNNING) {
+        this->execute();
+        this->pc = this->npc;
+        this->stepCount++;
+        i++;
+    }
+    return i;
+}
+
+bool RVCore::difftest_skip() {
+    if (this->state != RUNNING && this->state != BREAKPOINT) {
+        return false;
+    }
+    try {
+        this->memory_fetch();
+    } catch (const TrapException &) {
+        return false;
+    }
+    this->pc += (this->inst & 0x3) == 0x3 ? 4 : 2;
+    this->npc = this->pc;
+    return true;
+}
+
+void RVCore::difftest_raise_interrupt(InterruptCode code) {
+    // The interrupt is taken before the instruction at the pc, which is the epc
+    this->npc = this->pc;
+    if (this->privMode != PrivMode::MACHINE && (*this->mideleg >> code & 1)) {
+        this->interrupt_s(code);
+    } else {
+        this->interrupt_m(code);
+    }
+    this->pc = this->npc;
+}
+
+void RVCore::difftest_get_regs(kxemu_difftest_regs_t &regs) {
+    for (unsigned int i = 0; i < 32; i++) {
+        regs.gpr[i] = this->gpr[i];
+    }
+    regs.pc = this->pc;
+    for (unsigned int i = 0; i < 32; i++) {
+        std::memcpy(&regs.fpr[i], &this->fpr[i], sizeof(regs.fpr[i]));
+    }
+    regs.fcsr = this->csr.get_csr_value(CSRAddr::FCSR);
+    regs.priv = this->privMode;
+    for (const auto &c : difftestCSRs) {
+        regs.*c.field = this->csr.get_csr_value(c.addr);
+    }
+}
+
+void RVCore::difftest_set_regs(const kxemu_difftest_regs_t &regs) {
+    for (unsigned int i = 1; i < 32; i++) {
+        this->gpr[i] = regs.gpr[i];
+    }
+    this->pc = regs.pc;
+    this->npc = regs.pc;
+    for (unsigned int i = 0; i < 32; i++) {
+        std::memcpy(&this->fpr[i], &regs.fpr[i], sizeof(this->fpr[i]));
+    }
+    this->csr.set_csr_value(CSRAddr::FCSR, regs.fcsr);
+    this->update_fcsr();
+
+    bool vmChanged = regs.priv != this->privMode || regs.satp != this->csr.get_csr_value(CSRAddr::SATP);
+    for (const auto &c : difftestCSRs) {
+        this->csr.set_csr_value(c.addr, regs.*c.field);
+    }
+    this->privMode = regs.priv;
+    this->update_mstatus();
+    if (vmChanged) {
+        this->update_vm_translate();
+        this->tlb_fence();
+    }
+    this->reservedMemory.clear();
+}
+
+void RVCore::difftest_fence() {
+    this->icache_fence();
+    this->tlb_fence();
+}
+
+static device::Bus *difftestBus = nullptr;
+static RVCPU *difftestCPU = nullptr;
+
+static RVCore *difftest_core(unsigned int hart) {
+    if (unlikely(difftestCPU == nullptr || hart >= difftestCPU->core_count())) {
+        WARN("Difftest hart %u does not exist.", hart);
+        return nullptr;
+    }
+    return difftestCPU->get_core(hart);
+}
+
+// The memory of the REF is changed outside the harts, drop the decoded instructions and translations
+static void difftest_fence_all() {
+    for (unsigned int i = 0; i < difftestCPU->core_count(); i++) {
+        difftestCPU->get_core(i)->difftest_fence();
+    }
+}
+
+extern "C" {
+
+unsigned int kxemu_difftest_version(void) {
+    return KXEMU_DIFFTEST_VERSION;
+}
+
+int kxemu_difftest_init(unsigned int hartCount, uint64_t memBase, uint64_t memSize) {
+    kxemu_difftest_deinit();
+    if (hartCount == 0) {
+        return -1;
+    }
+
+    difftestBus = new device::Bus();
+    if (!difftestBus->add_memory_map(memBase, memSize)) {
+        kxemu_difftest_deinit();
+        return -1;
+    }
+    difftestCPU = new RVCPU();
+    difftestCPU->init(difftestBus, 0, hartCount);
+    difftestCPU->reset(memBase);
+    return 0;
+}
+
+void kxemu_difftest_deinit(void) {
+    delete difftestCPU;
+    delete difftestBus;
+    difftestCPU = nullptr;
+    difftestBus = nullptr;
+}
+
+void kxemu_difftest_memcpy(uint64_t addr, void *buf, size_t n, int direction) {
+    if (unlikely(difftestBus == nullptr)) {
+        return;
+    }
+    if (direction == KXEMU_DIFFTEST_TO_REF) {
+        if (!difftestBus->load_from_memory(buf, addr, n)) {
+            WARN("Difftest memcpy to " FMT_WORD " with %lu bytes is out of the memory.", (word_t)addr, (unsigned long)n);
+        }
+        difftest_fence_all();
+    } else {
+        if (!difftestBus->memcpy(addr, n, buf)) {
+            WARN("Difftest memcpy from " FMT_WORD " with %lu bytes is out of the memory.", (word_t)addr, (unsigned long)n);
+        }
+    }
+}
+
+int kxemu_difftest_mem_write(uint64_t addr, uint64_t data, unsigned int len) {
+    if (unlikely(difftestBus == nullptr)) {
+        return -1;
+    }
+    if (len != 1 && len != 2 && len != 4 && len != 8) {
+        return -1;
+    }
+    if (!difftestBus->write(addr, data, len)) {
+        return -1;
+    }
+    difftest_fence_all();
+    return 0;
+}
+
+void kxemu_difftest_regcpy(unsigned int hart, kxemu_difftest_regs_t *regs, int direction) {
+    RVCore *core = difftest_core(hart);
+    if (core == nullptr) {
+        return;
+    }
+    if (direction == KXEMU_DIFFTEST_TO_REF) {
+        core->difftest_set_regs(*regs);
+    } else {
+        core->difftest_get_regs(*regs);
+    }
+}
+
+uint64_t kxemu_difftest_exec(unsigned int hart, uint64_t n) {
+    RVCore *core = difftest_core(hart);
+    return core == nullptr ? 0 : core->difftest_exec(n);
+}
+
+int kxemu_difftest_skip(unsigned int hart) {
+    RVCore *core = difftest_core(hart);
+    return core != nullptr && core->difftest_skip() ? 0 : -1;
+}
+
+int kxemu_difftest_raise_intr(unsigned int hart, uint64_t cause) {
+    RVCore *core = difftest_core(hart);
+    // The code indexes the bits of mideleg and mip
+    if (core == nullptr || cause >= sizeof(word_t) * 8) {
+        return -1;
+    }
+    core->difftest_raise_interrupt((InterruptCode)cause);
+    return 0;
+}
+
+int kxemu_difftest_state(unsigned int hart) {
+    RVCore *core = difftest_core(hart);
+    if (core == nullptr || core->is_error()) {
+        return KXEMU_DIFFTEST_ERROR;
+    }
+    return core->is_halt() ? KXEMU_DIFFTEST_HALT : KXEMU_DIFFTEST_RUNNING;
+}
+
+uint64_t kxemu_difftest_halt_code(unsigned int hart) {
+    RVCore *core = difftest_core(hart);
+    return core == nullptr ? 0 : core->get_halt_code();
+}
+
+} // extern "C"
@@ -21,13 +21,22 @@ void RVCore::step() {
         this->state = RUNNING;
     }
     if (likely(this->state == RUNNING)) {
+        if (unlikely(this->replay != nullptr)) {
+            // Keep the steps of the devices update and the slices the same as run()
+            this->sliceYield = false;
+            this->run_step();
+            this->end_slice_step();
+            return;
+        }
+
         // Interrupt
         this->bus->update();
-        this->plic->scan_and_set_interrupt(this->coreID, this->privMode);
+        this->plic->scan_and_set_interrupt();
         this->scan_interrupt();
         
         this->execute();
         this->pc = this->npc;
+        this->stepCount++;
     } else {
         WARN("Core is not running, nothing to do.");
     }
@@ -37,20 +46,47 @@ void RVCore::set_device_mtx(std::mutex *mtx) {
     this->deviceMtx = mtx;
 }
 
-void RVCore::run_step(unsigned int &counter) {
+void RVCore::run_step() {
     constexpr unsigned int interruptFreq = 0x1000;
     
     this->execute();
 
+    if (unlikely(this->profileCountdown != 0 && --this->profileCountdown == 0)) {
+        this->profile_sample();
+    }
+
     // Interrupt
-    if (unlikely(counter & interruptFreq)) {
-        this->update_device();
+    if (unlikely((++this->stepCount & (interruptFreq - 1)) == 0)) {
+        if (likely(this->replay == nullptr)) {
+            this->update_device();
+        } else {
+            this->replay_update_device(REPLAY_UPDATE);
+        }
         this->scan_interrupt();
-        counter = 0;
+        if (unlikely(this->stepCount >= this->stepLimit || this->stopRequest.load(std::memory_order_relaxed))) {
+            this->stop_run();
+        }
     }
 
     this->pc = this->npc;
-    counter++;
+}
+
+void RVCore::stop_run() {
+    this->stopRequest = false;
+    this->stepLimit = UINT64_MAX;
+    if (this->state == RUNNING) {
+        this->haltCode = 0;
+        this->haltPC = this->npc;
+        this->state = BREAKPOINT;
+    }
+}
+
+void RVCore::request_stop() {
+    this->stopRequest.store(true, std::memory_order_relaxed);
+}
+
+void RVCore::set_step_limit(uint64_t n) {
+    this->stepLimit = n > UINT64_MAX - this->stepCount ? UINT64_MAX : this->stepCount + n;
 }
 
 void RVCore::run(const word_t *breakpoints_, unsigned int n) {
@@ -59,15 +95,14 @@ void RVCore::run(const word_t *breakpoints_, unsigned int n) {
         breakpoints.insert(breakpoints_[i]);
     }
 
-    unsigned int i = 0;
     this->state = RUNNING;
     if (n == 0) {
         while (this->state == RUNNING) {            
-            this->run_step(i);
+            this->run_step();
         }
     } else {
         if (this->state == RUNNING) {
-            this->run_step(i);
+            this->run_step();
         }
         while (this->state == RUNNING) {
             if (breakpoints.find(this->pc) != breakpoints.end()) {
@@ -77,21 +112,53 @@ void RVCore::run(const word_t *breakpoints_, unsigned int n) {
                 break;
             }
 
-            this->run_step(i);
+            this->run_step();
         }
     }
 }
 
+void RVCore::run_slice(const std::unordered_set<word_t> &breakpoints, bool first) {
+    if (first) {
+        this->state = RUNNING;
+    }
+
+    this->sliceYield = false;
+    while (this->state == RUNNING) {
+        // The breakpoint at the pc where the run starts is stepped over as run()
+        if (!first && breakpoints.find(this->pc) != breakpoints.end()) {
+            this->haltCode = 0;
+            this->haltPC = this->pc;
+            this->state = BREAKPOINT;
+            break;
+        }
+        first = false;
+
+        this->run_step();
+        if (this->end_slice_step()) {
+            break;
+        }
+    }
+}
+
+bool RVCore::end_slice_step() {
+    if (--this->sliceLeft != 0 && !this->sliceYield) {
+        return false;
+    }
+    this->sliceLeft = REPLAY_SLICE;
+    this->sliceCount++;
+    return true;
+}
+
 void RVCore::update_device() {
     if (unlikely(this->deviceMtx != nullptr)) {
         if (unlikely(this->deviceMtx->try_lock())) {
             this->bus->update();
-            this->plic->scan_and_set_interrupt(this->coreID, this->privMode);
+            this->plic->scan_and_set_interrupt();
             this->deviceMtx->unlock();
         }
     } else {
         this->bus->update();
-        this->plic->scan_and_set_interrupt(this->coreID, this->privMode);
+        this->plic->scan_and_set_interrupt();
     }
 }
 
@@ -101,8 +168,14 @@ void RVCore::execute() {
             throw TrapException(TrapCode::INST_ADDR_MISALIGNED, this->pc);
         }
         
-        if (likely(this->icache_decode_and_exec())) {
-            return;
+        if (likely(this->traceBuffer == nullptr)) {
+            if (likely(this->icache_decode_and_exec())) {
+                PERF_INC(this->perf.instret);
+                return;
+            }
+        } else {
+            this->traceMem = false;
+            this->tracePrivMode = this->privMode;
         }
         
         this->memory_fetch();
@@ -132,7 +205,16 @@ void RVCore::execute() {
         if (unlikely(do_inst == nullptr)) {
             this->do_invalid_inst();
         } else {
-            this->icache_push(do_inst, instLen, decodeInfo);
+            unsigned int mixIndex = 0;
+            #ifdef CONFIG_INST_MIX
+            mixIndex = inst_mix_index(do_inst, instLen);
+            this->instMix[mixIndex].inc();
+            #endif
+            this->icache_push(do_inst, instLen, decodeInfo, mixIndex);
+            PERF_INC(this->perf.instret);
+            if (unlikely(this->traceBuffer != nullptr)) {
+                this->trace_inst();
+            }
         }
     } catch (const TrapException &e) {
         // Handle trap exception
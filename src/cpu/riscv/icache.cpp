@@ -6,7 +6,7 @@ using namespace kxemu::cpu;
 
 #ifdef CONFIG_ENABLE_ICACHE
 
-void RVCore::icache_push(do_inst_t do_inst, unsigned int instLen, const DecodeInfo &decodeInfo) {
+void RVCore::icache_push(do_inst_t do_inst, unsigned int instLen, const DecodeInfo &decodeInfo, unsigned int mixIndex) {
     addr_t addr = this->pc;
     word_t set = addr.icache_set();
     this->icache[set].valid = true;
@@ -14,18 +14,28 @@ void RVCore::icache_push(do_inst_t do_inst, unsigned int instLen, const DecodeIn
     this->icache[set].do_inst = do_inst;
     this->icache[set].instLen = instLen;
     this->icache[set].decodeInfo = decodeInfo;
+    #ifdef CONFIG_INST_MIX
+    this->icache[set].mixIndex = mixIndex;
+    #else
+    (void)mixIndex;
+    #endif
 }
 
 bool RVCore::icache_decode_and_exec() {
     addr_t addr = this->pc;
     const ICacheBlock &block = this->icache[addr.icache_set()];
     if (block.tag == addr.icache_tag() && block.valid) {
+        PERF_INC(this->perf.icacheHit);
         this->npc = this->pc + block.instLen;
 
         (this->*block.do_inst)(block.decodeInfo);
+        #ifdef CONFIG_INST_MIX
+        this->instMix[block.mixIndex].inc();
+        #endif
         
         return true;
     } else {
+        PERF_INC(this->perf.icacheMiss);
         return false;
     }
 }
@@ -38,7 +48,7 @@ void RVCore::icache_fence() {
 
 #else
 
-void RVCore::icache_push(do_inst_t, unsigned int, const DecodeInfo &) {}
+void RVCore::icache_push(do_inst_t, unsigned int, const DecodeInfo &, unsigned int) {}
 
 bool RVCore::icache_decode_and_exec() {
     return false;
@@ -0,0 +1,68 @@
+#include "cpu/riscv/core.hpp"
+
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+using namespace kxemu::cpu;
+
+#ifdef CONFIG_INST_MIX
+
+const std::vector<RVCore::InstMixHandler> &RVCore::inst_mix_handlers() {
+    static const std::vector<InstMixHandler> handlers = {
+        #define _INST(name) {&RVCore::do_##name, #name},
+        #include "cpu/riscv/local-include/inst-list.h"
+    };
+    return handlers;
+}
+
+// Only called when the ICache is filled, the hits use the index kept in the block.
+// The last handler index is for the handlers not in the list.
+unsigned int RVCore::inst_mix_index(do_inst_t do_inst, unsigned int instLen) {
+    struct Hash {
+        std::size_t operator()(do_inst_t f) const {
+            return std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char *>(&f), sizeof(f)));
+        }
+    };
+    static const std::unordered_map<do_inst_t, unsigned int, Hash> indexMap = [] {
+        std::unordered_map<do_inst_t, unsigned int, Hash> map;
+        const auto &handlers = inst_mix_handlers();
+        for (unsigned int i = 0; i < handlers.size(); i++) {
+            map.emplace(handlers[i].do_inst, i);
+        }
+        return map;
+    }();
+
+    auto iter = indexMap.find(do_inst);
+    unsigned int index = iter == indexMap.end() ? inst_mix_handlers().size() : iter->second;
+    return 2 * index + (instLen == 2);
+}
+
+std::vector<InstMixEntry> RVCore::get_inst_mix() {
+    const auto &handlers = inst_mix_handlers();
+    std::vector<InstMixEntry> mix;
+    for (unsigned int i = 0; i < 2 * (handlers.size() + 1); i++) {
+        uint64_t count = this->instMix[i].get();
+        if (count != 0) {
+            const char *name = i / 2 < handlers.size() ? handlers[i / 2].name : "unknown";
+            mix.push_back({name, i % 2 ? 2u : 4u, count});
+        }
+    }
+    return mix;
+}
+
+void RVCore::reset_inst_mix() {
+    for (unsigned int i = 0; i < 2 * (inst_mix_handlers().size() + 1); i++) {
+        this->instMix[i].reset();
+    }
+}
+
+#else
+
+std::vector<InstMixEntry> RVCore::get_inst_mix() {
+    return {};
+}
+
+void RVCore::reset_inst_mix() {}
+
+#endif
@@ -17,6 +17,11 @@ word_t RVCore::amo_vaddr_translate_and_set_trap(word_t vaddr, int len) {
         throw TrapException(TrapCode::AMO_ACCESS_MISALIGNED, vaddr);
     }
 
+    if (unlikely(this->traceBuffer != nullptr)) {
+        this->traceMemAddr = vaddr;
+        this->traceMem = true;
+    }
+
     word_t paddr = vaddr;
     if (unlikely(this->privMode != PrivMode::MACHINE)) {
         paddr = this->vaddr_translate_core(vaddr, MemType::AMO).or_else([&](VMFault fault) -> VMResult {
@@ -73,7 +78,7 @@ void RVCore::do_store_conditional(const DecodeInfo &decodeInfo) {
     //     return std::nullopt;
     // });
 
-    sunit_t *ptr = (sunit_t *)this->bus->get_ptr(paddr);
+    sunit_t *ptr = (sunit_t *)this->bus->get_ptr(paddr, sizeof(sunit_t));
     if (ptr == nullptr) {
         throw TrapException(TrapCode::AMO_ACCESS_FAULT, paddr);
     }
@@ -1,6 +1,7 @@
 #include "cpu/riscv/core.hpp"
 #include "cpu/riscv/csr-field.hpp"
 #include "cpu/riscv/def.hpp"
+#include "macro.h"
 
 #include <thread>
 #include <utility>
@@ -95,7 +96,28 @@ void RVCore::do_ebreak(const DecodeInfo &) {
 }
 
 void RVCore::do_wfi(const DecodeInfo &) {
+    if (unlikely(this->replay != nullptr)) {
+        // The other harts run on this thread, so give up the slice and wait by running wfi again
+        this->replay_update_device(REPLAY_WFI);
+        if (!*this->mip) {
+            this->npc = this->pc;
+            this->sliceYield = true;
+        }
+        return;
+    }
+
+    // With a step limit, wfi completes at once as the spec allows, so the steps of an idle loop reach the limit
+    if (this->stepLimit != UINT64_MAX) {
+        return;
+    }
+
     while (!*this->mip) {
+        // The hart may idle here for ever, so the stop requests are checked as well.
+        // wfi completes as if woken up, and the hart stops after it.
+        if (unlikely(this->stopRequest.load(std::memory_order_relaxed))) {
+            this->stop_run();
+            return;
+        }
         std::this_thread::yield();
         this->update_device();
     }
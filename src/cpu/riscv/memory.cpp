@@ -63,8 +63,12 @@ RVCore::VMResult RVCore::vaddr_translate_bare(word_t addr, MemType type) {
     return addr; // No translation, return the address directly
 }
 
-template<unsigned int LEVELS, unsigned int PTESIZE, unsigned int VPNBITS>
+template<unsigned int LEVELS, unsigned int PTESIZE, unsigned int VPNBITS, bool PROBE>
 RVCore::VMResult RVCore::vaddr_translate_sv(addr_t vaddr, MemType type) noexcept {
+    if constexpr (!PROBE) {
+        PERF_INC(this->perf.pageWalk);
+    }
+
     // Whether the page which has the U bit set in the PTE is accessible by the current privilege mode
     bool uPageAccessible = this->privMode == PrivMode::USER || this->mstatus.sum;
 
@@ -73,7 +77,14 @@ RVCore::VMResult RVCore::vaddr_translate_sv(addr_t vaddr, MemType type) noexcept
         word_t pteAddr = base + vaddr.vpn(i, VPNBITS) * PTESIZE;
         PTE pte;
         
-        if (!this->pm_read_check_optional(pteAddr, PTESIZE).and_then([&](word_t data) {
+        if constexpr (PROBE) {
+            // Only the page tables in the memory are walked, reading a device may change it
+            auto block = this->bus->match_memory(pteAddr, PTESIZE);
+            if (block == nullptr) {
+                return std::unexpected(VMFault::ACCESS_FAULT);
+            }
+            pte = block->read(pteAddr, PTESIZE);
+        } else if (!this->pm_read_check_optional(pteAddr, PTESIZE).and_then([&](word_t data) {
             pte = data;
             return std::optional<word_t>(data);
         })) {
@@ -133,7 +144,9 @@ RVCore::VMResult RVCore::vaddr_translate_sv(addr_t vaddr, MemType type) noexcept
 
             word_t paddr = (((word_t)pte << 2) & ~mask) | (vaddr & mask);
 
-            this->tlb_push(vaddr, paddr, pteAddr, pte.flag());
+            if constexpr (!PROBE) {
+                this->tlb_push(vaddr, paddr, pteAddr, pte.flag());
+            }
 
             return paddr;
         } else {
@@ -192,6 +205,7 @@ RVCore::VMResult RVCore::vaddr_translate_core(addr_t vaddr, MemType type) noexce
     #ifdef CONFIG_TLB
     auto b = this->tlb_hit(vaddr);
     if (b.has_value()) {  
+        PERF_INC(this->perf.tlbHit);
         TLBBlock *block = b.value();
         bool u = block->flag.u() ? this->privMode == PrivMode::USER || this->mstatus.sum : this->privMode == PrivMode::SUPERVISOR;
         if (likely((block->flag & type) == type && (u))) {
@@ -204,6 +218,7 @@ RVCore::VMResult RVCore::vaddr_translate_core(addr_t vaddr, MemType type) noexce
             return std::unexpected(VMFault::PAGE_FAULT);
         }
     } else {
+        PERF_INC(this->perf.tlbMiss);
         return (this->*vaddr_translate_func)(vaddr, type);
     }
     #else
@@ -211,6 +226,28 @@ RVCore::VMResult RVCore::vaddr_translate_core(addr_t vaddr, MemType type) noexce
     #endif
 }
 
+RVCore::VMResult RVCore::vaddr_probe(word_t vaddr) noexcept {
+    #ifdef KXEMU_ISA32
+    if (this->vaddr_translate_func == &RVCore::vaddr_translate_sv32) {
+        return this->vaddr_translate_sv<2, 4, 10, true>(vaddr, MemType::DontCare);
+    }
+    #else
+    if (this->vaddr_translate_func == &RVCore::vaddr_translate_sv39) {
+        if ((vaddr >> 39) != ((vaddr & (1UL << 38)) ? 0x1ffffff : 0)) {
+            return std::unexpected(VMFault::PAGE_FAULT);
+        }
+        return this->vaddr_translate_sv<3, 8, 9, true>(vaddr, MemType::DontCare);
+    }
+    if (this->vaddr_translate_func == &RVCore::vaddr_translate_sv48) {
+        return this->vaddr_translate_sv<4, 8, 9, true>(vaddr, MemType::DontCare);
+    }
+    if (this->vaddr_translate_func == &RVCore::vaddr_translate_sv57) {
+        return this->vaddr_translate_sv<5, 8, 9, true>(vaddr, MemType::DontCare);
+    }
+    #endif
+    return vaddr;
+}
+
 word_t RVCore::vaddr_translate(word_t vaddr, bool &valid) {
     auto t = this->vaddr_translate_core(vaddr, MemType::DontCare);
     if (t) {
@@ -237,6 +274,10 @@ void RVCore::pm_fetch(word_t paddr) {
 }
 
 word_t RVCore::pm_read(word_t paddr, unsigned int len) {
+    if (unlikely(this->replay != nullptr) && this->bus->match_memory(paddr, len) == nullptr) {
+        return this->replay_mmio_read(paddr, len);
+    }
+
     bool valid;
     word_t data = this->bus->read(paddr, len, valid);
     if (unlikely(!valid)) {
@@ -251,6 +292,9 @@ void RVCore::pm_write(word_t paddr, word_t data, unsigned int len) {
         WARN("pm_write failed, paddr=" FMT_WORD ", data=" FMT_WORD ", len=%d", paddr, data, len);
         throw TrapException(TrapCode::STORE_ACCESS_FAULT, paddr);
     }
+    if (unlikely(this->replay != nullptr) && this->bus->match_memory(paddr, len) == nullptr) {
+        this->replay_take_interrupt(REPLAY_WRITE);
+    }
 }
 
 word_t RVCore::pm_read_check(word_t paddr, unsigned int len) {
@@ -347,6 +391,10 @@ void RVCore::memory_fetch() {
 }
 
 word_t RVCore::memory_load(word_t addr, unsigned int len) {
+    if (unlikely(this->traceBuffer != nullptr)) {
+        this->traceMemAddr = addr;
+        this->traceMem = true;
+    }
     if (unlikely(this->privMode == PrivMode::MACHINE)) {
         return this->pm_read(addr, len);
     } else {
@@ -355,6 +403,10 @@ word_t RVCore::memory_load(word_t addr, unsigned int len) {
 }
 
 void RVCore::memory_store(word_t addr, word_t data, unsigned int len) {
+    if (unlikely(this->traceBuffer != nullptr)) {
+        this->traceMemAddr = addr;
+        this->traceMem = true;
+    }
     if (unlikely(this->privMode == PrivMode::MACHINE)) {
         this->pm_write(addr, data, len);
     } else {
@@ -6,38 +6,39 @@
 #include "device/mmio.hpp"
 #include "log.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
+#include <mutex>
 
 using namespace kxemu::device;
 
 static inline constexpr AddrSpace PLIC_PRIORITY = {0x000000, 0x001000};
 static inline constexpr AddrSpace PLIC_PENDING  = {0x001000, 0x000080};
 static inline constexpr AddrSpace PLIC_ENABLE   = {0x002000, 0x1f0000};
-static inline constexpr AddrSpace PLIC_CONTEXT  = {0x200000, 0x100000};
+static inline constexpr AddrSpace PLIC_CONTEXT  = {0x200000, 0x3e00000};
 
 void PLIC::init(cpu::RVCore *cores, unsigned int coreCount) {
-    for (unsigned int i = 0; i < 32; i++) {
-        this->interruptSources[i].priority = 0;
-        this->interruptSources[i].pending = false;
-        for (unsigned int j = 0; j < 32; j++) {
-            this->interruptSources[i].enable[j] = false;
-        }
-    }
-
-    for (unsigned int i = 0; i < 32; i++) {
-        this->targetContexts[i].threshold = 0;
-        this->targetContexts[i].claim = 0;
-        this->targetContexts[i].core = nullptr;
+    this->targetContexts.assign(std::min(coreCount * 2, CONTEXT_COUNT), TargetContext{});
+    for (unsigned int i = 0; i < this->targetContexts.size(); i++) {
+        this->targetContexts[i].core = &cores[i / 2];
     }
+    this->reset();
+}
 
-    for (unsigned int i = 0; i < coreCount; i++) {
-        this->targetContexts[i * 2    ].core = &cores[i];
-        this->targetContexts[i * 2 + 1].core = &cores[i];
+void PLIC::reset() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    std::fill(std::begin(this->priority), std::end(this->priority), 0);
+    std::fill(std::begin(this->pending), std::end(this->pending), 0);
+    std::fill(std::begin(this->claimed), std::end(this->claimed), 0);
+    this->pendingWords = 0;
+    for (auto &target : this->targetContexts) {
+        std::fill(std::begin(target.enable), std::end(target.enable), 0);
+        target.threshold = 0;
     }
+    this->update_all_contexts();
 }
 
-void PLIC::reset() {}
-
 word_t PLIC::read(word_t offset, word_t size, bool &valid) {
     if (size != 4) {
         valid = false;
@@ -45,48 +46,27 @@ word_t PLIC::read(word_t offset, word_t size, bool &valid) {
     }
 
     valid = true;
+    std::lock_guard<std::mutex> lock(this->mtx);
     if (PLIC_PRIORITY.in_range(offset)) {
-        unsigned int source = offset / 4;
-        if (source < 32) {
-            return this->interruptSources[source].priority;
-        } else {
-            return 0;
-        }
+        return this->priority[offset / 4];
     } else if (PLIC_PENDING.in_range(offset)) {
-        unsigned int t = (offset - PLIC_PENDING.BASE) / 4;
-        if (t < 4) {
-            uint32_t pending = 0;
-            for (unsigned int i = 0; i < 32; i++) {
-                if (this->interruptSources[t * 8 + i].pending) {
-                    pending |= 1 << i;
-                }
-            }
-            return pending;
-        } else {
-            return 0;
-        }
+        return this->pending[(offset - PLIC_PENDING.BASE) / 4];
     } else if (PLIC_ENABLE.in_range(offset)) {
         unsigned int contextID = (offset - PLIC_ENABLE.BASE) / 0x80;
-        if ((offset - PLIC_ENABLE.BASE) % 0x80 == 0) { // Only 32 interrupt sources
-            uint32_t enable = 0;
-            for (unsigned int i = 0; i < 32; i++) {
-                if (this->interruptSources[i].enable[contextID]) {
-                    enable |= 1 << i;
-                }
-            }
-            return enable;
-        } else {
+        unsigned int index = (offset - PLIC_ENABLE.BASE) % 0x80 / 4;
+        if (contextID >= this->targetContexts.size()) {
             return 0;
         }
+        return this->targetContexts[contextID].enable[index];
     } else if (PLIC_CONTEXT.in_range(offset)) {
         unsigned int contextID = (offset - PLIC_CONTEXT.BASE) / 0x1000;
-        if (contextID >= 32) {
+        if (contextID >= this->targetContexts.size()) {
             return 0;
         }
         if ((offset - PLIC_CONTEXT.BASE) % 0x1000 == 0) {
             return this->targetContexts[contextID].threshold;
         } else if ((offset - PLIC_CONTEXT.BASE) % 0x1000 == 4) {
-            return this->targetContexts[contextID].claim;
+            return this->claim(contextID);
         }
         return 0;
     } else {
@@ -101,47 +81,53 @@ bool PLIC::write(word_t offset, word_t data, word_t size) {
         return false;
     }
 
+    std::lock_guard<std::mutex> lock(this->mtx);
     if (PLIC_PRIORITY.in_range(offset)) {
         unsigned int source = offset / 4;
-        if (source < 32) {
-            this->interruptSources[source].priority = data;
-            return true;
-        } else {
-            HINT("Source index out of range: index=%u", source);
-            return true;
+        if (source != 0 && this->priority[source] != data) {
+            this->priority[source] = data;
+            // Only the contexts where the source is enabled are affected
+            uint32_t bit = 1u << (source % 32);
+            for (unsigned int i = 0; i < this->targetContexts.size(); i++) {
+                if (this->targetContexts[i].enable[source / 32] & bit) {
+                    this->update_context(i);
+                }
+            }
         }
+        return true;
+    } else if (PLIC_PENDING.in_range(offset)) {
+        return true; // Read only
     } else if (PLIC_ENABLE.in_range(offset)) {
         unsigned int contextID = (offset - PLIC_ENABLE.BASE) / 0x80;
-        unsigned int index = (offset - PLIC_ENABLE.BASE) % 0x80;
-        if (index == 0) { // Only 32 interrupt sources
-            for (unsigned int i = 0; i < 32; i++) {
-                this->interruptSources[i].enable[contextID] = (data & (1 << i)) != 0;
-            }
-            return true;
-        } else {
-            HINT("Interrupt enable bits index out of range: index=%u", index);
+        unsigned int index = (offset - PLIC_ENABLE.BASE) % 0x80 / 4;
+        if (contextID >= this->targetContexts.size()) {
+            HINT("Context index out of range: index=%u", contextID);
             return true;
         }
+        // Source 0 does not exist
+        uint32_t enable = index == 0 ? data & ~1u : data;
+        if (this->targetContexts[contextID].enable[index] != enable) {
+            this->targetContexts[contextID].enable[index] = enable;
+            this->update_context(contextID);
+        }
+        return true;
     } else if (PLIC_CONTEXT.in_range(offset)) {
         unsigned int contextID = (offset - PLIC_CONTEXT.BASE) / 0x1000;
-        if (contextID >= 32) {
-            return false;
+        if (contextID >= this->targetContexts.size()) {
+            HINT("Context index out of range: index=%u", contextID);
+            return true;
         }
         if ((offset - PLIC_CONTEXT.BASE) % 0x1000 == 0) {
-            this->targetContexts[contextID].threshold = data;
+            if (this->targetContexts[contextID].threshold != data) {
+                this->targetContexts[contextID].threshold = data;
+                this->update_context(contextID);
+            }
             return true;
         } else if ((offset - PLIC_CONTEXT.BASE) % 0x1000 == 4) {
-            if (this->targetContexts[contextID].claim == data) {
-                this->targetContexts[contextID].claim = 0;
-                if (contextID % 2 == 0) {
-                    this->targetContexts[contextID].core->clear_external_interrupt_m();
-                } else {
-                    this->targetContexts[contextID].core->clear_external_interrupt_s();
-                }
-            }
+            this->complete(contextID, data);
             return true;
         }
-        return false;
+        return true;
     } else {
         return false;
     }
@@ -151,45 +137,192 @@ void PLIC::connect_to_bus(Bus *bus) {
     this->bus = bus;
 }
 
-void PLIC::scan_and_set_interrupt(unsigned int hartid, int privMode) {
-    unsigned int contextID;
-    if (privMode == cpu::PrivMode::MACHINE) {
-        contextID = hartid * 2;
+// Called with mtx locked
+void PLIC::set_pending(unsigned int source, bool value) {
+    unsigned int index = source / 32;
+    uint32_t bit = 1u << (source % 32);
+    if (value == ((this->pending[index] & bit) != 0)) {
+        return;
+    }
+
+    if (value) {
+        this->pending[index] |= bit;
+        this->pendingWords |= 1u << index;
     } else {
-        contextID = hartid * 2 + 1;
+        this->pending[index] &= ~bit;
+        if (this->pending[index] == 0) {
+            this->pendingWords &= ~(1u << index);
+        }
+    }
+
+    // A new pending source only needs to be compared with the cached one,
+    // a cleared one only matters to the contexts where it is the best.
+    for (unsigned int i = 0; i < this->targetContexts.size(); i++) {
+        const TargetContext &target = this->targetContexts[i];
+        if (!(target.enable[index] & bit)) {
+            continue;
+        }
+        if (value && this->better_source(source, target)) {
+            this->set_context_best(i, source);
+        } else if (!value && target.best == source) {
+            this->update_context(i);
+        }
+    }
+}
+
+// Called with mtx locked. The gateway forwards the interrupt of a device to the pending bit,
+// unless the source is claimed and not completed yet, then the device keeps it.
+void PLIC::latch_sources() {
+    for (auto &map : this->bus->mmioMaps) {
+        unsigned int source = map->id;
+        if (source == 0 || source >= SOURCE_COUNT || (this->claimed[source / 32] & (1u << (source % 32)))) {
+            continue;
+        }
+        if (map->dev->interrupt_pending()) {
+            this->set_pending(source, true);
+            map->dev->clear_interrupt();
+        }
+    }
+}
+
+unsigned int PLIC::best_source(const TargetContext &target) const {
+    unsigned int best = 0;
+    uint32_t bestPriority = target.threshold;
+    for (uint32_t words = this->pendingWords; words != 0; words &= words - 1) {
+        unsigned int index = __builtin_ctz(words);
+        for (uint32_t bits = this->pending[index] & target.enable[index]; bits != 0; bits &= bits - 1) {
+            unsigned int source = index * 32 + __builtin_ctz(bits);
+            if (this->priority[source] > bestPriority) {
+                bestPriority = this->priority[source];
+                best = source;
+            }
+        }
     }
-    
+    return best;
+}
+
+// Whether the pending and enabled source would replace the cached best source of the context
+bool PLIC::better_source(unsigned int source, const TargetContext &target) const {
+    uint32_t p = this->priority[source];
+    if (p <= target.threshold) {
+        return false;
+    }
+    if (target.best == 0) {
+        return true;
+    }
+    uint32_t bestPriority = this->priority[target.best];
+    return p > bestPriority || (p == bestPriority && source < target.best);
+}
+
+// Called with mtx locked. The external interrupt of the hart is only set or cleared
+// when the context changes between having a source and having none.
+void PLIC::set_context_best(unsigned int contextID, unsigned int best) {
     TargetContext &target = this->targetContexts[contextID];
-    if (target.claim != 0) {
+    target.best = best;
+    if ((best != 0) != target.interrupt) {
+        this->push_interrupt(contextID);
+    }
+}
+
+// Called with mtx locked
+void PLIC::push_interrupt(unsigned int contextID) {
+    TargetContext &target = this->targetContexts[contextID];
+    target.interrupt = target.best != 0;
+    if (contextID % 2 == 0) {
+        target.interrupt ? target.core->set_external_interrupt_m() : target.core->clear_external_interrupt_m();
+    } else {
+        target.interrupt ? target.core->set_external_interrupt_s() : target.core->clear_external_interrupt_s();
+    }
+}
+
+// Called with mtx locked
+void PLIC::update_context(unsigned int contextID) {
+    this->set_context_best(contextID, this->best_source(this->targetContexts[contextID]));
+}
+
+// Called with mtx locked
+void PLIC::update_all_contexts() {
+    for (unsigned int i = 0; i < this->targetContexts.size(); i++) {
+        // Push the state to the hart even if it is not changed
+        this->targetContexts[i].best = this->best_source(this->targetContexts[i]);
+        this->push_interrupt(i);
+    }
+}
+
+// Called with mtx locked
+uint32_t PLIC::claim(unsigned int contextID) {
+    unsigned int source = this->targetContexts[contextID].best;
+    if (source != 0) {
+        this->set_pending(source, false);
+        this->claimed[source / 32] |= 1u << (source % 32);
+    }
+    return source;
+}
+
+// Called with mtx locked
+void PLIC::complete(unsigned int contextID, uint32_t source) {
+    if (source == 0 || source >= SOURCE_COUNT) {
         return;
     }
-    
-    uint32_t priority = target.threshold;
-    uint32_t claim = 0;
-    MMIODev *sourceDev = nullptr;
-    
+    uint32_t bit = 1u << (source % 32);
+    if (!(this->targetContexts[contextID].enable[source / 32] & bit)) {
+        return; // Ignored if the source is not enabled for the context
+    }
+    this->claimed[source / 32] &= ~bit;
+}
+
+void PLIC::scan_and_set_interrupt() {
+    // The contexts are updated when the state changes, only the devices are polled here.
+    // Most of the time no device has an interrupt, so the lock is not taken.
+    bool any = false;
     for (auto &map : this->bus->mmioMaps) {
-        auto &dev = map->dev;
-        if (dev->interrupt_pending()) {
-            auto &source = this->interruptSources[map->id];
-            
-            source.pending = true;
-            sourceDev = dev;
-            
-            if (source.enable[contextID] && source.priority >= priority) {
-                priority = source.priority;
-                claim = map->id;
-            }
+        if (map->id != 0 && map->dev->interrupt_pending()) {
+            any = true;
+            break;
         }
     }
+    if (!any) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->latch_sources();
+}
+
+bool PLIC::save_state(utils::SnapshotWriter &writer) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    writer.write(this->priority);
+    writer.write(this->pending);
+    writer.write(this->claimed);
+    writer.write<uint32_t>(this->targetContexts.size());
+    for (const auto &target : this->targetContexts) {
+        writer.write(target.enable);
+        writer.write(target.threshold);
+    }
+    return writer.good();
+}
+
+bool PLIC::load_state(utils::SnapshotReader &reader) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    reader.read(this->priority);
+    reader.read(this->pending);
+    reader.read(this->claimed);
+    uint32_t contextCount;
+    if (!reader.read(contextCount) || contextCount != this->targetContexts.size()) {
+        WARN("Number of PLIC contexts mismatch.");
+        return false;
+    }
+    for (auto &target : this->targetContexts) {
+        reader.read(target.enable);
+        reader.read(target.threshold);
+    }
 
-    if (claim != 0) {
-        target.claim = claim;
-        sourceDev->clear_interrupt();
-        if (privMode == cpu::PrivMode::MACHINE) {
-            target.core->set_external_interrupt_m();
-        } else {
-            target.core->set_external_interrupt_s();
+    this->pendingWords = 0;
+    for (unsigned int i = 0; i < WORD_COUNT; i++) {
+        if (this->pending[i] != 0) {
+            this->pendingWords |= 1u << i;
         }
     }
+    this->update_all_contexts();
+    return reader.good();
 }
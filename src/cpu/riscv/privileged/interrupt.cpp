@@ -14,15 +14,26 @@ void RVCore::update_stimecmp() {
 #endif
     this->aclint->register_stimer(this->coreID, stimecmp);
     this->clear_timer_interrupt_s();
+    if (unlikely(this->replay != nullptr)) {
+        this->replay_take_interrupt(REPLAY_WRITE);
+    }
 }
 
 void RVCore::set_interrupt(InterruptCode code) {
+    if (unlikely(this->replay != nullptr)) {
+        this->replay_device_interrupt(code, true);
+        return;
+    }
     csr::MIP mip = this->csr.get_csr_value(CSRAddr::MIP);
     mip.set_pending(code);
     this->csr.set_csr_value(CSRAddr::MIP, mip);
 }
 
 void RVCore::clear_interrupt(InterruptCode code) {
+    if (unlikely(this->replay != nullptr)) {
+        this->replay_device_interrupt(code, false);
+        return;
+    }
     csr::MIP mip = this->csr.get_csr_value(CSRAddr::MIP);
     mip.clear_pending(code);
     this->csr.set_csr_value(CSRAddr::MIP, mip);
@@ -77,6 +88,11 @@ void RVCore::clear_external_interrupt_s() {
 }
 
 void RVCore::interrupt_m(InterruptCode code) {
+    PERF_INC(this->perf.interrupt[code % CorePerf::CAUSE_COUNT]);
+    if (unlikely(this->traceBuffer != nullptr)) {
+        this->trace_trap(this->npc, csr::MCause(code), 0);
+    }
+
     this->csr.set_csr_value(CSRAddr::MEPC, this->npc);
     this->csr.set_csr_value(CSRAddr::MTVAL, 0);
     this->csr.set_csr_value(CSRAddr::MCAUSE, csr::MCause(code));
@@ -98,6 +114,11 @@ void RVCore::interrupt_m(InterruptCode code) {
 }
 
 void RVCore::interrupt_s(InterruptCode code) {
+    PERF_INC(this->perf.interrupt[code % CorePerf::CAUSE_COUNT]);
+    if (unlikely(this->traceBuffer != nullptr)) {
+        this->trace_trap(this->npc, csr::MCause(code), 0);
+    }
+
     this->csr.write_csr(CSRAddr::SEPC, this->npc);
     this->csr.write_csr(CSRAddr::SCAUSE, csr::MCause(code));
     this->csr.write_csr(CSRAddr::STVAL, 0);
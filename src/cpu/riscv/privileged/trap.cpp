@@ -2,6 +2,7 @@
 #include "cpu/riscv/csr-field.hpp"
 #include "cpu/riscv/def.hpp"
 #include "cpu/word.hpp"
+#include "macro.h"
 
 using namespace kxemu::cpu;
 
@@ -11,6 +12,11 @@ using namespace kxemu::cpu;
 // up to x, so MPP is two bits wide and SPP is one bit wide. When a trap is taken from privilege mode y
 // into privilege mode x, xPIE is set to the value of xIE; xIE is set to 0; and xPP is set to y.
 void RVCore::enter_trap(TrapCode cause, word_t value) {
+    PERF_INC(this->perf.trap[cause % CorePerf::CAUSE_COUNT]);
+    if (unlikely(this->traceBuffer != nullptr)) {
+        this->trace_trap(this->pc, cause, value);
+    }
+
     bool deleg;
 #ifdef KXEMU_ISA64
     deleg = *this->medeleg & (1 << cause);
@@ -0,0 +1,67 @@
+#include "cpu/riscv/core.hpp"
+#include "cpu/word.hpp"
+
+using namespace kxemu::cpu;
+
+bool RVCore::set_profile(ProfileBuffer *buffer, unsigned int interval, unsigned int depth) {
+    if (buffer == nullptr || interval == 0) {
+        this->profileBuffer = nullptr;
+        this->profileCountdown = 0;
+        return true;
+    }
+
+    this->profileBuffer = buffer;
+    this->profileInterval = interval;
+    this->profileCountdown = interval;
+    this->profileDepth = depth < ProfileSample::MAX_DEPTH ? depth : ProfileSample::MAX_DEPTH;
+    return true;
+}
+
+// Read a word of the guest stack without side effects, MMIO is never touched.
+bool RVCore::profile_read_word(word_t vaddr, word_t &data) {
+    if (vaddr & (sizeof(word_t) - 1)) {
+        return false;
+    }
+
+    // The TLB and the perf counters are not touched, the profiler must not change what it measures
+    auto paddr = this->vaddr_probe(vaddr);
+    if (!paddr) {
+        return false;
+    }
+
+    auto block = this->bus->match_memory(paddr.value(), sizeof(word_t));
+    if (block == nullptr) {
+        return false;
+    }
+    data = block->read(paddr.value(), sizeof(word_t));
+    return true;
+}
+
+void RVCore::profile_sample() {
+    this->profileCountdown = this->profileInterval;
+
+    ProfileSample sample;
+    sample.pc = this->pc;
+    sample.privMode = this->privMode;
+    sample.depth = 0;
+
+    // The frame record of the psABI with frame pointers:
+    // the return address is at fp - XLEN / 8 and the caller's fp at fp - 2 * XLEN / 8.
+    // The stack grows downwards, so the walk stops if a frame does not move upwards.
+    word_t fp = this->gpr[8];
+    while (sample.depth < this->profileDepth && fp != 0) {
+        word_t ra, prevFP;
+        if (!this->profile_read_word(fp - sizeof(word_t), ra) || ra == 0) {
+            break;
+        }
+        sample.stack[sample.depth++] = ra;
+        if (!this->profile_read_word(fp - 2 * sizeof(word_t), prevFP) || prevFP <= fp) {
+            break;
+        }
+        fp = prevFP;
+    }
+
+    if (!this->profileBuffer->ring.push(sample)) {
+        this->profileBuffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,135 @@
+#include "cpu/riscv/core.hpp"
+#include "cpu/riscv/def.hpp"
+#include "cpu/word.hpp"
+#include "utils/replay-log.hpp"
+#include "log.h"
+#include "macro.h"
+#include "word.h"
+
+using namespace kxemu::cpu;
+using kxemu::utils::ReplayEvent;
+using kxemu::utils::ReplayLog;
+
+void RVCore::set_replay(utils::ReplayLog *log) {
+    // The interrupt changes of the devices not taken yet are applied when stopping,
+    // the PLIC only pushes the transitions and would not raise them again
+    if (log == nullptr && this->irqMask != 0) {
+        this->csr.set_csr_value(CSRAddr::MIP, (*this->mip & ~this->irqMask) | (this->irqValue & this->irqMask));
+    }
+    this->replay = log;
+    this->stepCount = 0;
+    this->irqMask = 0;
+    this->irqValue = 0;
+    this->sliceLeft = REPLAY_SLICE;
+    this->sliceCount = 0;
+    this->sliceYield = false;
+}
+
+uint64_t RVCore::get_step_count() {
+    return this->stepCount;
+}
+
+void RVCore::replay_device_interrupt(InterruptCode code, bool pending) {
+    word_t bit = (word_t)1 << code;
+    this->irqMask |= bit;
+    if (pending) {
+        this->irqValue |= bit;
+    } else {
+        this->irqValue &= ~bit;
+    }
+}
+
+void RVCore::replay_update_device(ReplayPoint point) {
+    if (this->replay->get_mode() == ReplayLog::RECORD) {
+        this->update_device();
+    }
+    this->replay_take_interrupt(point);
+}
+
+void RVCore::replay_take_interrupt(ReplayPoint point) {
+    if (this->replay->get_mode() == ReplayLog::RECORD) {
+        if (this->irqMask == 0) {
+            return;
+        }
+        word_t mip = (*this->mip & ~this->irqMask) | (this->irqValue & this->irqMask);
+        this->irqMask = 0;
+        if (mip != *this->mip) {
+            this->csr.set_csr_value(CSRAddr::MIP, mip);
+            this->replay->write({ReplayEvent::INTERRUPT, point, this->coreID, this->stepCount, mip, 0});
+        }
+        return;
+    }
+
+    // The changes made by the devices are dropped, only the recorded ones are taken
+    this->irqMask = 0;
+    const ReplayEvent *event = this->replay->peek();
+    if (event != nullptr && event->type == ReplayEvent::INTERRUPT && event->arg == point &&
+        event->hart == this->coreID && event->step == this->stepCount) {
+        this->csr.set_csr_value(CSRAddr::MIP, event->value);
+        this->replay->next();
+    }
+}
+
+const ReplayEvent *RVCore::replay_expect(ReplayEvent::Type type, word_t addr, unsigned int len) {
+    const ReplayEvent *event = this->replay->peek();
+    if (likely(event != nullptr && event->type == type && event->hart == this->coreID && event->step == this->stepCount &&
+               (type != ReplayEvent::MMIO || (event->addr == addr && event->arg == len)))) {
+        return event;
+    }
+
+    // Stop the hart after this instruction, which goes on with the value of the device
+    this->haltCode = 0;
+    this->haltPC = this->pc;
+    if (event == nullptr) {
+        INFO("Hart %u reaches the end of the replay log at step " FMT_VARU64 ", pc=" FMT_WORD,
+             this->coreID, this->stepCount, this->pc);
+        this->state = BREAKPOINT;
+    } else {
+        [[maybe_unused]] static const char *typeNames[] = {"time", "mmio", "interrupt"};
+        WARN("Hart %u diverges from the replay log at step " FMT_VARU64 ", pc=" FMT_WORD
+             " reads %s, the next event is %s of hart %u at step " FMT_VARU64,
+             this->coreID, this->stepCount, this->pc, typeNames[type], typeNames[event->type], event->hart, event->step);
+        this->state = ERROR;
+    }
+    return nullptr;
+}
+
+word_t RVCore::replay_mmio_read(word_t paddr, unsigned int len) {
+    // A load which faults is not recorded, it faults again when replaying
+    if (this->replay->get_mode() == ReplayLog::REPLAY && this->bus->match_mmio(paddr, len) != nullptr) {
+        const ReplayEvent *event = this->replay_expect(ReplayEvent::MMIO, paddr, len);
+        if (likely(event != nullptr)) {
+            word_t data = event->value;
+            this->replay->next();
+            return data;
+        }
+    }
+
+    bool valid;
+    word_t data = this->bus->read(paddr, len, valid);
+    if (unlikely(!valid)) {
+        WARN("pm_read failed, paddr=" FMT_WORD ", len=%d", paddr, len);
+        throw TrapException(TrapCode::LOAD_ACCESS_FAULT, paddr);
+    }
+    if (this->replay->get_mode() == ReplayLog::RECORD) {
+        this->replay->write({ReplayEvent::MMIO, (uint8_t)len, this->coreID, this->stepCount, data, paddr});
+    }
+    return data;
+}
+
+uint64_t RVCore::replay_uptime() {
+    if (this->replay->get_mode() == ReplayLog::REPLAY) {
+        const ReplayEvent *event = this->replay_expect(ReplayEvent::TIME);
+        if (likely(event != nullptr)) {
+            uint64_t uptime = event->value;
+            this->replay->next();
+            return uptime;
+        }
+    }
+
+    uint64_t uptime = this->aclint->get_uptime();
+    if (this->replay->get_mode() == ReplayLog::RECORD) {
+        this->replay->write({ReplayEvent::TIME, 0, this->coreID, this->stepCount, uptime, 0});
+    }
+    return uptime;
+}
@@ -0,0 +1,63 @@
+#include "cpu/riscv/core.hpp"
+#include "cpu/riscv/def.hpp"
+#include "cpu/word.hpp"
+#include "utils/snapshot.hpp"
+#include "log.h"
+
+#include <cstdint>
+
+using namespace kxemu::cpu;
+
+bool RVCore::save_state(utils::SnapshotWriter &writer) {
+    writer.write<uint32_t>(this->coreID);
+    writer.write<uint32_t>(this->state);
+    writer.write(this->haltCode);
+    writer.write(this->haltPC);
+    writer.write(this->pc);
+    writer.write(this->npc);
+    writer.write(this->gpr);
+    writer.write(this->fpr);
+    writer.write<uint32_t>(this->frm);
+    return this->csr.save_state(writer);
+}
+
+bool RVCore::load_state(utils::SnapshotReader &reader) {
+    uint32_t coreID;
+    uint32_t state;
+    uint32_t frm;
+    if (!reader.read(coreID) || coreID != this->coreID) {
+        WARN("Core ID of snapshot mismatch.");
+        return false;
+    }
+    reader.read(state);
+    if (state > HALT) {
+        return false;
+    }
+    this->state = (state_t)state;
+    reader.read(this->haltCode);
+    reader.read(this->haltPC);
+    reader.read(this->pc);
+    reader.read(this->npc);
+    reader.read(this->gpr);
+    reader.read(this->fpr);
+    reader.read(frm);
+    this->frm = frm;
+    if (!this->csr.load_state(reader)) {
+        return false;
+    }
+
+    // Rebuild the states derived from CSRs
+    this->update_mstatus();
+    this->update_vm_translate();
+    this->icache_fence();
+    this->tlb_fence();
+    this->reservedMemory.clear();
+
+    // Register the supervisor timer to the CLINT again,
+    // update_stimecmp clears the pending bit, so keep mip as saved.
+    word_t mip = this->csr.get_csr_value(CSRAddr::MIP);
+    this->update_stimecmp();
+    this->csr.set_csr_value(CSRAddr::MIP, mip);
+
+    return true;
+}
@@ -0,0 +1,111 @@
+#include "cpu/riscv/core.hpp"
+#include "cpu/word.hpp"
+#include "macro.h"
+
+#include <thread>
+
+using namespace kxemu::cpu;
+
+bool RVCore::set_trace(TraceBuffer *buffer) {
+    this->traceBuffer = buffer;
+    return true;
+}
+
+void RVCore::trace_push(const TraceRecord &record) {
+    if (unlikely(!this->traceBuffer->ring.push(record))) {
+        this->traceBuffer->stalls.fetch_add(1, std::memory_order_relaxed);
+        while (!this->traceBuffer->ring.push(record)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// The GPR written by the instruction, 0 if none. It is told by the encoding,
+// as some decoders, like the one of c.nop, do not set DecodeInfo::rd.
+static unsigned int trace_rd(uint32_t inst) {
+    unsigned int rd = (inst >> 7) & 0x1f;
+    if ((inst & 0x3) == 0x3) {
+        switch (inst & 0x7f) {
+            case 0x03: // LOAD
+            case 0x13: // OP-IMM
+            case 0x17: // AUIPC
+            case 0x1b: // OP-IMM-32
+            case 0x2f: // AMO
+            case 0x33: // OP
+            case 0x37: // LUI
+            case 0x3b: // OP-32
+            case 0x67: // JALR
+            case 0x6f: // JAL
+                return rd;
+            case 0x73: // SYSTEM, only the Zicsr instructions write rd
+                return ((inst >> 12) & 0x7) != 0 ? rd : 0;
+            case 0x53: { // OP-FP, compare, convert to integer, move to integer and classify
+                unsigned int funct5 = inst >> 27;
+                return funct5 == 0x14 || funct5 == 0x18 || funct5 == 0x1c ? rd : 0;
+            }
+            default:
+                return 0;
+        }
+    }
+
+    unsigned int funct3 = (inst >> 13) & 0x7;
+    unsigned int rdPrime = 8 + ((inst >> 2) & 0x7);  // CIW, CL
+    unsigned int rs1Prime = 8 + ((inst >> 7) & 0x7); // CA, CB
+    switch (inst & 0x3) {
+        case 0x0: // c.addi4spn, c.lw, c.ld
+            #ifdef KXEMU_ISA64
+            return funct3 == 0 || funct3 == 2 || funct3 == 3 ? rdPrime : 0;
+            #else
+            return funct3 == 0 || funct3 == 2 ? rdPrime : 0;
+            #endif
+        case 0x1:
+            switch (funct3) {
+                case 0: case 2: case 3: return rd; // c.addi, c.li, c.lui, c.addi16sp
+                #ifdef KXEMU_ISA64
+                case 1: return rd;                 // c.addiw
+                #else
+                case 1: return 1;                  // c.jal
+                #endif
+                case 4: return rs1Prime;           // c.srli, c.srai, c.andi, c.sub, ...
+                default: return 0;                 // c.j, c.beqz, c.bnez
+            }
+        default:
+            if (funct3 == 4) {
+                bool bit12 = (inst >> 12) & 1;
+                unsigned int rs2 = (inst >> 2) & 0x1f;
+                if (rs2 == 0) {
+                    return bit12 && rd != 0 ? 1 : 0; // c.jalr, or c.jr and c.ebreak
+                }
+                return rd;                           // c.mv, c.add
+            }
+            #ifdef KXEMU_ISA64
+            return funct3 == 0 || funct3 == 2 || funct3 == 3 ? rd : 0; // c.slli, c.lwsp, c.ldsp
+            #else
+            return funct3 == 0 || funct3 == 2 ? rd : 0;                 // c.slli, c.lwsp
+            #endif
+    }
+}
+
+void RVCore::trace_inst() {
+    TraceRecord record;
+    record.pc = this->pc;
+    record.inst = (this->inst & 0x3) == 0x3 ? this->inst : this->inst & 0xffff;
+    record.rd = trace_rd(record.inst);
+    record.value = this->gpr[record.rd];
+    record.memAddr = this->traceMem ? this->traceMemAddr : 0;
+    record.privMode = this->tracePrivMode;
+    record.flags = this->traceMem ? TraceRecord::MEM : 0;
+    this->trace_push(record);
+}
+
+void RVCore::trace_trap(word_t pc, word_t cause, word_t value) {
+    TraceRecord record;
+    record.pc = pc;
+    record.inst = 0;
+    record.rd = 0;
+    record.value = cause;
+    record.memAddr = value;
+    record.privMode = this->privMode;
+    record.flags = TraceRecord::TRAP;
+    this->trace_push(record);
+}
@@ -4,22 +4,88 @@
 #include "macro.h"
 #include "word.h"
 
+#include <cerrno>
 #include <istream>
-#include <new>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <optional>
-
-static inline constexpr unsigned int BUFFER_SIZE = 1024;
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+static inline constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
 
 using namespace kxemu::device;
 
-Bus::MemoryBlock::MemoryBlock(word_t start, word_t size) : start(start), end(start + size) {
-    this->data = new((std::align_val_t)8) uint8_t[size];
+// Map an anonymous region whose start is aligned to the huge page size,
+// so that the kernel is able to back it with transparent huge pages.
+static void *mmap_huge_aligned(std::size_t length) {
+    std::size_t total = length + HUGE_PAGE_SIZE;
+    uint8_t *p = (uint8_t *)mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+
+    uint8_t *aligned = (uint8_t *)ALIGN((uintptr_t)p, HUGE_PAGE_SIZE);
+    std::size_t head = aligned - p;
+    std::size_t tail = total - head - length;
+    if (head != 0) munmap(p, head);
+    if (tail != 0) munmap(aligned + length, tail);
+    return aligned;
+}
+
+Bus::MemoryBlock::MemoryBlock(word_t start, word_t size, MemoryBacking backing) : start(start), end(start + size), backing(backing) {
+    void *p = MAP_FAILED;
+    switch (backing) {
+        case MemoryBacking::ANON:
+            this->mapLength = size;
+            p = mmap(nullptr, this->mapLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            break;
+        case MemoryBacking::HUGEPAGE:
+            this->mapLength = ALIGN(size, HUGE_PAGE_SIZE);
+            p = mmap_huge_aligned(this->mapLength);
+            if (p != MAP_FAILED && madvise(p, this->mapLength, MADV_HUGEPAGE) != 0) {
+                WARN("madvise(MADV_HUGEPAGE) failed, fall back to normal pages.");
+            }
+            break;
+        case MemoryBacking::HUGETLB:
+            this->mapLength = ALIGN(size, HUGE_PAGE_SIZE);
+            p = mmap(nullptr, this->mapLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            break;
+        case MemoryBacking::MEMFD:
+            this->mapLength = size;
+            this->fd = memfd_create("kxemu-ram", MFD_CLOEXEC);
+            if (this->fd < 0) {
+                WARN("memfd_create failed: %s", std::strerror(errno));
+                break;
+            }
+            if (ftruncate(this->fd, this->mapLength) != 0) {
+                WARN("ftruncate memfd failed: %s", std::strerror(errno));
+                break;
+            }
+            p = mmap(nullptr, this->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+            break;
+    }
+
+    if (p == MAP_FAILED) {
+        WARN("Failed to map guest memory, size=" FMT_VARU64 ": %s", (uint64_t)size, std::strerror(errno));
+        this->data = nullptr;
+        this->mapLength = 0;
+    } else {
+        this->data = (uint8_t *)p;
+    }
 }
 
 Bus::MemoryBlock::~MemoryBlock() {
-    ::operator delete[](data, std::align_val_t(8));
+    delete[] this->dirtyBitmap;
+    if (this->data != nullptr) {
+        munmap(this->data, this->mapLength);
+    }
+    if (this->fd >= 0) {
+        close(this->fd);
+    }
 }
 
 bool Bus::MemoryBlock::in_range(word_t addr, word_t length) const {
@@ -34,6 +100,84 @@ word_t Bus::MemoryBlock::get_ptr_length(word_t addr) const {
     return end - addr;
 }
 
+word_t Bus::MemoryBlock::map_file_private(word_t addr, int fd, word_t offset, word_t length) {
+    // Replacing part of a shared or huge page mapping would break its semantic.
+    if (this->backing != MemoryBacking::ANON) {
+        return 0;
+    }
+
+    const word_t pageSize = sysconf(_SC_PAGESIZE);
+    uint8_t *dest = (uint8_t *)this->get_ptr(addr);
+    if (((uintptr_t)dest & (pageSize - 1)) != 0 || (offset & (pageSize - 1)) != 0) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (word_t)st.st_size <= offset) {
+        return 0;
+    }
+    
+    // Pages beyond the end of file raise SIGBUS, so only map whole pages.
+    word_t mapLength = std::min(length, (word_t)st.st_size - offset) & ~(pageSize - 1);
+    if (mapLength == 0) {
+        return 0;
+    }
+
+    void *p = mmap(dest, mapLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset);
+    if (p == MAP_FAILED) {
+        // The old mapping is unchanged if mmap fails.
+        WARN("Failed to map file to guest memory: %s", std::strerror(errno));
+        return 0;
+    }
+    this->mark_dirty(addr, mapLength);
+    return mapLength;
+}
+
+void Bus::MemoryBlock::set_dirty_tracking(bool enable) {
+    delete[] this->dirtyBitmap;
+    this->dirtyBitmap = nullptr;
+    this->dirtyBitmapLength = 0;
+    
+    if (enable) {
+        word_t pageCount = ((end - start) + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT;
+        this->dirtyBitmapLength = (pageCount + 63) / 64;
+        this->dirtyBitmap = new std::atomic<uint64_t>[this->dirtyBitmapLength];
+        for (std::size_t i = 0; i < this->dirtyBitmapLength; i++) {
+            this->dirtyBitmap[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void Bus::MemoryBlock::mark_dirty(word_t addr, word_t length) {
+    if (this->dirtyBitmap == nullptr || length == 0) {
+        return;
+    }
+    
+    word_t first = (addr - start) >> DIRTY_PAGE_SHIFT;
+    word_t last  = (addr - start + length - 1) >> DIRTY_PAGE_SHIFT;
+    for (word_t page = first; page <= last; page++) {
+        std::atomic<uint64_t> &word = this->dirtyBitmap[page / 64];
+        uint64_t bit = 1ULL << (page % 64);
+        // Most stores hit a page already dirty, avoid the atomic RMW for them
+        if (!(word.load(std::memory_order_relaxed) & bit)) {
+            word.fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::vector<word_t> Bus::MemoryBlock::take_dirty_pages() {
+    std::vector<word_t> pages;
+    for (std::size_t i = 0; i < this->dirtyBitmapLength; i++) {
+        uint64_t word = this->dirtyBitmap[i].exchange(0, std::memory_order_relaxed);
+        while (word != 0) {
+            unsigned int bit = __builtin_ctzll(word);
+            word &= word - 1;
+            pages.push_back(start + ((i * 64 + bit) << DIRTY_PAGE_SHIFT));
+        }
+    }
+    return pages;
+}
+
 word_t Bus::MemoryBlock::read(word_t addr, unsigned int length) const {
     word_t offset = addr - start;
     switch (length) {
@@ -54,6 +198,9 @@ bool Bus::MemoryBlock::write(word_t addr, word_t data, unsigned int length) {
         case 8: *(uint64_t *)(this->data + offset) = data; break;
         default: PANIC("Invalid length=%u", length); return false;
     }
+    if (unlikely(this->dirtyBitmap != nullptr)) {
+        this->mark_dirty(addr, length);
+    }
     return true;
 }
 
@@ -77,6 +224,7 @@ bool Bus::MemoryBlock::write(word_t addr, word_t data, unsigned int length) {
 
 word_t Bus::MemoryBlock::do_atomic(word_t addr, word_t data, unsigned int length, AMO amo) {
     void *p = this->get_ptr(addr);
+    this->mark_dirty(addr, length);
     switch (amo) {
         case AMO::SWAP: AMO_FUNC (swap, __atomic_exchange_n);
         case AMO::ADD:  AMO_FUNC (add,  __atomic_fetch_add );
@@ -93,6 +241,7 @@ word_t Bus::MemoryBlock::do_atomic(word_t addr, word_t data, unsigned int length
 
 bool Bus::MemoryBlock::compare_and_swap(word_t addr, void *expected, word_t desired, unsigned int length) {
     void *p = this->get_ptr(addr);
+    this->mark_dirty(addr, length);
     switch (length) {
         case 1: return __atomic_compare_exchange_n((int8_t  *)p, (int8_t  *)&expected, (int8_t )desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
         case 2: return __atomic_compare_exchange_n((int16_t *)p, (int16_t *)&expected, (int16_t)desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
@@ -120,7 +269,7 @@ Bus::MMIOMapBlock *Bus::match_mmio(word_t addr, word_t length) const {
     return nullptr;
 }
 
-bool Bus::add_memory_map(word_t start, word_t size) {
+bool Bus::add_memory_map(word_t start, word_t size, MemoryBacking backing) {
     // check if overlap
     for (auto &m : memoryMaps) {
         if (m->in_range(start) || m->in_range(start + size)) {
@@ -128,7 +277,11 @@ bool Bus::add_memory_map(word_t start, word_t size) {
         }
     }
     
-    auto m = new MemoryBlock(start, size);
+    auto m = new MemoryBlock(start, size, backing);
+    if (!m->is_valid()) {
+        delete m;
+        return false;
+    }
     memoryMaps.push_back(m);
     
     return true;
@@ -179,6 +332,7 @@ word_t Bus::read(word_t addr, word_t length, bool &valid) const {
 
     auto map = this->match_mmio(addr, length);
     if (likely(map != nullptr)) {
+        PERF_INC_SHARED(map->accesses);
         return map->dev->read(addr - map->start, length, valid);
     }
 
@@ -194,17 +348,32 @@ bool Bus::write(word_t addr, word_t data, word_t length) {
 
     auto map = this->match_mmio(addr, length);
     if (map != nullptr) {
+        PERF_INC_SHARED(map->accesses);
         return map->dev->write(addr - map->start, data, length);
     }
     return false;
 }
 
 void Bus::update() {
+    PERF_INC(this->updateCount);
     for (auto &m : mmioMaps) {
         m->dev->update();
     }
 }
 
+void Bus::mark_dirty(word_t addr, word_t length) const {
+    auto mem = this->match_memory(addr);
+    if (mem != nullptr) {
+        mem->mark_dirty(addr, std::min(length, mem->get_ptr_length(addr)));
+    }
+}
+
+void Bus::set_dirty_tracking(bool enable) {
+    for (auto &m : memoryMaps) {
+        m->set_dirty_tracking(enable);
+    }
+}
+
 std::optional<word_t> Bus::do_atomic(word_t addr, word_t data, unsigned int length, AMO amo) {
     auto mem = match_memory(addr, length);
     if (mem != nullptr) {
@@ -224,7 +393,7 @@ std::optional<bool> Bus::compare_and_swap(word_t addr, void *expected, word_t de
 }
 
 bool Bus::load_from_stream(std::istream &stream, word_t addr) {
-    uint8_t *dest = (uint8_t *)this->get_ptr(addr);
+    char *dest = (char *)this->get_ptr(addr);
     if (dest == nullptr) {
         WARN("Unable to write to destination.");
         return false;
@@ -232,28 +401,17 @@ bool Bus::load_from_stream(std::istream &stream, word_t addr) {
 
     word_t maxLength = this->get_ptr_length(addr);
 
-    char buffer[BUFFER_SIZE];
-    word_t writen = 0;
-
-    std::streamsize count = BUFFER_SIZE;
-    while (count == BUFFER_SIZE) {
-        stream.read((char *)buffer, BUFFER_SIZE);
-        count = stream.gcount();
-        if (writen + count >= maxLength) {
-            auto left = maxLength - writen;
-            std::memcpy(dest, buffer, left);
-            WARN("load image file to memory size out of range, only write %ld bytes", writen + count);
-            break;
-        }
-        std::memcpy(dest, buffer, count);
-        dest += count;
-        writen += count;
+    // Read straight into the guest memory.
+    stream.read(dest, maxLength);
+    this->mark_dirty(addr, stream.gcount());
+    if (stream.gcount() == (std::streamsize)maxLength && stream.peek() != std::istream::traits_type::eof()) {
+        WARN("load image file to memory size out of range, only write " FMT_VARU64 " bytes", (uint64_t)maxLength);
     }
     return true;
 }
 
 bool Bus::load_from_stream(std::istream &stream, word_t addr, word_t length) {
-    uint8_t *dest = (uint8_t *)this->get_ptr(addr);
+    char *dest = (char *)this->get_ptr(addr);
     if (dest == nullptr) {
         WARN("Unable to write to destination.");
         return false;
@@ -262,28 +420,74 @@ bool Bus::load_from_stream(std::istream &stream, word_t addr, word_t length) {
     word_t maxLength = this->get_ptr_length(addr);
     if (length > maxLength) {
         WARN("Length out of range.");
+        length = maxLength;
+    }
+
+    stream.read(dest, length);
+    this->mark_dirty(addr, stream.gcount());
+    if (stream.gcount() != (std::streamsize)length) {
+        WARN("caught stream eof, only write %ld bytes", stream.gcount());
+    }
+    return true;
+}
+
+bool Bus::load_from_fd(int fd, word_t addr, word_t offset, word_t length, bool cow) {
+    MemoryBlock *mem = this->match_memory(addr);
+    if (mem == nullptr) {
+        WARN("Unable to write to destination.");
+        return false;
+    }
+    
+    word_t maxLength = mem->get_ptr_length(addr);
+    if (length > maxLength) {
+        WARN("Length out of range, only write " FMT_VARU64 " bytes.", (uint64_t)maxLength);
+        length = maxLength;
     }
 
-    uint8_t buffer[BUFFER_SIZE];
     word_t writen = 0;
-    while (true) {
-        std::streamsize readLength = std::min((word_t)BUFFER_SIZE, length - writen);
-        stream.read((char *)buffer, readLength);
-        std::streamsize count = stream.gcount();
-        if (count != readLength) {
-            WARN("caught stream eof, only write " FMT_VARU64 " bytes", writen);
-            break;
+    if (cow) {
+        writen = mem->map_file_private(addr, fd, offset, length);
+    }
+    
+    // pread may return less than requested, for example 0x7ffff000 bytes at most on Linux.
+    uint8_t *dest = (uint8_t *)mem->get_ptr(addr);
+    while (writen < length) {
+        ssize_t count = pread(fd, dest + writen, length - writen, offset + writen);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            WARN("Failed to read file: %s", std::strerror(errno));
+            return false;
         }
-        std::memcpy(dest, buffer, count);
-        dest += count;
-        writen += count;
-        if (writen == length) {
+        if (count == 0) {
+            WARN("caught end of file, only write " FMT_VARU64 " bytes", (uint64_t)writen);
             break;
         }
+        writen += count;
     }
+    mem->mark_dirty(addr, writen);
+    
     return true;
 }
 
+bool Bus::load_from_file(const std::string &filename, word_t addr, bool cow) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        WARN("Failed to open file %s: %s", filename.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        WARN("Failed to stat file %s: %s", filename.c_str(), std::strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    bool r = this->load_from_fd(fd, addr, 0, st.st_size, cow);
+    close(fd);
+    return r;
+}
+
 bool Bus::load_from_memory(void *src, word_t addr, word_t length) {
     void *dest = this->get_ptr(addr);
     if (dest == nullptr) {
@@ -298,6 +502,7 @@ bool Bus::load_from_memory(void *src, word_t addr, word_t length) {
     }
     
     std::memcpy(dest, src, length);
+    this->mark_dirty(addr, length);
     
     return true;
 }
@@ -320,6 +525,59 @@ bool Bus::dump(std::ostream &stream, word_t addr, word_t length) const {
     return true;
 }
 
+bool Bus::dump_to_fd(int fd, word_t addr, word_t length) const {
+    const uint8_t *src = (const uint8_t *)this->get_ptr(addr);
+    if (src == nullptr) {
+        WARN("Unable to read from source.");
+        return false;
+    }
+
+    word_t maxLength = this->get_ptr_length(addr);
+    if (length > maxLength) {
+        WARN("Lenght out of range.");
+        return false;
+    }
+
+    word_t written = 0;
+    while (written < length) {
+        ssize_t count = ::write(fd, src + written, length - written);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            WARN("Failed to write file: %s", std::strerror(errno));
+            return false;
+        }
+        written += count;
+    }
+
+    return true;
+}
+
+// The old file may still be mapped copy-on-write as the guest memory, for example, after restoring
+// a snapshot from the same directory. Truncating it would take the pages from under the mapping,
+// so the content is written to a new file which replaces the old one.
+bool Bus::dump_to_file(const std::string &filename, word_t addr, word_t length) const {
+    std::string tmpname = filename + ".tmp";
+    int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        WARN("Failed to open file %s: %s", tmpname.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    bool r = this->dump_to_fd(fd, addr, length);
+    if (close(fd) != 0) {
+        WARN("Failed to close file %s: %s", tmpname.c_str(), std::strerror(errno));
+        r = false;
+    }
+    if (r && rename(tmpname.c_str(), filename.c_str()) != 0) {
+        WARN("Failed to rename %s to %s: %s", tmpname.c_str(), filename.c_str(), std::strerror(errno));
+        r = false;
+    }
+    if (!r) {
+        unlink(tmpname.c_str());
+    }
+    return r;
+}
+
 bool Bus::memset(word_t addr, word_t length, uint8_t byte) {
     void *dest = this->get_ptr(addr);
     word_t leftLength = this->get_ptr_length(addr);
@@ -330,6 +588,7 @@ bool Bus::memset(word_t addr, word_t length, uint8_t byte) {
     }
 
     std::memset(dest, byte, length);
+    this->mark_dirty(addr, length);
 
     return true;
 }
@@ -369,6 +628,7 @@ void *Bus::get_ptr(word_t addr) const{
 void *Bus::get_ptr(word_t addr, word_t length) const {
     auto mem = match_memory(addr);
     if (mem != nullptr) {
+        mem->mark_dirty(addr, std::min(length, mem->get_ptr_length(addr)));
         return mem->get_ptr(addr);
     }
 
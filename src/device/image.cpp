@@ -0,0 +1,438 @@
+#include "device/image.hpp"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace kxemu::device;
+
+static const char OVERLAY_MAGIC[8] = {'K', 'X', 'O', 'V', 'L', 'A', 'Y', '\0'};
+
+// preadv and pwritev may transfer less than requested, and at most IOV_MAX buffers at once.
+static bool rw_iov(int fd, struct iovec *iov, std::size_t iovcnt, off_t offset, bool write) {
+    while (iovcnt != 0) {
+        int count = std::min(iovcnt, (std::size_t)IOV_MAX);
+        ssize_t n = write ? pwritev(fd, iov, count, offset) : preadv(fd, iov, count, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            WARN("Failed to %s image: %s", write ? "write" : "read", std::strerror(errno));
+            return false;
+        }
+        if (n == 0) {
+            WARN("Caught end of image file.");
+            return false;
+        }
+
+        offset += n;
+        // Skip the buffers transferred completely and adjust the partial one
+        while (iovcnt != 0 && (std::size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt != 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static bool rw_buf(int fd, void *buf, std::size_t length, off_t offset, bool write) {
+    struct iovec iov = {buf, length};
+    return rw_iov(fd, &iov, 1, offset, write);
+}
+
+// Move the first length bytes of iov to out
+static void iov_take(struct iovec *&iov, std::size_t &iovcnt, uint64_t length, std::vector<struct iovec> &out) {
+    out.clear();
+    while (length != 0 && iovcnt != 0) {
+        std::size_t n = std::min((uint64_t)iov->iov_len, length);
+        out.push_back({iov->iov_base, n});
+        length -= n;
+        if (n == iov->iov_len) {
+            iov++;
+            iovcnt--;
+        } else {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static uint64_t iov_length(const struct iovec *iov, std::size_t iovcnt) {
+    uint64_t length = 0;
+    for (std::size_t i = 0; i < iovcnt; i++) {
+        length += iov[i].iov_len;
+    }
+    return length;
+}
+
+static inline uint64_t round_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) / align * align;
+}
+
+RawImage::~RawImage() {
+    if (this->fd >= 0) {
+        close(this->fd);
+    }
+}
+
+bool RawImage::open(const std::string &filepath) {
+    this->fd = ::open(filepath.c_str(), O_RDWR | O_CLOEXEC);
+    if (this->fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(this->fd, &st) != 0) {
+        close(this->fd);
+        this->fd = -1;
+        return false;
+    }
+    this->size = st.st_size;
+    return true;
+}
+
+bool RawImage::read(struct iovec *iov, std::size_t iovcnt, uint64_t offset) {
+    return rw_iov(this->fd, iov, iovcnt, offset, false);
+}
+
+bool RawImage::write(struct iovec *iov, std::size_t iovcnt, uint64_t offset) {
+    return rw_iov(this->fd, iov, iovcnt, offset, true);
+}
+
+bool RawImage::flush() {
+    return fdatasync(this->fd) == 0;
+}
+
+MappedImage::~MappedImage() {
+    if (this->data != nullptr) {
+        munmap((void *)this->data, this->size);
+    }
+}
+
+bool MappedImage::open(const std::string &filepath) {
+    int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    // The mapping keeps the file open
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        WARN("Failed to map image %s: %s", filepath.c_str(), std::strerror(errno));
+        return false;
+    }
+    this->data = (const uint8_t *)p;
+    this->size = st.st_size;
+    return true;
+}
+
+bool MappedImage::read(struct iovec *iov, std::size_t iovcnt, uint64_t offset) {
+    for (std::size_t i = 0; i < iovcnt; i++) {
+        if (offset > this->size || iov[i].iov_len > this->size - offset) {
+            WARN("Read out of mapped image, offset=%lu", offset);
+            return false;
+        }
+        std::memcpy(iov[i].iov_base, this->data + offset, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    return true;
+}
+
+bool MappedImage::write(struct iovec *, std::size_t, uint64_t) {
+    return false;
+}
+
+bool MappedImage::flush() {
+    return true;
+}
+
+OverlayImage::~OverlayImage() {
+    if (this->baseFd >= 0) {
+        close(this->baseFd);
+    }
+    if (this->deltaFd >= 0) {
+        close(this->deltaFd);
+    }
+}
+
+bool OverlayImage::open(const std::string &basePath, const std::string &deltaPath) {
+    this->basePath = basePath;
+    this->baseFd = ::open(basePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (this->baseFd < 0) {
+        WARN("Failed to open base image %s: %s", basePath.c_str(), std::strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(this->baseFd, &st) != 0) {
+        return false;
+    }
+    this->size = st.st_size;
+
+    this->deltaFd = ::open(deltaPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (this->deltaFd < 0 || fstat(this->deltaFd, &st) != 0) {
+        WARN("Failed to open delta image %s: %s", deltaPath.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    uint64_t l1Size = round_up(round_up(this->size, CLUSTER_SIZE) / CLUSTER_SIZE, L2_ENTRIES) / L2_ENTRIES;
+    this->l1.assign(l1Size, 0);
+    this->l2.clear();
+    this->l2.resize(l1Size);
+    this->dataStart = CLUSTER_SIZE + round_up(l1Size * sizeof(uint64_t), CLUSTER_SIZE);
+    this->fileEnd = this->dataStart;
+
+    return st.st_size == 0 ? this->create_delta() : this->load_delta();
+}
+
+bool OverlayImage::create_delta() {
+    OverlayHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, OVERLAY_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.clusterBits = CLUSTER_BITS;
+    header.size = this->size;
+    header.l1Offset = CLUSTER_SIZE;
+    header.l1Size = this->l1.size();
+
+    // The L1 table is filled with zero by ftruncate
+    if (ftruncate(this->deltaFd, this->dataStart) != 0 || !rw_buf(this->deltaFd, &header, sizeof(header), 0, true)) {
+        WARN("Failed to create delta image: %s", std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool OverlayImage::load_delta() {
+    OverlayHeader header;
+    if (!rw_buf(this->deltaFd, &header, sizeof(header), 0, false)) {
+        return false;
+    }
+    if (std::memcmp(header.magic, OVERLAY_MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION) {
+        WARN("Not a delta image of this version.");
+        return false;
+    }
+    if (header.clusterBits != CLUSTER_BITS || header.l1Offset != CLUSTER_SIZE || header.l1Size != this->l1.size() || header.size != this->size) {
+        WARN("Delta image does not match the base image.");
+        return false;
+    }
+
+    if (!this->l1.empty() && !rw_buf(this->deltaFd, this->l1.data(), this->l1.size() * sizeof(uint64_t), header.l1Offset, false)) {
+        return false;
+    }
+    for (std::size_t i = 0; i < this->l1.size(); i++) {
+        if (this->l1[i] == 0) continue;
+        if (this->l1[i] % CLUSTER_SIZE != 0 || this->l1[i] < this->dataStart) {
+            WARN("Invalid L2 table offset in delta image, index=%lu", i);
+            return false;
+        }
+        this->l2[i] = std::make_unique<uint64_t[]>(L2_ENTRIES);
+        if (!rw_buf(this->deltaFd, this->l2[i].get(), CLUSTER_SIZE, this->l1[i], false)) {
+            return false;
+        }
+    }
+
+    struct stat st;
+    if (fstat(this->deltaFd, &st) != 0) {
+        return false;
+    }
+    this->fileEnd = std::max(this->dataStart, round_up(st.st_size, CLUSTER_SIZE));
+    return true;
+}
+
+uint64_t OverlayImage::lookup(uint64_t cluster) {
+    std::shared_lock<std::shared_mutex> lock(this->indexMtx);
+    const auto &table = this->l2[cluster / L2_ENTRIES];
+    return table == nullptr ? 0 : table[cluster % L2_ENTRIES];
+}
+
+// Called with the indexMtx locked, the data cluster must be written before
+bool OverlayImage::set_l2_entry(uint64_t cluster, uint64_t clusterOffset) {
+    uint64_t l1Index = cluster / L2_ENTRIES;
+    uint64_t l2Index = cluster % L2_ENTRIES;
+    auto &table = this->l2[l1Index];
+    if (table == nullptr) {
+        uint64_t tableOffset = this->fileEnd;
+        if (ftruncate(this->deltaFd, tableOffset + CLUSTER_SIZE) != 0) {
+            WARN("Failed to allocate L2 table: %s", std::strerror(errno));
+            return false;
+        }
+        this->fileEnd += CLUSTER_SIZE;
+        uint64_t l1Entry = tableOffset;
+        if (!rw_buf(this->deltaFd, &l1Entry, sizeof(l1Entry), CLUSTER_SIZE + l1Index * sizeof(uint64_t), true)) {
+            return false;
+        }
+        this->l1[l1Index] = tableOffset;
+        table = std::make_unique<uint64_t[]>(L2_ENTRIES);
+    }
+
+    if (!rw_buf(this->deltaFd, &clusterOffset, sizeof(clusterOffset), this->l1[l1Index] + l2Index * sizeof(uint64_t), true)) {
+        return false;
+    }
+    table[l2Index] = clusterOffset;
+    return true;
+}
+
+// Copy the cluster from the base image to a new cluster of the delta
+uint64_t OverlayImage::allocate(uint64_t cluster) {
+    std::unique_lock<std::shared_mutex> lock(this->indexMtx);
+    const auto &table = this->l2[cluster / L2_ENTRIES];
+    if (table != nullptr && table[cluster % L2_ENTRIES] != 0) {
+        return table[cluster % L2_ENTRIES]; // Allocated by another thread
+    }
+
+    std::vector<uint8_t> buffer(CLUSTER_SIZE, 0);
+    uint64_t start = cluster * CLUSTER_SIZE;
+    uint64_t length = std::min(CLUSTER_SIZE, this->size - start);
+    if (!rw_buf(this->baseFd, buffer.data(), length, start, false)) {
+        return 0;
+    }
+
+    uint64_t clusterOffset = this->fileEnd;
+    if (!rw_buf(this->deltaFd, buffer.data(), CLUSTER_SIZE, clusterOffset, true)) {
+        return 0;
+    }
+    this->fileEnd += CLUSTER_SIZE;
+    if (!this->set_l2_entry(cluster, clusterOffset)) {
+        return 0;
+    }
+    return clusterOffset;
+}
+
+bool OverlayImage::read(struct iovec *iov, std::size_t iovcnt, uint64_t offset) {
+    std::vector<struct iovec> part;
+    uint64_t length = iov_length(iov, iovcnt);
+    if (offset > this->size || length > this->size - offset) {
+        WARN("Read out of overlay image, offset=%lu, length=%lu", offset, length);
+        return false;
+    }
+    while (length != 0) {
+        // Each cluster is read from the delta or the base
+        uint64_t cluster = offset / CLUSTER_SIZE;
+        uint64_t inner = offset % CLUSTER_SIZE;
+        uint64_t n = std::min(CLUSTER_SIZE - inner, length);
+        iov_take(iov, iovcnt, n, part);
+
+        uint64_t clusterOffset = this->lookup(cluster);
+        bool ok = clusterOffset != 0 ? rw_iov(this->deltaFd, part.data(), part.size(), clusterOffset + inner, false)
+                                     : rw_iov(this->baseFd , part.data(), part.size(), offset, false);
+        if (!ok) {
+            return false;
+        }
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool OverlayImage::write(struct iovec *iov, std::size_t iovcnt, uint64_t offset) {
+    std::vector<struct iovec> part;
+    uint64_t length = iov_length(iov, iovcnt);
+    if (offset > this->size || length > this->size - offset) {
+        WARN("Write out of overlay image, offset=%lu, length=%lu", offset, length);
+        return false;
+    }
+    while (length != 0) {
+        uint64_t cluster = offset / CLUSTER_SIZE;
+        uint64_t inner = offset % CLUSTER_SIZE;
+        uint64_t n = std::min(CLUSTER_SIZE - inner, length);
+        iov_take(iov, iovcnt, n, part);
+
+        uint64_t clusterOffset = this->lookup(cluster);
+        if (clusterOffset == 0) {
+            clusterOffset = this->allocate(cluster);
+            if (clusterOffset == 0) {
+                WARN("Failed to allocate cluster in delta image, cluster=%lu", cluster);
+                return false;
+            }
+        }
+        if (!rw_iov(this->deltaFd, part.data(), part.size(), clusterOffset + inner, true)) {
+            return false;
+        }
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool OverlayImage::flush() {
+    return fdatasync(this->deltaFd) == 0;
+}
+
+bool OverlayImage::clear_delta() {
+    // Cut off the L2 tables and data clusters, and fill the L1 table with zero
+    if (ftruncate(this->deltaFd, CLUSTER_SIZE) != 0 || ftruncate(this->deltaFd, this->dataStart) != 0) {
+        WARN("Failed to truncate delta image: %s", std::strerror(errno));
+        return false;
+    }
+    std::fill(this->l1.begin(), this->l1.end(), 0);
+    for (auto &table : this->l2) {
+        table.reset();
+    }
+    this->fileEnd = this->dataStart;
+    return true;
+}
+
+bool OverlayImage::discard() {
+    std::unique_lock<std::shared_mutex> lock(this->indexMtx);
+    return this->clear_delta();
+}
+
+bool OverlayImage::commit() {
+    std::unique_lock<std::shared_mutex> lock(this->indexMtx);
+    int fd = ::open(this->basePath.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        WARN("Failed to open base image %s for writing: %s", this->basePath.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    std::vector<uint8_t> buffer(CLUSTER_SIZE);
+    bool ok = true;
+    for (std::size_t i = 0; i < this->l2.size() && ok; i++) {
+        if (this->l2[i] == nullptr) continue;
+        for (uint64_t j = 0; j < L2_ENTRIES && ok; j++) {
+            uint64_t clusterOffset = this->l2[i][j];
+            if (clusterOffset == 0) continue;
+            uint64_t start = (i * L2_ENTRIES + j) * CLUSTER_SIZE;
+            uint64_t length = std::min(CLUSTER_SIZE, this->size - start);
+            ok = rw_buf(this->deltaFd, buffer.data(), length, clusterOffset, false) &&
+                 rw_buf(fd, buffer.data(), length, start, true);
+        }
+    }
+
+    // The delta is dropped only after the base image is on the disk
+    ok = ok && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok) {
+        WARN("Failed to commit delta image to %s", this->basePath.c_str());
+        return false;
+    }
+    return this->clear_delta();
+}
+
+uint64_t OverlayImage::allocated_clusters() {
+    std::shared_lock<std::shared_mutex> lock(this->indexMtx);
+    uint64_t count = 0;
+    for (const auto &table : this->l2) {
+        if (table == nullptr) continue;
+        count += std::count_if(table.get(), table.get() + L2_ENTRIES, [](uint64_t e) { return e != 0; });
+    }
+    return count;
+}
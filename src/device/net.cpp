@@ -0,0 +1,308 @@
+#include "device/net.hpp"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace kxemu::device;
+
+static constexpr std::size_t FRAME_MAX = 65536;
+
+std::map<std::string, std::unique_ptr<NetSwitch>> NetSwitch::switches;
+std::mutex NetSwitch::switchesMtx;
+
+static bool make_address(const std::string &path, struct sockaddr_un &addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path)) {
+        WARN("Socket path is too long: %s", path.c_str());
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// Create a unix datagram socket bound to path, the stale socket file is removed
+static int bind_dgram_socket(const std::string &path) {
+    struct sockaddr_un addr;
+    if (!make_address(path, addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        WARN("Failed to create socket: %s", std::strerror(errno));
+        return -1;
+    }
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        WARN("Failed to bind %s: %s", path.c_str(), std::strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Copy the frame in src to dst, the frame is truncated if dst is shorter
+static ssize_t iov_copy(const struct iovec *dst, std::size_t dstcnt, const struct iovec *src, std::size_t srccnt) {
+    std::size_t total = 0;
+    std::size_t d = 0, doff = 0;
+    for (std::size_t s = 0; s < srccnt && d < dstcnt; s++) {
+        std::size_t soff = 0;
+        while (soff < src[s].iov_len && d < dstcnt) {
+            std::size_t n = std::min(src[s].iov_len - soff, dst[d].iov_len - doff);
+            std::memcpy((uint8_t *)dst[d].iov_base + doff, (const uint8_t *)src[s].iov_base + soff, n);
+            soff += n;
+            doff += n;
+            total += n;
+            if (doff == dst[d].iov_len) {
+                d++;
+                doff = 0;
+            }
+        }
+    }
+    return total;
+}
+
+UnixDgramBackend::~UnixDgramBackend() {
+    if (this->reader.joinable()) {
+        char c = 0;
+        if (::write(this->stopPipe[1], &c, 1) < 0) {
+            WARN("Failed to stop network reader.");
+        }
+        this->reader.join();
+    }
+    if (this->stopPipe[0] >= 0) {
+        close(this->stopPipe[0]);
+        close(this->stopPipe[1]);
+    }
+    if (this->fd >= 0) {
+        close(this->fd);
+        unlink(this->localPath.c_str());
+    }
+}
+
+bool UnixDgramBackend::open(const std::string &localPath, const std::string &peerPath) {
+    // The peer may start later, so the socket is not connected
+    if (!make_address(peerPath, this->peer)) {
+        return false;
+    }
+    this->fd = bind_dgram_socket(localPath);
+    if (this->fd < 0) {
+        return false;
+    }
+    this->localPath = localPath;
+    return pipe2(this->stopPipe, O_CLOEXEC) == 0;
+}
+
+void UnixDgramBackend::attach(NetPort *port) {
+    NetBackend::attach(port);
+    this->reader = std::thread(&UnixDgramBackend::reader_thread, this);
+}
+
+void UnixDgramBackend::send(const struct iovec *iov, std::size_t iovcnt) {
+    struct msghdr msg = {};
+    msg.msg_name = &this->peer;
+    msg.msg_namelen = sizeof(this->peer);
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = std::min(iovcnt, (std::size_t)IOV_MAX);
+    // The frame is lost if the peer is not running, as an unplugged cable
+    sendmsg(this->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+void UnixDgramBackend::reader_thread() {
+    while (true) {
+        struct pollfd fds[2] = {
+            {this->fd, POLLIN, 0},
+            {this->stopPipe[0], POLLIN, 0},
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            WARN("Failed to poll network socket: %s", std::strerror(errno));
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        if (fds[0].revents == 0) {
+            continue;
+        }
+
+        // Receive the datagram straight into the guest buffers
+        bool received = false;
+        bool delivered = this->port->receive([this, &received](const struct iovec *iov, std::size_t iovcnt) {
+            received = true;
+            return readv(this->fd, iov, std::min(iovcnt, (std::size_t)IOV_MAX));
+        }, true);
+        if (!delivered && !received) {
+            recv(this->fd, nullptr, 0, MSG_DONTWAIT); // Drop the datagram
+        }
+    }
+}
+
+NetSwitch *NetSwitch::get(const std::string &path) {
+    std::lock_guard<std::mutex> lock(switchesMtx);
+    auto iter = switches.find(path);
+    if (iter != switches.end()) {
+        return iter->second.get();
+    }
+
+    auto sw = std::make_unique<NetSwitch>();
+    if (!sw->listen(path)) {
+        return nullptr;
+    }
+    return switches.emplace(path, std::move(sw)).first->second.get();
+}
+
+bool NetSwitch::listen(const std::string &path) {
+    this->fd = bind_dgram_socket(path);
+    if (this->fd < 0 || pipe2(this->stopPipe, O_CLOEXEC) != 0) {
+        return false;
+    }
+    this->path = path;
+    this->reader = std::thread(&NetSwitch::reader_thread, this);
+    return true;
+}
+
+NetSwitch::~NetSwitch() {
+    if (this->reader.joinable()) {
+        char c = 0;
+        if (::write(this->stopPipe[1], &c, 1) < 0) {
+            WARN("Failed to stop network switch.");
+        }
+        this->reader.join();
+    }
+    if (this->stopPipe[0] >= 0) {
+        close(this->stopPipe[0]);
+        close(this->stopPipe[1]);
+    }
+    if (this->fd >= 0) {
+        close(this->fd);
+        unlink(this->path.c_str());
+    }
+}
+
+// Called with mtx locked
+NetSwitch::Port *NetSwitch::find_remote(const struct sockaddr_un &addr, socklen_t length) {
+    for (auto &port : this->ports) {
+        if (port->local == nullptr && port->remoteLength == length && std::memcmp(&port->remote, &addr, length) == 0) {
+            return port.get();
+        }
+    }
+    auto port = std::make_unique<Port>();
+    port->remote = addr;
+    port->remoteLength = length;
+    this->ports.push_back(std::move(port));
+    return this->ports.back().get();
+}
+
+// Called with mtx locked
+void NetSwitch::deliver(Port *to, const struct iovec *iov, std::size_t iovcnt) {
+    if (to->local != nullptr) {
+        to->local->receive([iov, iovcnt](const struct iovec *dst, std::size_t dstcnt) {
+            return iov_copy(dst, dstcnt, iov, iovcnt);
+        }, false);
+    } else if (to->remoteLength != 0) {
+        struct msghdr msg = {};
+        msg.msg_name = &to->remote;
+        msg.msg_namelen = to->remoteLength;
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = iovcnt;
+        sendmsg(this->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
+
+void NetSwitch::forward(Port *from, const struct iovec *iov, std::size_t iovcnt) {
+    // Destination and source MAC address
+    uint8_t header[12];
+    struct iovec headerIov = {header, sizeof(header)};
+    if (iov_copy(&headerIov, 1, iov, iovcnt) != sizeof(header)) {
+        return;
+    }
+    MAC dst, src;
+    std::copy(header, header + 6, dst.begin());
+    std::copy(header + 6, header + 12, src.begin());
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (!(src[0] & 1)) {
+        this->table[src] = from;
+    }
+
+    auto iter = this->table.find(dst);
+    if (!(dst[0] & 1) && iter != this->table.end()) {
+        if (iter->second != from) {
+            this->deliver(iter->second, iov, iovcnt);
+        }
+        return;
+    }
+
+    // Broadcast, multicast or unknown unicast
+    for (auto &port : this->ports) {
+        if (port.get() != from) {
+            this->deliver(port.get(), iov, iovcnt);
+        }
+    }
+}
+
+void NetSwitch::reader_thread() {
+    std::vector<uint8_t> buffer(FRAME_MAX);
+    while (true) {
+        struct pollfd fds[2] = {
+            {this->fd, POLLIN, 0},
+            {this->stopPipe[0], POLLIN, 0},
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            WARN("Failed to poll network switch: %s", std::strerror(errno));
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        if (fds[0].revents == 0) {
+            continue;
+        }
+
+        struct sockaddr_un addr;
+        socklen_t length = sizeof(addr);
+        ssize_t n = recvfrom(this->fd, buffer.data(), buffer.size(), MSG_DONTWAIT, (struct sockaddr *)&addr, &length);
+        if (n <= 0 || length <= sizeof(sa_family_t)) {
+            continue; // The unbound senders can not receive frames
+        }
+
+        Port *from;
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            from = this->find_remote(addr, length);
+        }
+        struct iovec iov = {buffer.data(), (std::size_t)n};
+        this->forward(from, &iov, 1);
+    }
+}
+
+void NetSwitch::LocalBackend::attach(NetPort *port) {
+    NetBackend::attach(port);
+    std::lock_guard<std::mutex> lock(this->sw->mtx);
+    auto p = std::make_unique<Port>();
+    p->local = port;
+    this->self = p.get();
+    this->sw->ports.push_back(std::move(p));
+}
+
+void NetSwitch::LocalBackend::send(const struct iovec *iov, std::size_t iovcnt) {
+    this->sw->forward(this->self, iov, iovcnt);
+}
+
+NetSwitch::LocalBackend::~LocalBackend() {
+    std::lock_guard<std::mutex> lock(this->sw->mtx);
+    std::erase_if(this->sw->table, [this](const auto &entry) { return entry.second == this->self; });
+    std::erase_if(this->sw->ports, [this](const auto &port) { return port.get() == this->self; });
+}
@@ -2,11 +2,14 @@
 #include "log.h"
 #include "word.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
 #include <iostream>
 #include <mutex>
+#include <thread>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -15,8 +18,6 @@
 #define LSR_RX_READY (1 << 0)
 #define LSR_TX_READY (1 << 5)
 
-#define BUFFER_SIZE 1024
-
 using namespace kxemu::device;
 
 static int open_socket_client(const std::string &ip, int port) {
@@ -54,17 +55,14 @@ word_t Uart16650::read(word_t offset, word_t size, bool &valid) {
             return lsb;
         } else {
             // RBR: Receiver Buffer Register
-            if (queue.empty()) {
+            uint8_t c;
+            if (rxRing.empty()) {
                 return -1;
             }
-
-            queueMtx.lock();
-            uint8_t c = queue.front();
-            queue.pop();
-            if (queue.empty()) {
-                lsr &= ~LSR_RX_READY;
+            std::lock_guard<std::mutex> lock(rxMtx);
+            if (!rxRing.pop(c)) {
+                return -1;
             }
-            queueMtx.unlock();
             
             // Clear Receiver Data Available Interrupt
             if (ier & 0x01 && (iir & 0b00111111) == 0b10) {
@@ -89,7 +87,7 @@ word_t Uart16650::read(word_t offset, word_t size, bool &valid) {
         return lcr;
     } else if (offset == 5) {
         // LSR: Line Status Register
-        return lsr;
+        return read_lsr();
     } else if (offset == 6) {
         // MSR: Modem Status Register
         return msr;
@@ -129,12 +127,8 @@ bool Uart16650::write(word_t offset, word_t data, word_t size) {
         // FCR: FIFO Control Register
         if (data & (1 << 1)) {
             // Clear Receive FIFO
-            queueMtx.lock();
-            while (!queue.empty()) {
-                queue.pop();
-            }
-            lsr &= ~LSR_RX_READY;
-            queueMtx.unlock();
+            std::lock_guard<std::mutex> lock(rxMtx);
+            rxRing.clear();
         }
 
         switch ((data & 0b11000000) >> 6) {
@@ -161,8 +155,8 @@ bool Uart16650::write(word_t offset, word_t data, word_t size) {
 void Uart16650::update() {
     if (mode != Mode::SOCKET) return;
 
-    static struct timeval timeout = {};
-    static fd_set read_fds;
+    struct timeval timeout = {};
+    fd_set read_fds;
     FD_ZERO(&read_fds);
     FD_SET(recvSocket, &read_fds);
 
@@ -175,8 +169,12 @@ void Uart16650::update() {
         return;
     }
 
-    char buffer[64];
-    ssize_t n = ::read(recvSocket, buffer, sizeof(buffer));
+    char buffer[256];
+    std::size_t space = RX_BUFFER_SIZE - rxRing.size();
+    if (space == 0) {
+        return; // Keep the data in the socket until the guest reads
+    }
+    ssize_t n = ::read(recvSocket, buffer, std::min(space, sizeof(buffer)));
     if (n <= 0) {
         WARN("Failed to receive data from socket.");
         mode = Mode::NONE;
@@ -196,14 +194,20 @@ void Uart16650::clear_interrupt() {
     this->interrput = false;
 }
 
-bool Uart16650::putch(uint8_t data) {
-    std::lock_guard<std::mutex> lock(queueMtx);
-    if (queue.size() >= BUFFER_SIZE) {
-        return false;
+uint8_t Uart16650::read_lsr() {
+    uint8_t value = lsr & ~(LSR_RX_READY | LSR_TX_READY);
+    if (!rxRing.empty()) {
+        value |= LSR_RX_READY;
     }
-    queue.push(data);
-    lsr |= LSR_RX_READY;
-    return true;
+    if ((lsr & LSR_TX_READY) && !txRing.full()) {
+        value |= LSR_TX_READY;
+    }
+    return value;
+}
+
+bool Uart16650::putch(uint8_t data) {
+    std::lock_guard<std::mutex> lock(rxMtx);
+    return rxRing.push(data);
 }
 
 void Uart16650::set_output_stream(std::ostream &os) {
@@ -212,8 +216,8 @@ void Uart16650::set_output_stream(std::ostream &os) {
     } 
     mode = Mode::STREAM;
     stream = &os;
-    // For now, we assume that the stream is always ready to write
     lsr |= LSR_TX_READY;
+    start_writer();
 }
 
 bool Uart16650::open_socket(const std::string &ip, int port) {
@@ -229,19 +233,18 @@ bool Uart16650::open_socket(const std::string &ip, int port) {
     }
     mode = Mode::SOCKET;
     lsr |= LSR_TX_READY;
+    start_writer();
     return true;
 }
 
 void Uart16650::recv_byte(uint8_t c) {
-    std::lock_guard<std::mutex> lock(queueMtx);
-    if (queue.size() >= BUFFER_SIZE) {
+    std::lock_guard<std::mutex> lock(rxMtx);
+    if (!rxRing.push(c)) {
         WARN("uart buffer is full, drop data.");
         return;
     }
-    queue.push(c);
-    lsr |= LSR_RX_READY;
 
-    if (queue.size() >= this->recvFIFOTriggerByteCount) {
+    if (rxRing.size() >= this->recvFIFOTriggerByteCount) {
         if (ier & 0x01) {
             iir = 0b10 | 0b11000000; // Interrupt Pending
             this->interrput = true;
@@ -250,29 +253,138 @@ void Uart16650::recv_byte(uint8_t c) {
 }
 
 void Uart16650::send_byte(uint8_t c) {
-    std::lock_guard<std::mutex> lock(senderMtx);
+    if (mode == Mode::NONE) {
+        return;
+    }
+
+    // The guest should wait for THRE before writing, wait for the writer if it does not
+    while (!txRing.push(c)) {
+        std::this_thread::yield();
+    }
+
+    // Only wake the writer up if it is waiting, the fence pairs with the one in writer_thread
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writerSleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(writerMtx);
+        writerCV.notify_one();
+    }
+}
+
+void Uart16650::start_writer() {
+    writer = std::thread(&Uart16650::writer_thread, this);
+}
+
+bool Uart16650::flush_output(const uint8_t *data, std::size_t length) {
     if (mode == Mode::STREAM) {
-        if (stream == nullptr) {
-            WARN("uart stream is not set, output to stdout.");
-            std::cout << c;
-            std::cout.flush();
-        } else {
-            *stream << c;
-            stream->flush();
-        } 
-    } else if (mode == Mode::SOCKET) {
-        ssize_t n = send(sendSocket, &c, 1, 0);
+        std::ostream &os = stream == nullptr ? std::cout : *stream;
+        os.write((const char *)data, length);
+        os.flush();
+        return true;
+    }
+
+    while (length != 0) {
+        ssize_t n = send(sendSocket, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
         if (n <= 0) {
             WARN("Failed to send data to socket.");
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+void Uart16650::writer_thread() {
+    while (true) {
+        // Write all the contiguous bytes in the ring at once
+        const uint8_t *data;
+        std::size_t length;
+        while ((length = txRing.front_span(data)) != 0) {
+            flush_output(data, length);
+            txRing.consume(length);
         }
+
+        std::unique_lock<std::mutex> lock(writerMtx);
+        if (stopWriter) {
+            return;
+        }
+        writerSleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        writerCV.wait(lock, [this]() { return !txRing.empty() || stopWriter; });
+        writerSleeping.store(false, std::memory_order_relaxed);
     }
 }
 
+bool Uart16650::save_state(utils::SnapshotWriter &writer) {
+    writer.write(lsb);
+    writer.write(msb);
+    writer.write(ier);
+    writer.write(iir);
+    writer.write(lcr);
+    writer.write(read_lsr());
+    writer.write(msr);
+    writer.write(interrput);
+    writer.write<uint32_t>(recvFIFOTriggerByteCount);
+
+    // Bytes received but not read by the guest yet
+    // The machine is stopped, but kdb or the host input may still push to the ring
+    std::lock_guard<std::mutex> lock(rxMtx);
+    std::size_t size = rxRing.size();
+    writer.write<uint32_t>(size);
+    for (std::size_t i = 0; i < size; i++) {
+        writer.write(rxRing.at(i));
+    }
+    return writer.good();
+}
+
+bool Uart16650::load_state(utils::SnapshotReader &reader) {
+    uint8_t savedLSR;
+    uint32_t triggerCount;
+    reader.read(lsb);
+    reader.read(msb);
+    reader.read(ier);
+    reader.read(iir);
+    reader.read(lcr);
+    reader.read(savedLSR);
+    reader.read(msr);
+    reader.read(interrput);
+    reader.read(triggerCount);
+    recvFIFOTriggerByteCount = triggerCount;
+    
+    // Transmitter is ready or not depends on the output of this uart, not the snapshot,
+    // and Data Ready depends on the restored RX ring
+    lsr = (savedLSR & ~(LSR_TX_READY | LSR_RX_READY)) | (lsr & LSR_TX_READY);
+
+    uint32_t size;
+    if (!reader.read(size) || size > RX_BUFFER_SIZE) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(rxMtx);
+    rxRing.clear();
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t c;
+        reader.read(c);
+        rxRing.push(c);
+    }
+    return reader.good();
+}
+
 const char *Uart16650::get_type_name() const {
     return "uart16650";
 }
 
 Uart16650::~Uart16650() {
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(writerMtx);
+            stopWriter = true;
+            writerCV.notify_one();
+        }
+        writer.join();
+    }
     close(recvSocket);
     close(sendSocket);
 }
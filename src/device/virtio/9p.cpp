@@ -0,0 +1,874 @@
+#include "device/virtio/9p.hpp"
+#include "device/def.hpp"
+#include "device/virtio/virtio.hpp"
+#include "device/virtio/def.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace kxemu::device;
+
+// Message types of 9P2000.L, the response of a T-message is the next one
+enum P9Type : uint8_t {
+    P9_RLERROR     = 7,
+    P9_TSTATFS     = 8,
+    P9_TLOPEN      = 12,
+    P9_TLCREATE    = 14,
+    P9_TSYMLINK    = 16,
+    P9_TMKNOD      = 18,
+    P9_TRENAME     = 20,
+    P9_TREADLINK   = 22,
+    P9_TGETATTR    = 24,
+    P9_TSETATTR    = 26,
+    P9_TXATTRWALK  = 30,
+    P9_TXATTRCREATE = 32,
+    P9_TREADDIR    = 40,
+    P9_TFSYNC      = 50,
+    P9_TLOCK       = 52,
+    P9_TGETLOCK    = 54,
+    P9_TLINK       = 70,
+    P9_TMKDIR      = 72,
+    P9_TRENAMEAT   = 74,
+    P9_TUNLINKAT   = 76,
+    P9_TVERSION    = 100,
+    P9_TAUTH       = 102,
+    P9_TATTACH     = 104,
+    P9_TFLUSH      = 108,
+    P9_TWALK       = 110,
+    P9_TREAD       = 116,
+    P9_TWRITE      = 118,
+    P9_TCLUNK      = 120,
+    P9_TREMOVE     = 122,
+};
+
+static constexpr uint32_t MSIZE_MIN = 4096; // As the Linux client, the messages are sized by msize - header
+static constexpr uint32_t MSIZE_MAX = 512 * 1024;
+static constexpr std::size_t HEADER_SIZE = 7;        // size[4] type[1] tag[2]
+static constexpr std::size_t TWRITE_HEADER_SIZE = 23; // header fid[4] offset[8] count[4]
+static constexpr std::size_t RREAD_HEADER_SIZE = 11;  // header count[4]
+
+static constexpr uint8_t QTDIR     = 0x80;
+static constexpr uint8_t QTSYMLINK = 0x02;
+static constexpr uint8_t QTFILE    = 0x00;
+
+static constexpr uint64_t GETATTR_BASIC = 0x7ff;
+
+static constexpr uint32_t SETATTR_MODE      = 0x001;
+static constexpr uint32_t SETATTR_UID       = 0x002;
+static constexpr uint32_t SETATTR_GID       = 0x004;
+static constexpr uint32_t SETATTR_SIZE      = 0x008;
+static constexpr uint32_t SETATTR_ATIME     = 0x010;
+static constexpr uint32_t SETATTR_MTIME     = 0x020;
+static constexpr uint32_t SETATTR_ATIME_SET = 0x080;
+static constexpr uint32_t SETATTR_MTIME_SET = 0x100;
+
+static constexpr uint32_t UNLINKAT_REMOVEDIR = 0x200;
+static constexpr uint32_t V9FS_MAGIC = 0x01021997;
+
+// The open flags of 9P2000.L are the generic Linux values, as the host
+static constexpr int OPEN_FLAGS_MASK = O_ACCMODE | O_TRUNC | O_APPEND | O_EXCL;
+
+namespace {
+
+class P9Reader {
+private:
+    const std::vector<uint8_t> &buffer;
+    std::size_t pos;
+    bool valid = true;
+
+public:
+    P9Reader(const std::vector<uint8_t> &buffer, std::size_t pos) : buffer(buffer), pos(pos) {}
+
+    template<typename T>
+    T get() {
+        T value = 0;
+        if (pos + sizeof(T) > buffer.size()) {
+            valid = false;
+            return value;
+        }
+        std::memcpy(&value, buffer.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    std::string get_string() {
+        uint16_t length = get<uint16_t>();
+        if (!valid || pos + length > buffer.size()) {
+            valid = false;
+            return "";
+        }
+        std::string s((const char *)buffer.data() + pos, length);
+        pos += length;
+        return s;
+    }
+
+    bool good() const {
+        return valid;
+    }
+};
+
+// Close the fd when leaving the scope
+class ScopedFd {
+private:
+    int fd;
+
+public:
+    explicit ScopedFd(int fd) : fd(fd) {}
+    ~ScopedFd() {
+        if (fd >= 0) close(fd);
+    }
+    ScopedFd(const ScopedFd &) = delete;
+    ScopedFd &operator=(const ScopedFd &) = delete;
+
+    int get() const {
+        return fd;
+    }
+};
+
+class P9Writer {
+private:
+    std::vector<uint8_t> &buffer;
+
+public:
+    explicit P9Writer(std::vector<uint8_t> &buffer) : buffer(buffer) {}
+
+    template<typename T>
+    void put(T value) {
+        const uint8_t *p = (const uint8_t *)&value;
+        buffer.insert(buffer.end(), p, p + sizeof(T));
+    }
+
+    void put_string(const std::string &s) {
+        put<uint16_t>(s.size());
+        buffer.insert(buffer.end(), s.begin(), s.end());
+    }
+
+    void put_qid(uint8_t type, uint64_t path) {
+        put<uint8_t>(type);
+        put<uint32_t>(0); // version
+        put<uint64_t>(path);
+    }
+
+    void put_qid(const struct stat &st) {
+        uint8_t type = S_ISDIR(st.st_mode) ? QTDIR : S_ISLNK(st.st_mode) ? QTSYMLINK : QTFILE;
+        put_qid(type, st.st_ino);
+    }
+};
+
+} // namespace
+
+// Make out the buffers after the first skip bytes of iov, at most limit bytes
+static std::size_t iov_slice(const std::vector<struct iovec> &iov, std::size_t skip, std::size_t limit, std::vector<struct iovec> &out) {
+    out.clear();
+    std::size_t total = 0;
+    for (const auto &v : iov) {
+        if (skip >= v.iov_len) {
+            skip -= v.iov_len;
+            continue;
+        }
+        std::size_t n = std::min(v.iov_len - skip, limit - total);
+        if (n == 0) break;
+        out.push_back({(uint8_t *)v.iov_base + skip, n});
+        total += n;
+        skip = 0;
+    }
+    return total;
+}
+
+static std::size_t iov_total(const std::vector<struct iovec> &iov) {
+    std::size_t total = 0;
+    for (const auto &v : iov) {
+        total += v.iov_len;
+    }
+    return total;
+}
+
+static void iov_read(const std::vector<struct iovec> &iov, uint8_t *data, std::size_t length) {
+    for (const auto &v : iov) {
+        std::size_t n = std::min(v.iov_len, length);
+        std::memcpy(data, v.iov_base, n);
+        data += n;
+        length -= n;
+        if (length == 0) break;
+    }
+}
+
+static void iov_write(const std::vector<struct iovec> &iov, const uint8_t *data, std::size_t length) {
+    for (const auto &v : iov) {
+        std::size_t n = std::min(v.iov_len, length);
+        std::memcpy(v.iov_base, data, n);
+        data += n;
+        length -= n;
+        if (length == 0) break;
+    }
+}
+
+static bool valid_name(const std::string &name) {
+    return !name.empty() && name != "." && name != ".." && name.find('/') == std::string::npos;
+}
+
+static std::string join_path(const std::string &dir, const std::string &name) {
+    return dir.empty() ? name : dir + "/" + name;
+}
+
+VirtIO9P::VirtIO9P(const std::string &root, const std::string &tag) : VirtIO(VIRTIO_9P_DEVICE_ID, 1, 1), root(root) {
+    this->rootFd = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    // struct virtio_9p_config { le16 tag_len; u8 tag[]; }
+    uint16_t tagLength = tag.size();
+    this->configBuffer.resize(sizeof(tagLength) + tag.size());
+    std::memcpy(this->configBuffer.data(), &tagLength, sizeof(tagLength));
+    std::memcpy(this->configBuffer.data() + sizeof(tagLength), tag.data(), tag.size());
+    this->configuration = this->configBuffer.data();
+    this->sizeof_configuration = this->configBuffer.size();
+}
+
+bool VirtIO9P::is_valid() const {
+    return this->rootFd >= 0;
+}
+
+bool VirtIO9P::get_device_features_bit(unsigned int bit) {
+    return bit == VIRTIO_9P_F_MOUNT_TAG;
+}
+
+VirtIO9P::Fid *VirtIO9P::get_fid(uint32_t fid) {
+    auto iter = this->fids.find(fid);
+    return iter == this->fids.end() ? nullptr : &iter->second;
+}
+
+void VirtIO9P::clunk(uint32_t fid) {
+    auto iter = this->fids.find(fid);
+    if (iter == this->fids.end()) return;
+    if (iter->second.dir != nullptr) {
+        closedir(iter->second.dir); // Also closes the fd
+    } else if (iter->second.fd >= 0) {
+        close(iter->second.fd);
+    }
+    this->fids.erase(iter);
+}
+
+void VirtIO9P::clunk_all() {
+    while (!this->fids.empty()) {
+        this->clunk(this->fids.begin()->first);
+    }
+}
+
+int VirtIO9P::open_dir(const std::string &path) const {
+    int fd = openat(this->rootFd, ".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    std::size_t start = 0;
+    while (fd >= 0 && start < path.size()) {
+        std::size_t end = std::min(path.find('/', start), path.size());
+        std::string name = path.substr(start, end - start);
+        start = end + 1;
+        // A symbolic link is not followed, so every component stays beneath the root
+        int next = valid_name(name) ? openat(fd, name.c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) : -1;
+        int err = valid_name(name) ? errno : ENOENT;
+        close(fd);
+        errno = err;
+        fd = next;
+    }
+    return fd;
+}
+
+int VirtIO9P::open_parent(const std::string &path, std::string &name) const {
+    std::size_t pos = path.rfind('/');
+    if (pos == std::string::npos) {
+        name = path.empty() ? "." : path;
+        return this->open_dir("");
+    }
+    name = path.substr(pos + 1);
+    return this->open_dir(path.substr(0, pos));
+}
+
+bool VirtIO9P::reopen(Fid &fid) {
+    struct stat st;
+    std::string name;
+    ScopedFd dir(this->open_parent(fid.path, name));
+    if (dir.get() < 0 || fstatat(dir.get(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return false;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        fid.fd = openat(dir.get(), name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        fid.dir = fid.fd >= 0 ? fdopendir(fid.fd) : nullptr;
+        if (fid.dir == nullptr && fid.fd >= 0) {
+            close(fid.fd);
+            fid.fd = -1;
+        }
+    } else {
+        fid.fd = openat(dir.get(), name.c_str(), fid.openFlags | O_NOFOLLOW | O_CLOEXEC);
+    }
+    return fid.fd >= 0;
+}
+
+bool VirtIO9P::virtio_handle_req(const std::vector<Buffer> &buffer, uint32_t &len) {
+    // The request is in the device-readable buffers, the response in the device-writable buffers
+    this->reqIov.clear();
+    this->respIov.clear();
+    for (const Buffer &b : buffer) {
+        if (b.len == 0) continue;
+        void *p = b.write ? this->bus->get_ptr(b.addr, b.len) : this->bus->get_ptr(b.addr);
+        if (p == nullptr || this->bus->get_ptr_length(b.addr) < b.len) {
+            WARN("Invalid virtio-9p buffer, addr=" FMT_WORD64 ", len=" FMT_VARU64, b.addr, b.len);
+            return false;
+        }
+        (b.write ? this->respIov : this->reqIov).push_back({p, (std::size_t)b.len});
+    }
+
+    std::size_t reqLength = iov_total(this->reqIov);
+    if (reqLength < HEADER_SIZE) {
+        WARN("virtio-9p request is too short");
+        return false;
+    }
+
+    // The data of Twrite is not copied, it is written from the guest buffers directly
+    this->reqBuffer.resize(HEADER_SIZE);
+    iov_read(this->reqIov, this->reqBuffer.data(), HEADER_SIZE);
+    std::size_t copyLength = this->reqBuffer[4] == P9_TWRITE ? TWRITE_HEADER_SIZE : reqLength;
+    this->reqBuffer.resize(std::min(copyLength, reqLength));
+    iov_read(this->reqIov, this->reqBuffer.data(), this->reqBuffer.size());
+
+    len = this->handle_message();
+    return true;
+}
+
+// Copy respBuffer to the guest with the size field
+uint32_t VirtIO9P::finish_response() {
+    uint32_t size = this->respBuffer.size();
+    std::memcpy(this->respBuffer.data(), &size, sizeof(size));
+    if (iov_total(this->respIov) < size) {
+        WARN("virtio-9p response buffer is too small");
+        return 0;
+    }
+    iov_write(this->respIov, this->respBuffer.data(), size);
+    return size;
+}
+
+uint32_t VirtIO9P::handle_message() {
+    P9Reader r(this->reqBuffer, 4);
+    uint8_t  type = r.get<uint8_t>();
+    uint16_t tag  = r.get<uint16_t>();
+
+    std::vector<uint8_t> &resp = this->respBuffer;
+    resp.clear();
+    P9Writer w(resp);
+    w.put<uint32_t>(0); // size, filled by finish_response
+    w.put<uint8_t>(type + 1);
+    w.put<uint16_t>(tag);
+
+    auto error = [&](int err) {
+        resp.resize(HEADER_SIZE);
+        resp[4] = P9_RLERROR;
+        w.put<uint32_t>(err);
+        return this->finish_response();
+    };
+    // The fds opened for a request are closed when it returns
+    auto stat_of = [this](const std::string &path, struct stat &st) {
+        std::string name;
+        ScopedFd dir(this->open_parent(path, name));
+        return dir.get() >= 0 && fstatat(dir.get(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+    };
+
+    struct stat st;
+    switch (type) {
+        case P9_TVERSION: {
+            uint32_t msize = r.get<uint32_t>();
+            std::string version = r.get_string();
+            if (!r.good() || msize < MSIZE_MIN) return error(EINVAL);
+            // A new session, all the fids are clunked
+            this->clunk_all();
+            this->msize = std::min(msize, MSIZE_MAX);
+            w.put<uint32_t>(this->msize);
+            w.put_string(version == "9P2000.L" ? "9P2000.L" : "unknown");
+            break;
+        }
+        case P9_TAUTH:
+            return error(EOPNOTSUPP);
+        case P9_TATTACH: {
+            uint32_t fid = r.get<uint32_t>();
+            if (!r.good()) return error(EINVAL);
+            if (this->fids.count(fid)) return error(EBADF);
+            if (fstat(this->rootFd, &st) != 0) return error(errno);
+            this->fids[fid] = Fid{""};
+            w.put_qid(st);
+            break;
+        }
+        case P9_TFLUSH:
+            // Requests are handled synchronously, nothing to cancel
+            break;
+        case P9_TWALK: {
+            uint32_t fid    = r.get<uint32_t>();
+            uint32_t newfid = r.get<uint32_t>();
+            uint16_t nwname = r.get<uint16_t>();
+            Fid *f = this->get_fid(fid);
+            if (!r.good()) return error(EINVAL);
+            if (f == nullptr) return error(EBADF);
+            if (newfid != fid && this->fids.count(newfid)) return error(EBADF);
+
+            std::string path = f->path;
+            std::vector<struct stat> qids;
+            for (uint16_t i = 0; i < nwname; i++) {
+                std::string name = r.get_string();
+                if (!r.good()) return error(EINVAL);
+                std::string next;
+                if (name == "..") {
+                    // Never walk out of the exported directory
+                    std::size_t pos = path.rfind('/');
+                    next = pos == std::string::npos ? "" : path.substr(0, pos);
+                } else if (name == "." || valid_name(name)) {
+                    next = name == "." ? path : join_path(path, name);
+                } else {
+                    if (i == 0) return error(ENOENT);
+                    break;
+                }
+                if (!stat_of(next, st)) {
+                    if (i == 0) return error(errno);
+                    break;
+                }
+                qids.push_back(st);
+                path = next;
+            }
+
+            // newfid is only created if all the names are walked
+            if (qids.size() == nwname) {
+                if (newfid == fid) {
+                    this->clunk(fid);
+                }
+                this->fids[newfid] = Fid{path};
+            }
+            w.put<uint16_t>(qids.size());
+            for (const auto &q : qids) {
+                w.put_qid(q);
+            }
+            break;
+        }
+        case P9_TGETATTR: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            if (f == nullptr) return error(EBADF);
+            if (!stat_of(f->path, st)) return error(errno);
+            w.put<uint64_t>(GETATTR_BASIC);
+            w.put_qid(st);
+            w.put<uint32_t>(st.st_mode);
+            w.put<uint32_t>(st.st_uid);
+            w.put<uint32_t>(st.st_gid);
+            w.put<uint64_t>(st.st_nlink);
+            w.put<uint64_t>(st.st_rdev);
+            w.put<uint64_t>(st.st_size);
+            w.put<uint64_t>(st.st_blksize);
+            w.put<uint64_t>(st.st_blocks);
+            w.put<uint64_t>(st.st_atim.tv_sec);
+            w.put<uint64_t>(st.st_atim.tv_nsec);
+            w.put<uint64_t>(st.st_mtim.tv_sec);
+            w.put<uint64_t>(st.st_mtim.tv_nsec);
+            w.put<uint64_t>(st.st_ctim.tv_sec);
+            w.put<uint64_t>(st.st_ctim.tv_nsec);
+            w.put<uint64_t>(0); // btime
+            w.put<uint64_t>(0);
+            w.put<uint64_t>(0); // gen
+            w.put<uint64_t>(0); // data_version
+            break;
+        }
+        case P9_TSETATTR: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            uint32_t valid = r.get<uint32_t>();
+            uint32_t mode  = r.get<uint32_t>();
+            uint32_t uid   = r.get<uint32_t>();
+            uint32_t gid   = r.get<uint32_t>();
+            uint64_t size  = r.get<uint64_t>();
+            struct timespec times[2];
+            times[0].tv_sec  = r.get<uint64_t>();
+            times[0].tv_nsec = r.get<uint64_t>();
+            times[1].tv_sec  = r.get<uint64_t>();
+            times[1].tv_nsec = r.get<uint64_t>();
+            if (!r.good()) return error(EINVAL);
+            if (f == nullptr) return error(EBADF);
+
+            std::string name;
+            ScopedFd dir(this->open_parent(f->path, name));
+            if (dir.get() < 0) return error(errno);
+            const char *path = name.c_str();
+            if ((valid & SETATTR_MODE) && fchmodat(dir.get(), path, mode & 07777, AT_SYMLINK_NOFOLLOW) != 0) return error(errno);
+            if ((valid & (SETATTR_UID | SETATTR_GID)) &&
+                fchownat(dir.get(), path, (valid & SETATTR_UID) ? uid : (uid_t)-1, (valid & SETATTR_GID) ? gid : (gid_t)-1, AT_SYMLINK_NOFOLLOW) != 0) {
+                return error(errno);
+            }
+            if (valid & SETATTR_SIZE) {
+                ScopedFd fd(openat(dir.get(), path, O_WRONLY | O_NOFOLLOW | O_CLOEXEC));
+                if (fd.get() < 0 || ftruncate(fd.get(), size) != 0) return error(errno);
+            }
+            if (valid & (SETATTR_ATIME | SETATTR_MTIME)) {
+                if (!(valid & SETATTR_ATIME)) times[0].tv_nsec = UTIME_OMIT;
+                else if (!(valid & SETATTR_ATIME_SET)) times[0].tv_nsec = UTIME_NOW;
+                if (!(valid & SETATTR_MTIME)) times[1].tv_nsec = UTIME_OMIT;
+                else if (!(valid & SETATTR_MTIME_SET)) times[1].tv_nsec = UTIME_NOW;
+                if (utimensat(dir.get(), path, times, AT_SYMLINK_NOFOLLOW) != 0) return error(errno);
+            }
+            break;
+        }
+        case P9_TLOPEN: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            uint32_t flags = r.get<uint32_t>();
+            if (!r.good()) return error(EINVAL);
+            if (f == nullptr) return error(EBADF);
+            if (f->fd >= 0) return error(EBADF);
+            f->openFlags = flags & (O_ACCMODE | O_APPEND);
+            std::string name;
+            ScopedFd dir(this->open_parent(f->path, name));
+            if (dir.get() < 0 || fstatat(dir.get(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) return error(errno);
+            if (S_ISDIR(st.st_mode)) {
+                if (!this->reopen(*f)) return error(errno);
+            } else {
+                f->fd = openat(dir.get(), name.c_str(), (flags & OPEN_FLAGS_MASK) | O_NOFOLLOW | O_CLOEXEC);
+                if (f->fd < 0) return error(errno);
+            }
+            w.put_qid(st);
+            w.put<uint32_t>(0); // iounit, decided by msize
+            break;
+        }
+        case P9_TLCREATE: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            std::string name = r.get_string();
+            uint32_t flags = r.get<uint32_t>();
+            uint32_t mode  = r.get<uint32_t>();
+            r.get<uint32_t>(); // gid
+            if (!r.good() || !valid_name(name)) return error(EINVAL);
+            if (f == nullptr || f->fd >= 0) return error(EBADF);
+            ScopedFd dir(this->open_dir(f->path));
+            if (dir.get() < 0) return error(errno);
+            int fd = openat(dir.get(), name.c_str(), (flags & OPEN_FLAGS_MASK) | O_CREAT | O_NOFOLLOW | O_CLOEXEC, mode & 07777);
+            if (fd < 0) return error(errno);
+            fstat(fd, &st);
+            // The fid becomes the created file
+            f->path = join_path(f->path, name);
+            f->fd = fd;
+            f->openFlags = flags & (O_ACCMODE | O_APPEND);
+            w.put_qid(st);
+            w.put<uint32_t>(0);
+            break;
+        }
+        case P9_TREAD: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            uint64_t offset = r.get<uint64_t>();
+            uint32_t count  = r.get<uint32_t>();
+            if (!r.good()) return error(EINVAL);
+            if (f == nullptr || f->fd < 0 || f->dir != nullptr) return error(EBADF);
+
+            // Read into the guest buffers after the header of Rread
+            count = std::min(count, this->msize - (uint32_t)RREAD_HEADER_SIZE);
+            iov_slice(this->respIov, RREAD_HEADER_SIZE, count, this->dataIov);
+            ssize_t n = this->dataIov.empty() ? 0 : preadv(f->fd, this->dataIov.data(), std::min(this->dataIov.size(), (std::size_t)IOV_MAX), offset);
+            if (n < 0) return error(errno);
+            w.put<uint32_t>(n);
+            uint32_t size = RREAD_HEADER_SIZE + n;
+            std::memcpy(resp.data(), &size, sizeof(size));
+            iov_write(this->respIov, resp.data(), RREAD_HEADER_SIZE);
+            return size;
+        }
+        case P9_TWRITE: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            uint64_t offset = r.get<uint64_t>();
+            uint32_t count  = r.get<uint32_t>();
+            if (!r.good()) return error(EINVAL);
+            if (f == nullptr || f->fd < 0 || f->dir != nullptr) return error(EBADF);
+
+            // Write from the guest buffers after the header of Twrite
+            iov_slice(this->reqIov, TWRITE_HEADER_SIZE, count, this->dataIov);
+            ssize_t n = this->dataIov.empty() ? 0 : pwritev(f->fd, this->dataIov.data(), std::min(this->dataIov.size(), (std::size_t)IOV_MAX), offset);
+            if (n < 0) return error(errno);
+            w.put<uint32_t>(n);
+            break;
+        }
+        case P9_TREADDIR: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            uint64_t offset = r.get<uint64_t>();
+            uint32_t count  = r.get<uint32_t>();
+            if (!r.good()) return error(EINVAL);
+            if (f == nullptr || f->dir == nullptr) return error(EBADF);
+
+            // The offset of an entry is the telldir cookie after it
+            if (offset == 0) {
+                rewinddir(f->dir);
+            } else {
+                seekdir(f->dir, offset);
+            }
+            count = std::min(count, this->msize - (uint32_t)RREAD_HEADER_SIZE);
+            w.put<uint32_t>(0);
+            std::size_t start = resp.size();
+            while (true) {
+                long pos = telldir(f->dir);
+                errno = 0;
+                struct dirent *entry = readdir(f->dir);
+                if (entry == nullptr) {
+                    if (errno != 0) return error(errno);
+                    break;
+                }
+                std::size_t nameLength = std::strlen(entry->d_name);
+                if (resp.size() - start + 13 + 8 + 1 + 2 + nameLength > count) {
+                    seekdir(f->dir, pos);
+                    break;
+                }
+                uint8_t qidType = entry->d_type == DT_DIR ? QTDIR : entry->d_type == DT_LNK ? QTSYMLINK : QTFILE;
+                w.put_qid(qidType, entry->d_ino);
+                w.put<uint64_t>(telldir(f->dir));
+                w.put<uint8_t>(entry->d_type);
+                w.put_string(entry->d_name);
+            }
+            uint32_t dataLength = resp.size() - start;
+            std::memcpy(resp.data() + start - sizeof(dataLength), &dataLength, sizeof(dataLength));
+            break;
+        }
+        case P9_TCLUNK: {
+            uint32_t fid = r.get<uint32_t>();
+            if (!r.good()) return error(EINVAL);
+            if (!this->fids.count(fid)) return error(EBADF);
+            this->clunk(fid);
+            break;
+        }
+        case P9_TREMOVE: {
+            uint32_t fid = r.get<uint32_t>();
+            Fid *f = this->get_fid(fid);
+            if (f == nullptr) return error(EBADF);
+            // The fid is clunked even if the remove fails, a directory is removed as remove()
+            std::string name;
+            ScopedFd dir(this->open_parent(f->path, name));
+            int ret = dir.get() < 0 ? -1 : unlinkat(dir.get(), name.c_str(), 0);
+            if (ret != 0 && errno == EISDIR) {
+                ret = unlinkat(dir.get(), name.c_str(), AT_REMOVEDIR);
+            }
+            int err = errno;
+            this->clunk(fid);
+            if (ret != 0) return error(err);
+            break;
+        }
+        case P9_TSTATFS: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            if (f == nullptr) return error(EBADF);
+            std::string name;
+            ScopedFd dir(this->open_parent(f->path, name));
+            if (dir.get() < 0) return error(errno);
+            ScopedFd fd(openat(dir.get(), name.c_str(), O_PATH | O_NOFOLLOW | O_CLOEXEC));
+            struct statvfs sv;
+            if (fd.get() < 0 || fstatvfs(fd.get(), &sv) != 0) return error(errno);
+            w.put<uint32_t>(V9FS_MAGIC);
+            w.put<uint32_t>(sv.f_bsize);
+            w.put<uint64_t>(sv.f_blocks);
+            w.put<uint64_t>(sv.f_bfree);
+            w.put<uint64_t>(sv.f_bavail);
+            w.put<uint64_t>(sv.f_files);
+            w.put<uint64_t>(sv.f_ffree);
+            w.put<uint64_t>(sv.f_fsid);
+            w.put<uint32_t>(sv.f_namemax);
+            break;
+        }
+        case P9_TMKDIR: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            std::string name = r.get_string();
+            uint32_t mode = r.get<uint32_t>();
+            if (!r.good() || !valid_name(name)) return error(EINVAL);
+            if (f == nullptr) return error(EBADF);
+            ScopedFd dir(this->open_dir(f->path));
+            if (dir.get() < 0) return error(errno);
+            if (mkdirat(dir.get(), name.c_str(), mode & 07777) != 0 ||
+                fstatat(dir.get(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) return error(errno);
+            w.put_qid(st);
+            break;
+        }
+        case P9_TSYMLINK: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            std::string name   = r.get_string();
+            std::string target = r.get_string();
+            if (!r.good() || !valid_name(name)) return error(EINVAL);
+            if (f == nullptr) return error(EBADF);
+            // The target is only read by the guest, the host never follows it
+            ScopedFd dir(this->open_dir(f->path));
+            if (dir.get() < 0) return error(errno);
+            if (symlinkat(target.c_str(), dir.get(), name.c_str()) != 0 ||
+                fstatat(dir.get(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) return error(errno);
+            w.put_qid(st);
+            break;
+        }
+        case P9_TMKNOD: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            std::string name = r.get_string();
+            uint32_t mode  = r.get<uint32_t>();
+            uint32_t major = r.get<uint32_t>();
+            uint32_t minor = r.get<uint32_t>();
+            if (!r.good() || !valid_name(name)) return error(EINVAL);
+            if (f == nullptr) return error(EBADF);
+            ScopedFd dir(this->open_dir(f->path));
+            if (dir.get() < 0) return error(errno);
+            if (mknodat(dir.get(), name.c_str(), mode, makedev(major, minor)) != 0 ||
+                fstatat(dir.get(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) return error(errno);
+            w.put_qid(st);
+            break;
+        }
+        case P9_TREADLINK: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            if (f == nullptr) return error(EBADF);
+            std::string name;
+            ScopedFd dir(this->open_parent(f->path, name));
+            if (dir.get() < 0) return error(errno);
+            char target[PATH_MAX];
+            ssize_t n = readlinkat(dir.get(), name.c_str(), target, sizeof(target));
+            if (n < 0) return error(errno);
+            w.put_string(std::string(target, n));
+            break;
+        }
+        case P9_TLINK: {
+            Fid *dir = this->get_fid(r.get<uint32_t>());
+            Fid *f   = this->get_fid(r.get<uint32_t>());
+            std::string name = r.get_string();
+            if (!r.good() || !valid_name(name)) return error(EINVAL);
+            if (dir == nullptr || f == nullptr) return error(EBADF);
+            std::string oldName;
+            ScopedFd oldDirFd(this->open_parent(f->path, oldName));
+            ScopedFd newDirFd(this->open_dir(dir->path));
+            if (oldDirFd.get() < 0 || newDirFd.get() < 0) return error(errno);
+            if (linkat(oldDirFd.get(), oldName.c_str(), newDirFd.get(), name.c_str(), 0) != 0) return error(errno);
+            break;
+        }
+        case P9_TRENAME: {
+            Fid *f   = this->get_fid(r.get<uint32_t>());
+            Fid *dir = this->get_fid(r.get<uint32_t>());
+            std::string name = r.get_string();
+            if (!r.good() || !valid_name(name)) return error(EINVAL);
+            if (dir == nullptr || f == nullptr) return error(EBADF);
+            std::string oldName;
+            ScopedFd oldDirFd(this->open_parent(f->path, oldName));
+            ScopedFd newDirFd(this->open_dir(dir->path));
+            if (oldDirFd.get() < 0 || newDirFd.get() < 0) return error(errno);
+            if (renameat(oldDirFd.get(), oldName.c_str(), newDirFd.get(), name.c_str()) != 0) return error(errno);
+            f->path = join_path(dir->path, name);
+            break;
+        }
+        case P9_TRENAMEAT: {
+            Fid *oldDir = this->get_fid(r.get<uint32_t>());
+            std::string oldName = r.get_string();
+            Fid *newDir = this->get_fid(r.get<uint32_t>());
+            std::string newName = r.get_string();
+            if (!r.good() || !valid_name(oldName) || !valid_name(newName)) return error(EINVAL);
+            if (oldDir == nullptr || newDir == nullptr) return error(EBADF);
+            ScopedFd oldDirFd(this->open_dir(oldDir->path));
+            ScopedFd newDirFd(this->open_dir(newDir->path));
+            if (oldDirFd.get() < 0 || newDirFd.get() < 0) return error(errno);
+            if (renameat(oldDirFd.get(), oldName.c_str(), newDirFd.get(), newName.c_str()) != 0) return error(errno);
+            break;
+        }
+        case P9_TUNLINKAT: {
+            Fid *dir = this->get_fid(r.get<uint32_t>());
+            std::string name = r.get_string();
+            uint32_t flags = r.get<uint32_t>();
+            if (!r.good() || !valid_name(name)) return error(EINVAL);
+            if (dir == nullptr) return error(EBADF);
+            ScopedFd dirFd(this->open_dir(dir->path));
+            if (dirFd.get() < 0) return error(errno);
+            if (unlinkat(dirFd.get(), name.c_str(), (flags & UNLINKAT_REMOVEDIR) ? AT_REMOVEDIR : 0) != 0) return error(errno);
+            break;
+        }
+        case P9_TFSYNC: {
+            Fid *f = this->get_fid(r.get<uint32_t>());
+            uint32_t datasync = r.get<uint32_t>();
+            if (f == nullptr || f->fd < 0) return error(EBADF);
+            if ((datasync ? fdatasync(f->fd) : fsync(f->fd)) != 0) return error(errno);
+            break;
+        }
+        case P9_TLOCK:
+            // Only the guest accesses the directory, the locks are handled by the guest kernel
+            w.put<uint8_t>(0); // P9_LOCK_SUCCESS
+            break;
+        case P9_TGETLOCK: {
+            r.get<uint32_t>(); // fid
+            r.get<uint8_t>();  // type
+            uint64_t start  = r.get<uint64_t>();
+            uint64_t length = r.get<uint64_t>();
+            uint32_t procID = r.get<uint32_t>();
+            std::string clientID = r.get_string();
+            if (!r.good()) return error(EINVAL);
+            w.put<uint8_t>(2); // P9_LOCK_TYPE_UNLCK
+            w.put<uint64_t>(start);
+            w.put<uint64_t>(length);
+            w.put<uint32_t>(procID);
+            w.put_string(clientID);
+            break;
+        }
+        case P9_TXATTRWALK:
+        case P9_TXATTRCREATE:
+            return error(EOPNOTSUPP);
+        default:
+            WARN("Unsupported 9P message type %d", type);
+            return error(EOPNOTSUPP);
+    }
+
+    return this->finish_response();
+}
+
+void VirtIO9P::reset() {
+    this->clunk_all();
+    VirtIO::reset();
+}
+
+bool VirtIO9P::save_state(utils::SnapshotWriter &writer) {
+    if (!VirtIO::save_state(writer)) {
+        return false;
+    }
+
+    // The fids are saved by the paths, and opened again on restore
+    writer.write(this->msize);
+    writer.write<uint32_t>(this->fids.size());
+    for (const auto &[fid, f] : this->fids) {
+        writer.write(fid);
+        writer.write_string(f.path);
+        writer.write<bool>(f.fd >= 0);
+        writer.write<int32_t>(f.openFlags);
+    }
+    return writer.good();
+}
+
+bool VirtIO9P::load_state(utils::SnapshotReader &reader) {
+    if (!VirtIO::load_state(reader)) {
+        return false;
+    }
+
+    this->clunk_all();
+    uint32_t count;
+    reader.read(this->msize);
+    if (!reader.read(count) || this->msize < MSIZE_MIN || this->msize > MSIZE_MAX) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t fid;
+        Fid f;
+        bool opened;
+        int32_t openFlags;
+        reader.read(fid);
+        if (!reader.read_string(f.path)) {
+            return false;
+        }
+        reader.read(opened);
+        reader.read(openFlags);
+        f.openFlags = openFlags;
+        if (opened && !this->reopen(f)) {
+            WARN("Failed to open %s again, the fid %u is lost", f.path.c_str(), fid);
+            continue;
+        }
+        this->fids[fid] = f;
+    }
+    return reader.good();
+}
+
+VirtIO9P::~VirtIO9P() {
+    this->clunk_all();
+    if (this->rootFd >= 0) {
+        close(this->rootFd);
+    }
+}
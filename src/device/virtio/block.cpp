@@ -4,122 +4,278 @@
 #include "device/virtio/def.h"
 #include "log.h"
 
+#include <algorithm>
 #include <cstring>
+#include <memory>
 #include <mutex>
+#include <sys/uio.h>
 
 using namespace kxemu::device;
 
-VirtIOBlock::VirtIOBlock() : VirtIO(VIRTIO_BLK_DEVICE_ID, 15, 1) {
-    
+static constexpr uint64_t SECTOR_SIZE = 512;
+
+VirtIOBlock::VirtIOBlock(unsigned int queueCount) : VirtIO(VIRTIO_BLK_DEVICE_ID, 15, std::clamp(queueCount, 1U, MAX_QUEUES)) {
+    std::memset(&this->config, 0, sizeof(this->config));
+    this->config.num_queues = this->queueCount;
+    this->configuration = &this->config;
+    this->sizeof_configuration = sizeof(this->config);
+
+    for (unsigned int i = 0; i < this->queueCount; i++) {
+        Worker *worker = this->workers.emplace_back(std::make_unique<Worker>()).get();
+        worker->thread = std::thread(&VirtIOBlock::worker_thread, this, worker);
+    }
 }
 
 bool VirtIOBlock::open_raw_img(const std::string &filepath) {
-    this->fstream.open(filepath, std::ios::in | std::ios::out | std::ios::binary);
-    if (!this->fstream.is_open()) {
+    auto raw = std::make_unique<RawImage>();
+    if (!raw->open(filepath)) {
         return false;
     }
-    this->fstream.seekg(0, std::ios::end);
-    this->imgSize = this->fstream.tellg();
-    this->fstream.seekg(0, std::ios::beg);
+    this->image = std::move(raw);
+    this->config.capacity = this->image->get_size() / SECTOR_SIZE;
     return true;
 }
 
-bool VirtIOBlock::blk_read(uint32_t sector, uint32_t len, word_t bufferAddr, uint8_t *status) {
-    if (len & (512 - 1)) return false;
-    
-    char *dest = (char *)this->bus->get_ptr(bufferAddr, len);
-    if (dest == nullptr) {
-        WARN("dest is nullptr");
+bool VirtIOBlock::open_mapped_img(const std::string &filepath) {
+    auto mapped = std::make_unique<MappedImage>();
+    if (!mapped->open(filepath)) {
         return false;
     }
-    
-    std::size_t start = sector * 512;
-    if (start + len >= this->imgSize) {
-        WARN("start + len >= this->imgSize");
-        *status = 0;
-        return true;
-    }
-
-    std::lock_guard<std::mutex> lock(this->streamMtx);
-    
-    char *buffer = new char[len];
-    this->fstream.seekg(start, std::ios::beg);
-    this->fstream.read(buffer, len);
-    if (this->fstream.fail()) {
-        WARN("this->fstream.fail()");
-        delete []buffer;
+    this->image = std::move(mapped);
+    this->config.capacity = this->image->get_size() / SECTOR_SIZE;
+    return true;
+}
+
+bool VirtIOBlock::open_overlay_img(const std::string &basePath, const std::string &deltaPath) {
+    auto overlay = std::make_unique<OverlayImage>();
+    if (!overlay->open(basePath, deltaPath)) {
         return false;
     }
-    std::memcpy(dest, buffer, len);
-    delete []buffer;
+    this->image = std::move(overlay);
+    this->config.capacity = this->image->get_size() / SECTOR_SIZE;
+    return true;
+}
 
-    *status = 0;
+OverlayImage *VirtIOBlock::get_overlay() {
+    return dynamic_cast<OverlayImage *>(this->image.get());
+}
 
-    return true;
+bool VirtIOBlock::commit_overlay() {
+    OverlayImage *overlay = this->get_overlay();
+    if (overlay == nullptr) {
+        return false;
+    }
+    this->wait_idle();
+    return overlay->commit();
 }
-bool VirtIOBlock::blk_write(uint32_t sector, uint32_t len, word_t bufferAddr, uint8_t *status) {
-    if (len & (512 - 1)) return false;
 
-    char *buffer = (char *)this->bus->get_ptr(bufferAddr, len);
-    if (buffer == nullptr) {
+bool VirtIOBlock::discard_overlay() {
+    OverlayImage *overlay = this->get_overlay();
+    if (overlay == nullptr) {
         return false;
     }
+    this->wait_idle();
+    return overlay->discard();
+}
 
-    std::lock_guard<std::mutex> lock(this->streamMtx);
+bool VirtIOBlock::get_device_features_bit(unsigned int bit) {
+    switch (bit) {
+        case VIRTIO_BLK_F_FLUSH:
+        case VIRTIO_BLK_F_MQ:
+            return true;
+        case VIRTIO_BLK_F_RO:
+            return this->image != nullptr && this->image->is_read_only();
+    }
+    return false;
+}
 
-    std::size_t start = sector * 512;
-    if (start + len >= this->imgSize) {
-        WARN("start + len >= this->imgSize");
-        *status = 0;
-        return true;
+bool VirtIOBlock::blk_read(uint64_t sector, std::vector<struct iovec> &iov, uint32_t &len) {
+    uint64_t length = 0;
+    for (const auto &v : iov) {
+        length += v.iov_len;
     }
 
-    this->fstream.seekp(start, std::ios::beg);
+    // The sector is from the guest, check it before the multiplication can wrap around
+    uint64_t size = this->image->get_size();
+    if (sector > size / SECTOR_SIZE || length > size - sector * SECTOR_SIZE) {
+        WARN("Read out of image, sector=%lu, length=%lu", sector, length);
+        return false;
+    }
+
+    len = length;
+    return this->image->read(iov.data(), iov.size(), sector * SECTOR_SIZE);
+}
+
+bool VirtIOBlock::blk_write(uint64_t sector, std::vector<struct iovec> &iov) {
+    uint64_t length = 0;
+    for (const auto &v : iov) {
+        length += v.iov_len;
+    }
+
+    if (this->image->is_read_only()) {
+        return false;
+    }
 
-    this->fstream.write(buffer, len);
-    if (this->fstream.fail()) {
+    // The sector is from the guest, check it before the multiplication can wrap around
+    uint64_t size = this->image->get_size();
+    if (sector > size / SECTOR_SIZE || length > size - sector * SECTOR_SIZE) {
+        WARN("Write out of image, sector=%lu, length=%lu", sector, length);
         return false;
     }
-    this->fstream.flush();
 
-    *status = 0;
+    // No flush here, the guest sends VIRTIO_BLK_T_FLUSH when it needs the data on disk
+    return this->image->write(iov.data(), iov.size(), sector * SECTOR_SIZE);
+}
 
-    return true;
+// The iov of the request is consumed by the image
+uint8_t VirtIOBlock::blk_execute(Request &req, uint32_t &len) {
+    len = 0;
+    switch (req.type) {
+        case VIRTIO_BLK_T_IN:
+            return this->blk_read(req.sector, req.iov, len) ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR;
+        case VIRTIO_BLK_T_OUT:
+            return this->blk_write(req.sector, req.iov) ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR;
+        case VIRTIO_BLK_T_FLUSH:
+            return this->image->flush() ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR;
+        default:
+            return VIRTIO_BLK_S_UNSUPP;
+    }
 }
 
-bool VirtIOBlock::virtio_handle_req(const std::vector<Buffer> &buffer, uint32_t &len) {
-    if (buffer.size() < 3) {
-        const BufferHead *head = (BufferHead *)this->bus->get_ptr(buffer[0].addr, sizeof(BufferHead));
-        if (head != nullptr) {
-            INFO("head->sector: %lu", head->sector);
-        } else {
-            WARN("head is nullptr, head.addr: " FMT_WORD64, buffer[0].addr);
+void VirtIOBlock::virtio_submit_req(unsigned int queueIndex, unsigned int descIndex, const std::vector<Buffer> &buffer) {
+    // The request is a device-readable header, the data buffers and a device-writable status byte.
+    const Buffer &last = buffer.back();
+    uint8_t *status = buffer.size() >= 2 && last.len >= 1 ? (uint8_t *)this->bus->get_ptr(last.addr + last.len - 1, 1) : nullptr;
+    const BufferHead *head = (BufferHead *)this->bus->get_ptr(buffer[0].addr);
+    if (head == nullptr || status == nullptr || buffer[0].len < sizeof(BufferHead)) {
+        WARN("Invalid virtio-blk request, buffer count=%lu", buffer.size());
+        if (status != nullptr) {
+            *status = VIRTIO_BLK_S_IOERR;
         }
-        WARN("buffer.size() < 3: %lu", buffer.size());
-        return true;
-    }
-    
-    const Buffer &b0 = buffer[0];
-    const Buffer &b1 = buffer[1];
-    const Buffer &b2 = buffer[2];
-    
-    const BufferHead *head = (BufferHead *)this->bus->get_ptr(b0.addr, sizeof(BufferHead));
-    if (head == nullptr) {
-        WARN("head is nullptr");
-        return false;
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->virtio_handle_done(status != nullptr ? 1 : 0, queueIndex, descIndex);
+        return;
     }
 
-    uint8_t *status = (uint8_t *)this->bus->get_ptr(b2.addr, sizeof(uint8_t));
-    
-    switch (head->type) {
-        case VIRTIO_BLK_T_IN:  return this->blk_read (head->sector, b1.len, b1.addr, status);
-        case VIRTIO_BLK_T_OUT: return this->blk_write(head->sector, b1.len, b1.addr, status);
-        default: WARN("Unknown type: %u", head->type); return false;
+    Worker *worker = this->workers[queueIndex].get();
+    std::unique_lock<std::mutex> lock(worker->reqMtx);
+
+    // The iov reuses the storage of a completed request, no allocation once the queue is warm
+    Request &req = worker->reqQueue.emplace_back();
+    if (!worker->spareIov.empty()) {
+        req.iov = std::move(worker->spareIov.back());
+        worker->spareIov.pop_back();
     }
+    req.queueIndex = queueIndex;
+    req.descIndex = descIndex;
+    req.type = head->type;
+    req.sector = head->sector;
+    req.status = status;
+
+    // Resolve the guest addresses here, the workers only touch host memory
+    for (std::size_t i = 1; i < buffer.size(); i++) {
+        const Buffer &b = buffer[i];
+        word_t len = i == buffer.size() - 1 ? b.len - 1 : b.len; // The last byte of the last buffer is status
+        if (len == 0) continue;
+        void *p = this->bus->get_ptr(b.addr, len);
+        if (p == nullptr || this->bus->get_ptr_length(b.addr) < len) {
+            WARN("Invalid virtio-blk buffer, addr=" FMT_WORD64 ", len=" FMT_VARU64, b.addr, len);
+            req.type = -1; // Reported as unsupported
+            req.iov.clear();
+            break;
+        }
+        req.iov.push_back({p, len});
+    }
+
+    worker->inflight++;
+    worker->reqCV.notify_one();
+
+    if (this->synchronous.load(std::memory_order_relaxed)) {
+        worker->idleCV.wait(lock, [worker]() { return worker->inflight == 0; });
+    }
+}
+
+void VirtIOBlock::worker_thread(Worker *worker) {
+    std::vector<Request> batch;
+    std::vector<uint32_t> lens;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(worker->reqMtx);
+            worker->reqCV.wait(lock, [worker]() { return !worker->reqQueue.empty() || worker->stop; });
+            if (worker->reqQueue.empty()) {
+                return; // stop is set and all requests are handled
+            }
+            while (!worker->reqQueue.empty() && batch.size() < BATCH_MAX) {
+                batch.push_back(std::move(worker->reqQueue.front()));
+                worker->reqQueue.pop_front();
+            }
+        }
+
+        lens.resize(batch.size());
+        for (std::size_t i = 0; i < batch.size(); i++) {
+            *batch[i].status = this->blk_execute(batch[i], lens[i]);
+        }
+
+        // Complete the whole batch at once, the guest handles them in one interrupt
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            for (std::size_t i = 0; i < batch.size(); i++) {
+                this->virtio_handle_done(lens[i] + 1, batch[i].queueIndex, batch[i].descIndex);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(worker->reqMtx);
+            worker->inflight -= batch.size();
+            if (worker->inflight == 0) {
+                worker->idleCV.notify_all();
+            }
+            for (auto &req : batch) {
+                if (worker->spareIov.size() < SPARE_IOV_MAX) {
+                    req.iov.clear();
+                    worker->spareIov.push_back(std::move(req.iov));
+                }
+            }
+        }
+        batch.clear();
+    }
+}
+
+void VirtIOBlock::wait_idle() {
+    for (auto &worker : this->workers) {
+        std::unique_lock<std::mutex> lock(worker->reqMtx);
+        worker->idleCV.wait(lock, [&worker]() { return worker->inflight == 0; });
+    }
+}
+
+void VirtIOBlock::set_synchronous(bool synchronous) {
+    this->wait_idle();
+    this->synchronous = synchronous;
+}
+
+void VirtIOBlock::reset() {
+    // Requests in flight must not write the used ring after reset
+    this->wait_idle();
+    VirtIO::reset();
+}
+
+bool VirtIOBlock::save_state(utils::SnapshotWriter &writer) {
+    this->wait_idle();
+    return VirtIO::save_state(writer);
+}
+
+bool VirtIOBlock::load_state(utils::SnapshotReader &reader) {
+    this->wait_idle();
+    return VirtIO::load_state(reader);
 }
 
 VirtIOBlock::~VirtIOBlock() {
-    if (this->fstream.is_open()) {
-        this->fstream.close();
+    for (auto &worker : this->workers) {
+        std::lock_guard<std::mutex> lock(worker->reqMtx);
+        worker->stop = true;
+        worker->reqCV.notify_all();
+    }
+    for (auto &worker : this->workers) {
+        worker->thread.join();
     }
 }
@@ -0,0 +1,204 @@
+#include "device/virtio/console.hpp"
+#include "device/def.hpp"
+#include "device/virtio/virtio.hpp"
+#include "device/virtio/def.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace kxemu::device;
+
+VirtIOConsole::VirtIOConsole() : VirtIO(VIRTIO_CONSOLE_DEVICE_ID, 0, 2) {}
+
+void VirtIOConsole::open_stdout() {
+    this->fd = STDOUT_FILENO;
+    this->ownFd = false;
+}
+
+bool VirtIOConsole::open_file(const std::string &filepath) {
+    this->fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (this->fd < 0) {
+        WARN("Failed to open %s: %s", filepath.c_str(), std::strerror(errno));
+        return false;
+    }
+    this->ownFd = true;
+    return true;
+}
+
+bool VirtIOConsole::open_unix_socket(const std::string &path) {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path)) {
+        WARN("Socket path is too long: %s", path.c_str());
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        WARN("Failed to create socket: %s", std::strerror(errno));
+        return false;
+    }
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        WARN("Failed to connect to %s: %s", path.c_str(), std::strerror(errno));
+        close(sockfd);
+        return false;
+    }
+    if (pipe2(this->stopPipe, O_CLOEXEC) != 0) {
+        close(sockfd);
+        return false;
+    }
+
+    this->fd = sockfd;
+    this->ownFd = true;
+    this->isSocket = true;
+    this->reader = std::thread(&VirtIOConsole::reader_thread, this);
+    return true;
+}
+
+void VirtIOConsole::virtio_submit_req(unsigned int queueIndex, unsigned int descIndex, const std::vector<Buffer> &buffer) {
+    if (queueIndex == TRANSMITQ) {
+        this->transmit(descIndex, buffer);
+        return;
+    }
+
+    // Keep the receive buffers until the input comes
+    this->hold_rx_chain(descIndex, buffer);
+}
+
+void VirtIOConsole::transmit(unsigned int descIndex, const std::vector<Buffer> &buffer) {
+    std::vector<struct iovec> iov;
+    iov.reserve(buffer.size());
+    for (const Buffer &b : buffer) {
+        if (b.write || b.len == 0) continue;
+        void *p = this->bus->get_ptr(b.addr);
+        if (p == nullptr || this->bus->get_ptr_length(b.addr) < b.len) {
+            WARN("Invalid virtio-console buffer, addr=" FMT_WORD64 ", len=" FMT_VARU64, b.addr, b.len);
+            break;
+        }
+        iov.push_back({p, (std::size_t)b.len});
+    }
+
+    // All the buffers of the chain are written by one system call in most cases
+    struct iovec *v = iov.data();
+    std::size_t count = iov.size();
+    while (this->fd >= 0 && count != 0) {
+        ssize_t n;
+        if (this->isSocket) {
+            struct msghdr msg = {};
+            msg.msg_iov = v;
+            msg.msg_iovlen = std::min(count, (std::size_t)IOV_MAX);
+            n = sendmsg(this->fd, &msg, MSG_NOSIGNAL);
+        } else {
+            n = writev(this->fd, v, std::min(count, (std::size_t)IOV_MAX));
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            WARN("Failed to write console output: %s", std::strerror(errno));
+            break;
+        }
+        while (count != 0 && (std::size_t)n >= v->iov_len) {
+            n -= v->iov_len;
+            v++;
+            count--;
+        }
+        if (count != 0) {
+            v->iov_base = (uint8_t *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->virtio_handle_done(0, TRANSMITQ, descIndex);
+}
+
+void VirtIOConsole::reader_thread() {
+    std::vector<struct iovec> iov;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->rxMtx);
+            this->rxCV.wait(lock, [this]() { return !this->rxChains.empty() || this->stopReader; });
+            if (this->stopReader) {
+                return;
+            }
+        }
+
+        struct pollfd fds[2] = {
+            {this->fd, POLLIN, 0},
+            {this->stopPipe[0], POLLIN, 0},
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            WARN("Failed to poll console input: %s", std::strerror(errno));
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        if (fds[0].revents == 0) {
+            continue;
+        }
+
+        // The chain may be dropped by reset while polling
+        std::lock_guard<std::mutex> lock(this->rxMtx);
+        if (this->rxChains.empty()) {
+            continue;
+        }
+        const RxChain &chain = this->rxChains.front();
+        iov.clear();
+        for (const Buffer &b : chain.buffer) {
+            if (!b.write || b.len == 0) continue;
+            void *p = this->bus->get_ptr(b.addr, b.len);
+            if (p == nullptr || this->bus->get_ptr_length(b.addr) < b.len) {
+                break;
+            }
+            iov.push_back({p, (std::size_t)b.len});
+        }
+
+        ssize_t n = iov.empty() ? 0 : readv(this->fd, iov.data(), std::min(iov.size(), (std::size_t)IOV_MAX));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (n <= 0 && !iov.empty()) {
+            INFO("Console input is closed.");
+            return;
+        }
+
+        std::lock_guard<std::mutex> doneLock(this->mtx);
+        this->virtio_handle_done(n, RECEIVEQ, chain.descIndex);
+        this->rxChains.pop_front();
+    }
+}
+
+VirtIOConsole::~VirtIOConsole() {
+    if (this->reader.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->rxMtx);
+            this->stopReader = true;
+            this->rxCV.notify_all();
+        }
+        char c = 0;
+        if (::write(this->stopPipe[1], &c, 1) < 0) {
+            WARN("Failed to stop console reader.");
+        }
+        this->reader.join();
+    }
+    if (this->stopPipe[0] >= 0) {
+        close(this->stopPipe[0]);
+        close(this->stopPipe[1]);
+    }
+    if (this->ownFd) {
+        close(this->fd);
+    }
+}
@@ -0,0 +1,140 @@
+#include "device/virtio/net.hpp"
+#include "device/def.hpp"
+#include "device/virtio/virtio.hpp"
+#include "device/virtio/def.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <sys/uio.h>
+
+using namespace kxemu::device;
+
+// How long the backend waits for the guest to refill the receiveq before dropping a frame
+static constexpr auto RX_WAIT_TIMEOUT = std::chrono::milliseconds(100);
+
+// Make out the buffers after the first skip bytes of iov
+static bool iov_skip(const std::vector<struct iovec> &iov, std::size_t skip, std::vector<struct iovec> &out) {
+    out.clear();
+    for (const auto &v : iov) {
+        if (skip >= v.iov_len) {
+            skip -= v.iov_len;
+            continue;
+        }
+        out.push_back({(uint8_t *)v.iov_base + skip, v.iov_len - skip});
+        skip = 0;
+    }
+    return skip == 0;
+}
+
+// Write data to the beginning of iov, which must be long enough
+static void iov_write(const std::vector<struct iovec> &iov, const void *data, std::size_t length) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (const auto &v : iov) {
+        std::size_t n = std::min(v.iov_len, length);
+        std::memcpy(v.iov_base, p, n);
+        p += n;
+        length -= n;
+        if (length == 0) break;
+    }
+}
+
+VirtIONet::VirtIONet(const uint8_t mac[6]) : VirtIO(VIRTIO_NET_DEVICE_ID, VIRTIO_NET_F_STATUS + 1, 2) {
+    std::memcpy(this->config.mac, mac, sizeof(this->config.mac));
+    this->config.status = VIRTIO_NET_S_LINK_UP;
+    this->configuration = &this->config;
+    this->sizeof_configuration = sizeof(this->config);
+}
+
+void VirtIONet::set_backend(std::unique_ptr<NetBackend> backend) {
+    this->backend = std::move(backend);
+    this->backend->attach(this);
+}
+
+bool VirtIONet::get_device_features_bit(unsigned int bit) {
+    return bit == VIRTIO_NET_F_MAC || bit == VIRTIO_NET_F_STATUS;
+}
+
+void VirtIONet::virtio_submit_req(unsigned int queueIndex, unsigned int descIndex, const std::vector<Buffer> &buffer) {
+    if (queueIndex == TRANSMITQ) {
+        this->transmit(descIndex, buffer);
+        return;
+    }
+
+    // Keep the receive buffers until a frame comes
+    this->hold_rx_chain(descIndex, buffer);
+}
+
+void VirtIONet::transmit(unsigned int descIndex, const std::vector<Buffer> &buffer) {
+    std::vector<struct iovec> &iov = this->txIov;
+    iov.clear();
+    bool valid = true;
+    for (const Buffer &b : buffer) {
+        if (b.write || b.len == 0) continue;
+        void *p = this->bus->get_ptr(b.addr);
+        if (p == nullptr || this->bus->get_ptr_length(b.addr) < b.len) {
+            WARN("Invalid virtio-net buffer, addr=" FMT_WORD64 ", len=" FMT_VARU64, b.addr, b.len);
+            valid = false;
+            break;
+        }
+        iov.push_back({p, (std::size_t)b.len});
+    }
+
+    // The frame follows the virtio_net_hdr, the offloads are not offered so the header is ignored
+    std::vector<struct iovec> frame;
+    if (valid && iov_skip(iov, sizeof(NetHeader), frame) && !frame.empty() && this->backend != nullptr) {
+        this->backend->send(frame.data(), frame.size());
+    }
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->virtio_handle_done(0, TRANSMITQ, descIndex);
+}
+
+bool VirtIONet::receive(const NetFill &fill, bool wait) {
+    std::unique_lock<std::mutex> lock(this->rxMtx);
+    if (wait) {
+        this->rxCV.wait_for(lock, RX_WAIT_TIMEOUT, [this]() { return !this->rxChains.empty(); });
+    }
+    if (this->rxChains.empty()) {
+        return false;
+    }
+
+    const RxChain &chain = this->rxChains.front();
+    this->rxIov.clear();
+    for (const Buffer &b : chain.buffer) {
+        if (!b.write || b.len == 0) continue;
+        void *p = this->bus->get_ptr(b.addr, b.len);
+        if (p == nullptr || this->bus->get_ptr_length(b.addr) < b.len) {
+            break;
+        }
+        this->rxIov.push_back({p, (std::size_t)b.len});
+    }
+
+    ssize_t n = -1;
+    if (iov_skip(this->rxIov, sizeof(NetHeader), this->rxData)) {
+        NetHeader header = {};
+        header.num_buffers = 1;
+        iov_write(this->rxIov, &header, sizeof(header));
+        n = fill(this->rxData.data(), this->rxData.size());
+        if (n < 0) {
+            return false;
+        }
+    } else {
+        WARN("virtio-net receive buffer is too small");
+    }
+
+    // A chain too small for the header is returned empty
+    {
+        std::lock_guard<std::mutex> doneLock(this->mtx);
+        this->virtio_handle_done(n < 0 ? 0 : sizeof(NetHeader) + n, RECEIVEQ, chain.descIndex);
+    }
+    this->rxChains.pop_front();
+    return n >= 0;
+}
+
+VirtIONet::~VirtIONet() {
+    // Stop the backend before the device, the backend delivers frames to the device
+    this->backend.reset();
+}
@@ -26,6 +26,10 @@ VirtIO::VirtIO(
 ) 
     : deviceID(deviceID), featuresNumMax(featuresNumMax), queueCount(queueCount) {
     this->virtQueues = new VirtQueue[queueCount];
+    this->state = IDLE;
+    this->deviceFeaturesSelect = 0;
+    this->driverFeaturesSelect = 0;
+    this->queueSelect = 0;
 }
 
 VirtIO::~VirtIO() {
@@ -33,7 +37,15 @@ VirtIO::~VirtIO() {
 }
 
 void VirtIO::reset() {
+    {
+        std::lock_guard<std::mutex> lock(this->rxMtx);
+        this->rxChains.clear();
+    }
     this->state = IDLE;
+    this->indirectDesc = false;
+    this->eventIdx = false;
+    this->interruptStatus = 0;
+    this->interrupt = false;
     for (unsigned int i = 0; i < this->queueCount; i++) {
         this->virtQueues[i].lastAvailIndex = 0;
     }
@@ -75,10 +87,62 @@ void VirtIO::write_status(word_t data) {
     }
 }
 
+void *VirtIO::get_guest_ptr(word_t addr, word_t length, bool write) {
+    if (length == 0 || this->bus->get_ptr_length(addr) < length) {
+        return nullptr;
+    }
+    return write ? this->bus->get_ptr(addr, length) : this->bus->get_ptr(addr);
+}
+
+bool VirtIO::virtq_read_chain(VirtQueue &queue, const VirtQueueDescriptor *descriptors, uint16_t descIdx) {
+    std::vector<Buffer> &buffer = queue.buffer;
+    buffer.clear();
+
+    const VirtQueueDescriptor *table = descriptors;
+    unsigned int tableSize = queue.queueNum;
+    unsigned int count = 0;
+    while (true) {
+        if (descIdx >= tableSize || ++count > tableSize) {
+            WARN("Invalid descriptor chain, index=%u", descIdx);
+            return false;
+        }
+        const VirtQueueDescriptor *descriptor = &table[descIdx];
+        
+        if (descriptor->flags & VIRTQ_DESC_F_INDIRECT) {
+            // The descriptor refers to a table of descriptors, which is the whole chain.
+            if (!this->indirectDesc || table != descriptors || descriptor->len % sizeof(VirtQueueDescriptor) != 0) {
+                WARN("Invalid indirect descriptor");
+                return false;
+            }
+            table = (const VirtQueueDescriptor *)this->get_guest_ptr(descriptor->addr, descriptor->len, false);
+            if (table == nullptr) {
+                WARN("Failed to get indirect descriptor table");
+                return false;
+            }
+            tableSize = descriptor->len / sizeof(VirtQueueDescriptor);
+            descIdx = 0;
+            count = 0;
+            continue;
+        }
+        
+        buffer.push_back({
+            descriptor->addr, 
+            descriptor->len, 
+            (descriptor->flags & VIRTQ_DESC_F_WRITE) != 0,
+        });
+        
+        if (!(descriptor->flags & VIRTQ_DESC_F_NEXT)) {
+            return true;
+        }
+        descIdx = descriptor->next;
+    }
+}
+
 void VirtIO::notify_queue(uint32_t queueIdx) {
-    if (queueIdx > this->queueCount) return ;
+    if (queueIdx >= this->queueCount) return ;
 
     VirtQueue &queue = this->virtQueues[queueIdx];
+    std::lock_guard<std::mutex> lock(queue.notifyMtx);
     
     // struct virtq_avail {
     //     #define VIRTQ_AVAIL_F_NO_INTERRUPT 1
@@ -88,54 +152,72 @@ void VirtIO::notify_queue(uint32_t queueIdx) {
     //     le16 used_event; /* Only if VIRTIO_F_EVENT_IDX */
     // };
     
-    char *avail = (char *)this->bus->get_ptr(queue.p_avail, (3 + queue.queueNum) * 2);
+    if (queue.queueNum == 0) {
+        WARN("Notify queue %u without size", queueIdx);
+        return ;
+    }
+
+    char *avail = (char *)this->get_guest_ptr(queue.p_avail, (3 + queue.queueNum) * 2, false);
     if (avail == nullptr) {
         WARN("Failed to get struct virtq_avail");
         return ;
     }
     
-    uint16_t availIndex = *(uint16_t *)(avail + 2);
+    uint16_t *availIndex = (uint16_t *)(avail + 2);
     uint16_t *ring = (uint16_t *)(avail + 4);
     
-    VirtQueueDescriptor *descriptors = (VirtQueueDescriptor *)this->bus->get_ptr(queue.p_desc, sizeof(VirtQueueDescriptor) * queue.queueNum);
+    VirtQueueDescriptor *descriptors = (VirtQueueDescriptor *)this->get_guest_ptr(queue.p_desc, sizeof(VirtQueueDescriptor) * queue.queueNum, false);
     if (descriptors == nullptr) {
         WARN("Failed to get struct virtq_desc");
         return ;
     }
 
-    while (queue.lastAvailIndex != availIndex) {
-        uint16_t current = queue.lastAvailIndex % queue.queueNum;
-        
-        uint16_t descIdx = ring[current];
-        VirtQueueDescriptor *descriptor = &descriptors[descIdx];
-        
-        if (descriptor->flags & VIRTQ_DESC_F_INDIRECT) {
-            NOT_IMPLEMENTED();
+    // avail_event of the used ring, tell the driver to notify when it passes this index
+    uint16_t *availEvent = nullptr;
+    if (this->eventIdx) {
+        char *used = (char *)this->get_guest_ptr(queue.p_used, 6 + sizeof(VirtqUsedElem) * queue.queueNum, true);
+        if (used != nullptr) {
+            availEvent = (uint16_t *)(used + 4 + sizeof(VirtqUsedElem) * queue.queueNum);
         }
-        
-        std::vector<Buffer> buffer;
-        while (true) {
-            buffer.push_back({
-                descriptor->addr, 
-                descriptor->len, 
-                (descriptor->flags & VIRTQ_DESC_F_WRITE) != 0,
-            });
+    }
+
+    while (true) {
+        uint16_t index = __atomic_load_n(availIndex, __ATOMIC_ACQUIRE);
+        while (queue.lastAvailIndex != index) {
+            uint16_t current = queue.lastAvailIndex % queue.queueNum;
+            uint16_t descIdx = ring[current];
             
-            if (!(descriptor->flags & VIRTQ_DESC_F_NEXT)) {
-                break;
+            if (this->virtq_read_chain(queue, descriptors, descIdx)) {
+                this->virtio_submit_req(queueIdx, descIdx, queue.buffer);
+            } else {
+                // Give the chain back, or the driver waits for it forever
+                std::lock_guard<std::mutex> lock(this->mtx);
+                this->virtio_handle_done(0, queueIdx, descIdx);
             }
-            
-            descriptor = &descriptors[descriptor->next];
+
+            queue.lastAvailIndex++;
         }
 
-        uint32_t len;
-        if (this->virtio_handle_req(buffer, len)) {
-            virtio_handle_done(len, queueIdx, descIdx);
-        } else {
-            WARN("Occured an error");
+        if (availEvent == nullptr) {
+            break;
         }
 
-        queue.lastAvailIndex++;
+        // The driver may add buffers after reading the old avail_event without notifying,
+        // check the index again after publishing the new avail_event.
+        __atomic_store_n(availEvent, queue.lastAvailIndex, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(availIndex, __ATOMIC_SEQ_CST) == queue.lastAvailIndex) {
+            break;
+        }
+    }
+}
+
+void VirtIO::virtio_submit_req(unsigned int queueIndex, unsigned int descIndex, const std::vector<Buffer> &buffer) {
+    uint32_t len;
+    if (this->virtio_handle_req(buffer, len)) {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->virtio_handle_done(len, queueIndex, descIndex);
+    } else {
+        WARN("Occured an error");
     }
 }
 
@@ -157,39 +239,78 @@ void VirtIO::virtio_handle_done(uint32_t len, unsigned int queueIndex, unsigned
     //     le32 len;
     // };
     
-    char *used = (char *)this->bus->get_ptr(queue.p_used, 6 + sizeof(VirtqUsedElem) * queue.queueNum);
-    bool noNotify = (*(uint16_t *)used) & VIRTQ_USED_F_NO_NOTIFY;
+    char *used  = (char *)this->get_guest_ptr(queue.p_used, 6 + sizeof(VirtqUsedElem) * queue.queueNum, true);
+    char *avail = (char *)this->get_guest_ptr(queue.p_avail, (3 + queue.queueNum) * 2, false);
+    if (used == nullptr || avail == nullptr) {
+        WARN("Failed to get struct virtq_used");
+        return ;
+    }
     
-    uint16_t usedIndex = *(uint16_t *)(used + 2) % queue.queueNum;
+    uint16_t *usedIndex = (uint16_t *)(used + 2);
+    uint16_t oldIndex = *usedIndex;
     VirtqUsedElem *ring = (VirtqUsedElem *)(used + 4);
-    ring[usedIndex].id  = descIndex;
-    ring[usedIndex].len = len;
+    ring[oldIndex % queue.queueNum].id  = descIndex;
+    ring[oldIndex % queue.queueNum].len = len;
     
-    ((uint16_t *)(used + 2))[0] ++; // Increase the used->idx
+    // The element must be visible before the used->idx
+    uint16_t newIndex = oldIndex + 1;
+    __atomic_store_n(usedIndex, newIndex, __ATOMIC_SEQ_CST);
+
+    bool notify;
+    if (this->eventIdx) {
+        // Interrupt only if the used->idx passes used_event of the available ring
+        uint16_t usedEvent = __atomic_load_n((uint16_t *)(avail + 4 + 2 * queue.queueNum), __ATOMIC_SEQ_CST);
+        notify = (uint16_t)(newIndex - usedEvent - 1) < (uint16_t)(newIndex - oldIndex);
+    } else {
+        notify = !((*(uint16_t *)avail) & VIRTQ_AVAIL_F_NO_INTERRUPT);
+    }
 
-    if (!noNotify) {
+    if (notify) {
+        this->interruptStatus |= VIRTIO_INT_USED_BUFFER;
         this->interrupt = true;
     }
 }
 
+void VirtIO::hold_rx_chain(unsigned int descIndex, const std::vector<Buffer> &buffer) {
+    std::lock_guard<std::mutex> lock(this->rxMtx);
+    this->rxChains.push_back({descIndex, buffer});
+    this->rxCV.notify_one();
+}
+
+bool VirtIO::get_features_bit(unsigned int bit) {
+    switch (bit) {
+        case VIRTIO_F_INDIRECT_DESC:
+        case VIRTIO_F_EVENT_IDX:
+        case VIRTIO_F_VERSION_1:
+            return true;
+    }
+    return bit < this->featuresNumMax && this->get_device_features_bit(bit);
+}
+
+void VirtIO::set_features_bit(unsigned int bit, bool value) {
+    switch (bit) {
+        case VIRTIO_F_INDIRECT_DESC: this->indirectDesc = value; return;
+        case VIRTIO_F_EVENT_IDX:     this->eventIdx     = value; return;
+        case VIRTIO_F_VERSION_1: return;
+    }
+    if (bit < this->featuresNumMax) {
+        this->set_driver_features_bit(bit, value);
+    }
+}
+
 uint32_t VirtIO::read_device_features() {
     if (this->state != DRIVERED) {
         return 0;
     }
     
     unsigned int start = this->deviceFeaturesSelect * 32;
-    if (start >= featuresNumMax) {
+    if (start >= FEATURES_NUM_MAX) {
         return 0;
     }
-   
-    unsigned int end = start + 32;
-    if (end > this->featuresNumMax) {
-        end = this->featuresNumMax;
-    }
     
     uint32_t features = 0;
-    for (unsigned int i = start; i < end; i++) {
-        features |= this->get_device_features_bit(i) << (i - start);
+    for (unsigned int i = start; i < start + 32; i++) {
+        features |= (uint32_t)this->get_features_bit(i) << (i - start);
     }
 
     return features;
@@ -201,17 +322,13 @@ void VirtIO::write_driver_features(uint32_t features) {
     }
 
     unsigned int start = this->driverFeaturesSelect * 32;
-    if (start >= this->featuresNumMax) {
+    if (start >= FEATURES_NUM_MAX) {
         return;
     }
-
-    unsigned int end = start + 32;
-    if (end > this->featuresNumMax) {
-        end = this->featuresNumMax;
-    }
     
-    for (unsigned int i = start; i < end; i++) {
-        this->set_driver_features_bit(i, features & (1 << (i - start)));
+    // Only the features offered by the device can be accepted
+    for (unsigned int i = start; i < start + 32; i++) {
+        this->set_features_bit(i, (features & (1U << (i - start))) && this->get_features_bit(i));
     }
 }
 
@@ -248,7 +365,7 @@ word_t VirtIO::read(word_t offset, word_t size, bool &valid) {
         case 0x34: return this->queueNumMax;
         case 0x44: return this->virtQueues[this->queueSelect].ready;
 
-        case 0x60: return 0; // InterruptStatus field, not support Configuration Change Interrupt yet
+        case 0x60: return this->interruptStatus; // InterruptStatus, not support Configuration Change Interrupt yet
         case 0x70: return this->read_status();
     }
 
@@ -300,7 +417,7 @@ bool VirtIO::write(word_t offset, word_t data, word_t size) {
 
         case 0x50: this->notify_queue(data); break;
         
-        case 0x64: break; // Interrupt ACK, not implenmted ignore yet
+        case 0x64: this->interruptStatus &= ~(uint32_t)data; break; // InterruptACK
         case 0x70: this->write_status(data); break;
 
         case 0x80: set_lower(this->virtQueues[this->queueSelect].p_desc , data); break;
@@ -320,6 +437,122 @@ void VirtIO::connect_to_bus(Bus *bus) {
     this->bus = bus;
 }
 
+bool VirtIO::save_state(utils::SnapshotWriter &writer) {
+    std::lock_guard<std::mutex> rxLock(this->rxMtx);
+    std::lock_guard<std::mutex> lock(this->mtx);
+    writer.write(this->deviceID);
+    writer.write<uint32_t>(this->state);
+    writer.write(this->deviceFeaturesSelect);
+    writer.write(this->driverFeaturesSelect);
+    writer.write(this->queueSelect);
+    writer.write<bool>(this->interrupt);
+    writer.write<uint32_t>(this->interruptStatus);
+    writer.write(this->indirectDesc);
+    writer.write(this->eventIdx);
+
+    writer.write<uint32_t>(this->queueCount);
+    for (unsigned int i = 0; i < this->queueCount; i++) {
+        const VirtQueue &queue = this->virtQueues[i];
+        writer.write(queue.p_desc);
+        writer.write(queue.p_avail);
+        writer.write(queue.p_used);
+        writer.write(queue.queueNum);
+        writer.write(queue.ready);
+        writer.write(queue.lastAvailIndex);
+    }
+
+    writer.write<uint64_t>(this->sizeof_configuration);
+    if (this->sizeof_configuration != 0) {
+        writer.write_bytes(this->configuration, this->sizeof_configuration);
+    }
+
+    writer.write<uint32_t>(this->rxChains.size());
+    for (const RxChain &chain : this->rxChains) {
+        writer.write<uint32_t>(chain.descIndex);
+        writer.write<uint32_t>(chain.buffer.size());
+        for (const Buffer &b : chain.buffer) {
+            writer.write(b);
+        }
+    }
+    return writer.good();
+}
+
+bool VirtIO::load_state(utils::SnapshotReader &reader) {
+    std::lock_guard<std::mutex> rxLock(this->rxMtx);
+    std::lock_guard<std::mutex> lock(this->mtx);
+    uint32_t deviceID;
+    if (!reader.read(deviceID) || deviceID != this->deviceID) {
+        WARN("VirtIO device ID of snapshot mismatch.");
+        return false;
+    }
+    
+    uint32_t state;
+    reader.read(state);
+    if (state > DRIVER_OK) {
+        return false;
+    }
+    this->state = (State)state;
+    reader.read(this->deviceFeaturesSelect);
+    reader.read(this->driverFeaturesSelect);
+    bool interrupt;
+    uint32_t interruptStatus;
+    reader.read(this->queueSelect);
+    reader.read(interrupt);
+    reader.read(interruptStatus);
+    reader.read(this->indirectDesc);
+    reader.read(this->eventIdx);
+    this->interrupt = interrupt;
+    this->interruptStatus = interruptStatus;
+    if (this->queueSelect >= this->queueCount) {
+        return false;
+    }
+
+    uint32_t queueCount;
+    if (!reader.read(queueCount) || queueCount != this->queueCount) {
+        WARN("VirtIO queue count of snapshot mismatch.");
+        return false;
+    }
+    for (unsigned int i = 0; i < this->queueCount; i++) {
+        VirtQueue &queue = this->virtQueues[i];
+        reader.read(queue.p_desc);
+        reader.read(queue.p_avail);
+        reader.read(queue.p_used);
+        reader.read(queue.queueNum);
+        reader.read(queue.ready);
+        reader.read(queue.lastAvailIndex);
+    }
+
+    uint64_t configSize;
+    if (!reader.read(configSize) || configSize != this->sizeof_configuration) {
+        WARN("VirtIO configuration size of snapshot mismatch.");
+        return false;
+    }
+    if (configSize != 0) {
+        reader.read_bytes(this->configuration, configSize);
+    }
+
+    uint32_t chainCount;
+    if (!reader.read(chainCount) || chainCount > RX_CHAIN_MAX) {
+        return false;
+    }
+    this->rxChains.clear();
+    for (uint32_t i = 0; i < chainCount; i++) {
+        uint32_t descIndex;
+        uint32_t bufferCount;
+        reader.read(descIndex);
+        if (!reader.read(bufferCount) || bufferCount > RX_CHAIN_MAX) {
+            return false;
+        }
+        RxChain chain = {descIndex, std::vector<Buffer>(bufferCount)};
+        for (Buffer &b : chain.buffer) {
+            reader.read(b);
+        }
+        this->rxChains.push_back(std::move(chain));
+    }
+    this->rxCV.notify_one();
+    return reader.good();
+}
+
 bool VirtIO::interrupt_pending() {
     return this->interrupt;
 }
@@ -29,8 +29,9 @@ const char *isa::get_gdb_target_desc() {
     return "";
 }
 
-cpu::CPU<isa::word_t> *isa::new_cpu() {
-    return new cpu::LACPU();
+const char *isa::get_priv_name(unsigned int mode) {
+    static const char *privNames[] = {"PLV0", "PLV1", "PLV2", "PLV3"};
+    return mode < 4 ? privNames[mode] : "?";
 }
 
 unsigned int isa::get_gpr_count() {
@@ -17,7 +17,7 @@
 
 using namespace llvm;
 
-static MCDisassembler *disassembler;
+static MCDisassembler *disassembler = nullptr;
 static MCInstPrinter *gIP = nullptr;
 static MCSubtargetInfo *gSTI = nullptr;
 
@@ -52,6 +52,11 @@ void init_disasm() {
 }
 
 std::string kxemu::isa::disassemble(const uint8_t *code, const uint64_t dataSize, const word_t pc, uint64_t &instLen) {
+    // Batch mode does not initialize the disassembler at startup
+    if (disassembler == nullptr) {
+        init_disasm();
+    }
+
     MCInst inst;
     ArrayRef<uint8_t> arr(code, 4);
     disassembler->getInstruction(inst, instLen, arr, pc, nulls());
@@ -1,6 +1,5 @@
 #include "cpu/cpu.hpp"
 #include "isa/isa.hpp"
-#include "cpu/riscv/cpu.hpp"
 
 #include <elf.h>
 
@@ -40,12 +39,13 @@ const char *kxemu::isa::get_gdb_target_desc() {
     #endif
 }
 
+const char *kxemu::isa::get_priv_name(unsigned int mode) {
+    static const char *privNames[] = {"U", "S", "H", "M"};
+    return mode < 4 ? privNames[mode] : "?";
+}
+
 extern void init_disasm();
 
 void kxemu::isa::init() {
     init_disasm();
 }
-
-cpu::CPU<isa::word_t> *kxemu::isa::new_cpu() {
-    return new cpu::RVCPU();
-}
@@ -0,0 +1,143 @@
+#include "kdb/kdb.hpp"
+#include "machine.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kxemu;
+
+// Used when the sourced scripts create no memory
+static constexpr kdb::word_t DEFAULT_MEMORY_SIZE = 0x8000000;
+
+// The exit code when the harts do not halt by themselves, as timeout(1)
+static constexpr int NOT_HALTED_EXIT_CODE = 124;
+
+static bool is_elf_file(const std::string &filename) {
+    std::ifstream f(filename, std::ios::binary);
+    char magic[4] = {};
+    f.read(magic, sizeof(magic));
+    return f.gcount() == sizeof(magic) && magic[0] == 0x7f && magic[1] == 'E' && magic[2] == 'L' && magic[3] == 'F';
+}
+
+bool kdb::batch::load_kernel(const std::string &filename) {
+    if (kdb::bus->memoryMaps.empty() && !kdb::machine->add_memory(Machine::DEFAULT_ENTRY, DEFAULT_MEMORY_SIZE)) {
+        return false;
+    }
+
+    if (is_elf_file(filename)) {
+        auto entry = kdb::load_elf(filename);
+        if (!entry.has_value()) {
+            return false;
+        }
+        kdb::reset_cpu(entry.value());
+        return true;
+    }
+
+    if (!kdb::machine->load_image(filename, kdb::machine->get_entry())) {
+        return false;
+    }
+    kdb::reset_cpu();
+    return true;
+}
+
+static const char *core_status(cpu::Core<kdb::word_t> *core) {
+    if (core->is_error()) {
+        return "error";
+    } else if (core->is_halt()) {
+        return "halt";
+    } else {
+        return "stop";
+    }
+}
+
+int kdb::batch::run(uint64_t maxInsns, double timeout, std::ostream &os) {
+    unsigned int coreCount = kdb::cpu->core_count();
+    std::vector<uint64_t> startSteps(coreCount);
+    for (unsigned int i = 0; i < coreCount; i++) {
+        startSteps[i] = kdb::cpu->get_core(i)->get_step_count();
+    }
+    if (maxInsns != 0) {
+        kdb::machine->set_step_limit(maxInsns);
+    }
+
+    // The watchdog stops the harts when the timeout expires before they stop by themselves
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool finished = false;
+    bool timedOut = false;
+    std::thread watchdog;
+    if (timeout > 0) {
+        watchdog = std::thread([&]() {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (!cv.wait_for(lock, std::chrono::duration<double>(timeout), [&]() { return finished; })) {
+                timedOut = true;
+                kdb::machine->stop();
+            }
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    kdb::machine->run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (watchdog.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            finished = true;
+        }
+        cv.notify_one();
+        watchdog.join();
+    }
+
+    uint64_t insns = 0;
+    bool error = false;
+    bool halted = true;
+    for (unsigned int i = 0; i < coreCount; i++) {
+        auto core = kdb::cpu->get_core(i);
+        insns += core->get_step_count() - startSteps[i];
+        error = error || core->is_error();
+        halted = halted && core->is_halt();
+    }
+
+    const char *status;
+    int exitCode;
+    if (error) {
+        status = "error";
+        exitCode = 1;
+    } else if (halted) {
+        status = "halt";
+        exitCode = kdb::machine->get_exit_code();
+    } else {
+        status = timedOut ? "timeout" : "limit";
+        exitCode = NOT_HALTED_EXIT_CODE;
+    }
+
+    os << "{" << std::endl
+       << "  \"status\": \"" << status << "\"," << std::endl
+       << "  \"exit_code\": " << exitCode << "," << std::endl
+       << "  \"insns\": " << insns << "," << std::endl
+       << "  \"host_seconds\": " << std::fixed << std::setprecision(6) << seconds << "," << std::endl
+       << "  \"mips\": " << std::setprecision(3) << (seconds > 0 ? insns / seconds / 1e6 : 0.0) << "," << std::endl;
+    os.unsetf(std::ios::floatfield);
+    os << "  \"cores\": [";
+    for (unsigned int i = 0; i < coreCount; i++) {
+        auto core = kdb::cpu->get_core(i);
+        os << (i == 0 ? "" : ",") << std::endl
+           << "    {\"id\": " << i
+           << ", \"status\": \"" << core_status(core)
+           << "\", \"halt_code\": " << (core->is_halt() ? core->get_halt_code() : 0)
+           << ", \"pc\": " << (core->is_halt() || core->is_error() ? core->get_halt_pc() : core->get_pc())
+           << ", \"insns\": " << core->get_step_count() - startSteps[i] << "}";
+    }
+    os << std::endl << "  ]" << std::endl << "}" << std::endl;
+
+    return exitCode;
+}
@@ -49,7 +49,11 @@ static const cmd::cmd_map_t cmdMap = {
     {"x"    , cmd::show_mem},
     {"gdb"  , cmd::gdb},
     {"device", cmd::device},
-    {"set"  , cmd::set   }
+    {"set"  , cmd::set   },
+    {"snapshot", cmd::snapshot},
+    {"profile", cmd::profile},
+    {"trace", cmd::trace},
+    {"replay", cmd::replay}
 };
 
 static bool cmdRunning = true;
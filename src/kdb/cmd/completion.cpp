@@ -30,7 +30,9 @@ static const Node *tree = new Node({
         })
     },
     {"info", new Node({
-        {"gpr", nullptr}
+        {"gpr", nullptr},
+        {"perf", new Node({{"reset", nullptr}, {"json", nullptr}})},
+        {"mix", new Node({{"reset", nullptr}, {"all", nullptr}})}
     })},
     {"load", new Node({
         {"elf", nullptr}
@@ -50,6 +52,32 @@ static const Node *tree = new Node({
     {"reset", nullptr},
     {"uart", new Node({
         {"add", nullptr}
+    })},
+    {"device", new Node({
+        {"ls", nullptr},
+        {"add", nullptr},
+        {"commit", nullptr},
+        {"discard", nullptr}
+    })},
+    {"snapshot", new Node({
+        {"save", nullptr},
+        {"delta", nullptr},
+        {"load", nullptr}
+    })},
+    {"profile", new Node({
+        {"start", nullptr},
+        {"stop", nullptr},
+        {"dump", nullptr}
+    })},
+    {"trace", new Node({
+        {"start", nullptr},
+        {"stop", nullptr}
+    })},
+    {"replay", new Node({
+        {"record", nullptr},
+        {"play", nullptr},
+        {"stop", nullptr},
+        {"info", nullptr}
     })}
 });
 
@@ -113,7 +113,8 @@ int cmd::run(const args_t &) {
 }
 
 int cmd::symbol(const cmd::args_t &) {
-    if (kdb::symbolTable.empty()) {
+    const auto &symbolTable = kdb::machine->get_symbol_table();
+    if (symbolTable.empty()) {
         std::cout << "No symbol found" << std::endl;
         return cmd::Success;
     }
@@ -122,7 +123,7 @@ int cmd::symbol(const cmd::args_t &) {
     << std::setw(16)  << "name" << " | "
     << std::setw(WORD_WIDTH + 2) << "addr"
     << std::endl;
-    for (auto sym : kdb::symbolTable) {
+    for (auto sym : symbolTable) {
         std::cout << std::setfill(' ')
         << std::setw(16) << sym.second << " | "
         << FMT_STREAM_WORD(sym.first) 
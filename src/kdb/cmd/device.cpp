@@ -1,21 +1,32 @@
+#include "device/virtio/9p.hpp"
 #include "device/virtio/block.hpp"
+#include "device/virtio/console.hpp"
+#include "device/virtio/net.hpp"
 #include "kdb/cmd.hpp"
 #include "kdb/kdb.hpp"
 #include "utils/utils.hpp"
 #include "word.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
 #include <iomanip>
+#include <random>
 
 using namespace kxemu;
 using namespace kxemu::kdb;
 
-static int device_ls (const cmd::args_t &args);
-static int device_add(const cmd::args_t &args);
+static int device_ls     (const cmd::args_t &args);
+static int device_add    (const cmd::args_t &args);
+static int device_commit (const cmd::args_t &args);
+static int device_discard(const cmd::args_t &args);
 
 static const cmd::cmd_map_t cmdMap = {
-    {"ls",  device_ls },
-    {"add", device_add}
+    {"ls",      device_ls     },
+    {"add",     device_add    },
+    {"commit",  device_commit },
+    {"discard", device_discard},
 };
 
 static int device_ls(const cmd::args_t &args) {
@@ -65,15 +76,15 @@ static int device_add_uart(unsigned int id, const cmd::args_t &args) {
     bool success;
     if (args.size() == 5) {
         // [0]device [1]add [2]uart [3]id [4]base
-        success = kdb::uart::add(id, base.value(), std::cout);
+        success = kdb::machine->add_uart(id, base.value(), std::cout);
     } else if (args.size() == 6) {
         // [0]device [1]add [2]uart [3]id [4]base [5]port
         int port = std::stoi(args[5]);
         std::cout << "uart.ip=" << "127.0.0.1" << ", uart.port=" << port << std::endl;
-        success =  kdb::uart::add(id, base.value(), "127.0.0.1", port);
+        success =  kdb::machine->add_uart(id, base.value(), "127.0.0.1", port);
     } else {
         // [0]device [1]add [2]uart [3]id [4]base [5]ip [6]port
-        success = kdb::uart::add(id, base.value(), args[4], std::stoi(args[5]));
+        success = kdb::machine->add_uart(id, base.value(), args[4], std::stoi(args[5]));
     }
 
     if (!success) {
@@ -86,7 +97,8 @@ static int device_add_uart(unsigned int id, const cmd::args_t &args) {
 }
 
 static int device_add_virtio_block(unsigned int id, const cmd::args_t &args) {
-    // [0]device [1]add [2]id [3]virtio-blk [4]base [5]img-type [6]img-filepath
+    // [0]device [1]add [2]id [3]virtio-blk [4]base [5]raw/ro   [6]img-filepath [7]queues
+    // [0]device [1]add [2]id [3]virtio-blk [4]base [5]overlay  [6]base-filepath [7]delta-filepath [8]queues
     if (args.size() < 7) {
         return cmd::InvalidArgs;
     }
@@ -98,11 +110,42 @@ static int device_add_virtio_block(unsigned int id, const cmd::args_t &args) {
     }
     const std::string &imgType = args[5];
     const std::string &filepath = args[6];
+    std::size_t queuesArg = 7;
+    if (imgType == "overlay") {
+        if (args.size() < 8) {
+            std::cout << "Usage: device add <id> virtio-blk <base> overlay <base-image> <delta-image> [queues]" << std::endl;
+            return cmd::EmptyArgs;
+        }
+        queuesArg = 8;
+    }
 
-    kxemu::device::VirtIOBlock *dev = new kxemu::device::VirtIOBlock;
+    // One queue per hart by default
+    unsigned int queues = std::min(kdb::cpu->core_count(), kxemu::device::VirtIOBlock::MAX_QUEUES);
+    if (args.size() > queuesArg) {
+        auto n = utils::string_to_unsigned(args[queuesArg]);
+        if (!n.has_value() || n.value() == 0 || n.value() > kxemu::device::VirtIOBlock::MAX_QUEUES) {
+            std::cerr << "Invalid queue count: " << args[queuesArg] << ", at most " << kxemu::device::VirtIOBlock::MAX_QUEUES << std::endl;
+            return cmd::InvalidArgs;
+        }
+        queues = n.value();
+    }
+
+    kxemu::device::VirtIOBlock *dev = new kxemu::device::VirtIOBlock(queues);
     if (imgType == "raw") {
         if (!dev->open_raw_img(filepath)) {
-            std::cerr << "Failed to open image file: " << imgType << std::endl;
+            std::cerr << "Failed to open image file: " << filepath << std::endl;
+            delete dev;
+            return cmd::CmdError;
+        }
+    } else if (imgType == "ro") {
+        if (!dev->open_mapped_img(filepath)) {
+            std::cerr << "Failed to map image file: " << filepath << std::endl;
+            delete dev;
+            return cmd::CmdError;
+        }
+    } else if (imgType == "overlay") {
+        if (!dev->open_overlay_img(filepath, args[7])) {
+            std::cerr << "Failed to open overlay image: " << filepath << ", " << args[7] << std::endl;
             delete dev;
             return cmd::CmdError;
         }
@@ -112,14 +155,185 @@ static int device_add_virtio_block(unsigned int id, const cmd::args_t &args) {
         return cmd::InvalidArgs;
     }
     
-    if (!bus->add_mmio_map(id, base.value(), 0x200, dev)) {
+    if (!kdb::machine->add_device(id, base.value(), 0x200, dev)) {
         std::cerr << "Failed to add device."  << std::endl;
         return cmd::CmdError;
     }
 
-    kdb::device::add(dev);
+    std::cout << "Add virtio-block device: id=" << id << ", base=" << FMT_STREAM_WORD(base.value()) << ", queues=" << queues << std::endl;
+
+    return cmd::Success;
+}
+
+static int device_add_virtio_console(unsigned int id, const cmd::args_t &args) {
+    // [0]device [1]add [2]id [3]virtio-console [4]base [5]stdout
+    // [0]device [1]add [2]id [3]virtio-console [4]base [5]file/unix [6]path
+    if (args.size() < 6) {
+        std::cout << "Usage: device add <id> virtio-console <base> stdout|file <path>|unix <path>" << std::endl;
+        return cmd::EmptyArgs;
+    }
+
+    auto base = utils::string_to_unsigned(args[4]);
+    if (!base.has_value()) {
+        std::cerr << "Invalid base: " << args[4] << std::endl;
+        return cmd::InvalidArgs;
+    }
 
-    std::cout << "Add virtio-block device: id=" << id << ", base=" << FMT_STREAM_WORD(base.value()) << std::endl;
+    const std::string &output = args[5];
+    if (output != "stdout" && args.size() < 7) {
+        std::cerr << "Missing path of " << output << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    kxemu::device::VirtIOConsole *dev = new kxemu::device::VirtIOConsole();
+    bool success;
+    if (output == "stdout") {
+        dev->open_stdout();
+        success = true;
+    } else if (output == "file") {
+        success = dev->open_file(args[6]);
+    } else if (output == "unix") {
+        success = dev->open_unix_socket(args[6]);
+    } else {
+        std::cerr << "Unknown console output: " << output << std::endl;
+        delete dev;
+        return cmd::InvalidArgs;
+    }
+    if (!success) {
+        std::cerr << "Failed to open console output." << std::endl;
+        delete dev;
+        return cmd::CmdError;
+    }
+
+    if (!kdb::machine->add_device(id, base.value(), 0x200, dev)) {
+        std::cerr << "Failed to add device."  << std::endl;
+        return cmd::CmdError;
+    }
+
+    std::cout << "Add virtio-console device: id=" << id << ", base=" << FMT_STREAM_WORD(base.value()) << std::endl;
+
+    return cmd::Success;
+}
+
+static bool parse_mac(const std::string &s, uint8_t mac[6]) {
+    unsigned int b[6];
+    char end;
+    if (std::sscanf(s.c_str(), "%x:%x:%x:%x:%x:%x%c", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &end) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        if (b[i] > 0xff) return false;
+        mac[i] = b[i];
+    }
+    return (mac[0] & 1) == 0; // Not a multicast address
+}
+
+static int device_add_virtio_net(unsigned int id, const cmd::args_t &args) {
+    // [0]device [1]add [2]id [3]virtio-net [4]base [5]unix   [6]local-path [7]peer-path [8]mac
+    // [0]device [1]add [2]id [3]virtio-net [4]base [5]switch [6]switch-path [7]mac
+    if (args.size() < 7) {
+        std::cout << "Usage: device add <id> virtio-net <base> unix <local-path> <peer-path> [mac]" << std::endl;
+        std::cout << "       device add <id> virtio-net <base> switch <switch-path> [mac]" << std::endl;
+        return cmd::EmptyArgs;
+    }
+
+    auto base = utils::string_to_unsigned(args[4]);
+    if (!base.has_value()) {
+        std::cerr << "Invalid base: " << args[4] << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    const std::string &backendType = args[5];
+    std::size_t macArg;
+    if (backendType == "unix") {
+        if (args.size() < 8) {
+            std::cerr << "Missing peer path" << std::endl;
+            return cmd::InvalidArgs;
+        }
+        macArg = 8;
+    } else if (backendType == "switch") {
+        macArg = 7;
+    } else {
+        std::cerr << "Unknown network backend: " << backendType << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    // A random locally administered address by default
+    uint8_t mac[6] = {0x52, 0x54, 0x00};
+    if (args.size() > macArg) {
+        if (!parse_mac(args[macArg], mac)) {
+            std::cerr << "Invalid MAC address: " << args[macArg] << std::endl;
+            return cmd::InvalidArgs;
+        }
+    } else {
+        std::random_device rd;
+        for (int i = 3; i < 6; i++) {
+            mac[i] = rd();
+        }
+    }
+
+    std::unique_ptr<kxemu::device::NetBackend> backend;
+    if (backendType == "unix") {
+        auto unixBackend = std::make_unique<kxemu::device::UnixDgramBackend>();
+        if (!unixBackend->open(args[6], args[7])) {
+            std::cerr << "Failed to open unix socket " << args[6] << std::endl;
+            return cmd::CmdError;
+        }
+        backend = std::move(unixBackend);
+    } else {
+        kxemu::device::NetSwitch *sw = kxemu::device::NetSwitch::get(args[6]);
+        if (sw == nullptr) {
+            std::cerr << "Failed to create network switch at " << args[6] << std::endl;
+            return cmd::CmdError;
+        }
+        backend = std::make_unique<kxemu::device::NetSwitch::LocalBackend>(sw);
+    }
+
+    kxemu::device::VirtIONet *dev = new kxemu::device::VirtIONet(mac);
+    if (!kdb::machine->add_device(id, base.value(), 0x200, dev)) {
+        std::cerr << "Failed to add device."  << std::endl;
+        return cmd::CmdError;
+    }
+    dev->set_backend(std::move(backend));
+
+    std::cout << "Add virtio-net device: id=" << id << ", base=" << FMT_STREAM_WORD(base.value()) << ", mac=" << std::hex << std::setfill('0');
+    for (int i = 0; i < 6; i++) {
+        std::cout << (i == 0 ? "" : ":") << std::setw(2) << (unsigned int)mac[i];
+    }
+    std::cout << std::dec << std::setfill(' ') << std::endl;
+
+    return cmd::Success;
+}
+
+static int device_add_virtio_9p(unsigned int id, const cmd::args_t &args) {
+    // [0]device [1]add [2]id [3]virtio-9p [4]base [5]host-dir [6]tag
+    if (args.size() < 7) {
+        std::cout << "Usage: device add <id> virtio-9p <base> <host-dir> <tag>" << std::endl;
+        return cmd::EmptyArgs;
+    }
+
+    auto base = utils::string_to_unsigned(args[4]);
+    if (!base.has_value()) {
+        std::cerr << "Invalid base: " << args[4] << std::endl;
+        return cmd::InvalidArgs;
+    }
+    if (args[6].empty() || args[6].size() > UINT16_MAX) {
+        std::cerr << "Invalid tag: " << args[6] << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    kxemu::device::VirtIO9P *dev = new kxemu::device::VirtIO9P(args[5], args[6]);
+    if (!dev->is_valid()) {
+        std::cerr << "Not a directory: " << args[5] << std::endl;
+        delete dev;
+        return cmd::InvalidArgs;
+    }
+    if (!kdb::machine->add_device(id, base.value(), 0x200, dev)) {
+        std::cerr << "Failed to add device."  << std::endl;
+        return cmd::CmdError;
+    }
+
+    std::cout << "Add virtio-9p device: id=" << id << ", base=" << FMT_STREAM_WORD(base.value()) << ", dir=" << args[5] << ", tag=" << args[6] << std::endl;
 
     return cmd::Success;
 }
@@ -132,7 +346,7 @@ static int device_add(const cmd::args_t &args) {
 
     if (args[2] == "memory") {
         if (args.size() < 5) {
-            std::cout << "Usage: device add memory <start> <size>" << std::endl;
+            std::cout << "Usage: device add memory <start> <size> [anon|thp|hugetlb|memfd]" << std::endl;
             return cmd::EmptyArgs;
         }
         
@@ -142,8 +356,21 @@ static int device_add(const cmd::args_t &args) {
             std::cerr << "Invalid args" << std::endl;
             return cmd::InvalidArgs;
         }
+
+        auto backing = kxemu::device::Bus::MemoryBacking::ANON;
+        if (args.size() >= 6) {
+            auto b = kdb::string_to_memory_backing(args[5]);
+            if (!b.has_value()) {
+                std::cerr << "Unknown memory backing: " << args[5] << std::endl;
+                return cmd::InvalidArgs;
+            }
+            backing = b.value();
+        }
         
-        kdb::bus->add_memory_map(start.value(), size.value());
+        if (!kdb::bus->add_memory_map(start.value(), size.value(), backing)) {
+            std::cerr << "Failed to add memory." << std::endl;
+            return cmd::CmdError;
+        }
     } else {
         auto id = utils::string_to_unsigned(args[2]);
         if (!id.has_value()) {
@@ -156,6 +383,12 @@ static int device_add(const cmd::args_t &args) {
             device_add_uart(id.value(), args);
         } else if (type == "virtio-blk") {
             device_add_virtio_block(id.value(), args);
+        } else if (type == "virtio-console") {
+            device_add_virtio_console(id.value(), args);
+        } else if (type == "virtio-net") {
+            device_add_virtio_net(id.value(), args);
+        } else if (type == "virtio-9p") {
+            device_add_virtio_9p(id.value(), args);
         } else {
             std::cerr << "Unknown device type: " << type << std::endl;
             return cmd::InvalidArgs;
@@ -165,6 +398,59 @@ static int device_add(const cmd::args_t &args) {
     return cmd::Success;
 }
 
+static kxemu::device::VirtIOBlock *find_overlay_block(const cmd::args_t &args) {
+    // [0]device [1]commit/discard [2]id
+    if (args.size() < 3) {
+        std::cout << "Usage: device " << args[1] << " <id>" << std::endl;
+        return nullptr;
+    }
+    auto id = utils::string_to_unsigned(args[2]);
+    if (!id.has_value()) {
+        std::cerr << "Invalid id: " << args[2] << std::endl;
+        return nullptr;
+    }
+
+    for (const auto &ioDevice : kdb::bus->mmioMaps) {
+        if (ioDevice->id != id.value()) continue;
+        auto *blk = dynamic_cast<kxemu::device::VirtIOBlock *>(ioDevice->dev);
+        if (blk == nullptr || blk->get_overlay() == nullptr) {
+            std::cerr << "Device " << id.value() << " is not a virtio-blk with overlay image" << std::endl;
+            return nullptr;
+        }
+        return blk;
+    }
+    std::cerr << "No device with id " << id.value() << std::endl;
+    return nullptr;
+}
+
+static int device_commit(const cmd::args_t &args) {
+    auto *blk = find_overlay_block(args);
+    if (blk == nullptr) {
+        return cmd::InvalidArgs;
+    }
+    uint64_t clusters = blk->get_overlay()->allocated_clusters();
+    if (!blk->commit_overlay()) {
+        std::cerr << "Failed to commit overlay image" << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Committed " << clusters << " clusters to the base image" << std::endl;
+    return cmd::Success;
+}
+
+static int device_discard(const cmd::args_t &args) {
+    auto *blk = find_overlay_block(args);
+    if (blk == nullptr) {
+        return cmd::InvalidArgs;
+    }
+    uint64_t clusters = blk->get_overlay()->allocated_clusters();
+    if (!blk->discard_overlay()) {
+        std::cerr << "Failed to discard overlay image" << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Discarded " << clusters << " clusters" << std::endl;
+    return cmd::Success;
+}
+
 int cmd::device(const args_t &args) {
     return find_and_run(args, cmdMap, 1);
 }
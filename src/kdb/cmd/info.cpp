@@ -31,14 +31,67 @@ static int cmd_info_reg(const std::string &name) {
     return cmd::Success;
 }
 
+static int cmd_info_perf(const cmd::args_t &args) {
+    // [0]info [1]perf [2]reset/json [3]filename
+    if (args.size() < 3) {
+        kdb::perf::print(std::cout);
+        return cmd::Success;
+    }
+
+    if (args[2] == "reset") {
+        kdb::perf::reset();
+        return cmd::Success;
+    } else if (args[2] == "json") {
+        if (args.size() < 4) {
+            kdb::perf::write_json(std::cout);
+            return cmd::Success;
+        }
+        if (!kdb::perf::dump_json(args[3])) {
+            std::cerr << "Failed to write " << args[3] << std::endl;
+            return cmd::CmdError;
+        }
+        return cmd::Success;
+    } else {
+        std::cout << "Usage: info perf [reset | json [filename]]" << std::endl;
+        return cmd::InvalidArgs;
+    }
+}
+
+static int cmd_info_mix(const cmd::args_t &args) {
+    // [0]info [1]mix [2]reset/all
+    if (args.size() < 3) {
+        kdb::perf::print_inst_mix(std::cout, cmd::currentCore);
+        return cmd::Success;
+    }
+
+    if (args[2] == "reset") {
+        for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+            kdb::cpu->get_core(i)->reset_inst_mix();
+        }
+        return cmd::Success;
+    } else if (args[2] == "all") {
+        for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+            kdb::perf::print_inst_mix(std::cout, i);
+        }
+        return cmd::Success;
+    } else {
+        std::cout << "Usage: info mix [reset | all]" << std::endl;
+        return cmd::InvalidArgs;
+    }
+}
+
 int cmd::info(const args_t &args) {
     if (args.size() < 2) {
-        std::cout << "Usage: info gpr/pc" << std::endl;
+        std::cout << "Usage: info gpr/pc/perf/mix" << std::endl;
         return cmd::EmptyArgs;
     }
 
     if (args[1] == "gpr") {
         return cmd_info_gpr();
+    } else if (args[1] == "perf") {
+        return cmd_info_perf(args);
+    } else if (args[1] == "mix") {
+        return cmd_info_mix(args);
     } else {
         return cmd_info_reg(args[1]);
     }
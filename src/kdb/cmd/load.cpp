@@ -6,8 +6,8 @@
 #include <cerrno>
 #include <cstring>
 #include <iostream>
-#include <fstream>
 #include <optional>
+#include <unistd.h>
 
 using namespace kxemu;
 using namespace kxemu::kdb;
@@ -36,14 +36,14 @@ static int cmd_load_elf(const cmd::args_t &args) {
     
     std::cout << "Load ELF file success." << std::endl;
     std::cout << "Switch entry to " << FMT_STREAM_WORD(entry.value()) << "." << std::endl;
-    kdb::programEntry = entry.value();
+    kdb::machine->set_entry(entry.value());
     
     return cmd::Success;
 }
 
 static int cmd_load_bin(const cmd::args_t &args) {
     if (args.size() < 4) {
-        std::cout << "Usage: load bin <filename> <addr>" << std::endl;
+        std::cout << "Usage: load bin <filename> <addr> [cow]" << std::endl;
         return cmd::EmptyArgs;
     }
     const std::string &filename = args[2];
@@ -53,14 +53,21 @@ static int cmd_load_bin(const cmd::args_t &args) {
         return cmd::InvalidArgs;
     }
 
-    std::ifstream f;
-    f.open(filename, std::ios::in | std::ios::binary);
-    if (!f.is_open()) {
+    bool cow = false;
+    if (args.size() >= 5) {
+        if (args[4] != "cow") {
+            std::cout << "Invalid load mode: " << args[4] << std::endl;
+            return cmd::InvalidArgs;
+        }
+        cow = true;
+    }
+
+    if (access(filename.c_str(), R_OK) != 0) {
         std::cout << "Open file \"" << filename << "\" FAILED: " << std::strerror(errno) << std::endl;
         return cmd::CmdError;
     }
 
-    if (kdb::bus->load_from_stream(f, addr.value())) {
+    if (kdb::bus->load_from_file(filename, addr.value(), cow)) {
         std::cout << "Load binary file success." << std::endl;
         return cmd::Success;
     } else {
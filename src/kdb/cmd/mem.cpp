@@ -9,6 +9,7 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <unistd.h>
 
 using namespace kxemu;
 using namespace kxemu::kdb;
@@ -55,7 +56,17 @@ static int cmd_mem_create(const std::vector<std::string> &args) {
         return cmd::InvalidArgs;
     }
     
-    s = kdb::bus->add_memory_map(start, size);
+    auto backing = kxemu::device::Bus::MemoryBacking::ANON;
+    if (args.size() >= 6) {
+        auto b = kdb::string_to_memory_backing(args[5]);
+        if (!b.has_value()) {
+            std::cout << "Invalid memory type: " << args[5] << std::endl;
+            return cmd::InvalidArgs;
+        }
+        backing = b.value();
+    }
+    
+    s = kdb::bus->add_memory_map(start, size, backing);
     if (s) {
         std::cout << "Create new memory map " << name << " at " << FMT_STREAM_WORD(start) << " with size=" <<  FMT_STREAM_WORD(size) << std::endl;
         return cmd::Success;
@@ -68,14 +79,12 @@ static int cmd_mem_img(const cmd::args_t &args) {
     const std::string filename = args[2];
     if (!check_memory_initialized()) return cmd::MissingPrevOp;
 
-    std::ifstream f;
-    f.open(filename, std::ios::in | std::ios::binary);
-    if (!f.is_open()) {
+    if (access(filename.c_str(), R_OK) != 0) {
         std::cout << "FileNotFound: No such file: " << filename << std::endl;
         return cmd::CmdError;
     }
 
-    kdb::bus->load_from_stream(f, 0x80000000);
+    kdb::bus->load_from_file(filename, 0x80000000);
 
     return cmd::Success;
 }
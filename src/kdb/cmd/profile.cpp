@@ -0,0 +1,90 @@
+#include "kdb/cmd.hpp"
+#include "kdb/kdb.hpp"
+#include "utils/utils.hpp"
+
+#include <iostream>
+#include <string>
+
+using namespace kxemu;
+using namespace kxemu::kdb;
+
+static int cmd_profile_start(const cmd::args_t &args) {
+    if (args.size() > 4) {
+        std::cerr << "Usage: profile start [interval] [depth]" << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    unsigned int interval = 10000;
+    unsigned int depth = 0;
+    bool success = true;
+    if (args.size() >= 3) {
+        interval = utils::string_to_unsigned(args[2], success);
+        if (!success || interval == 0) {
+            std::cerr << "Invalid interval: " << args[2] << std::endl;
+            return cmd::InvalidArgs;
+        }
+    }
+    if (args.size() == 4) {
+        depth = utils::string_to_unsigned(args[3], success);
+        if (!success) {
+            std::cerr << "Invalid depth: " << args[3] << std::endl;
+            return cmd::InvalidArgs;
+        }
+    }
+
+    if (!kdb::profile::start(interval, depth)) {
+        std::cerr << "The CPU does not support sampling." << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Sample every " << interval << " instructions";
+    if (depth != 0) {
+        std::cout << " with up to " << depth << " frames";
+    }
+    std::cout << "." << std::endl;
+    return cmd::Success;
+}
+
+static int cmd_profile_stop(const cmd::args_t &) {
+    if (!kdb::profile::is_running()) {
+        std::cerr << "The profiler is not running." << std::endl;
+        return cmd::MissingPrevOp;
+    }
+
+    kdb::profile::stop();
+    std::cout << "Stop with " << kdb::profile::sample_count() << " samples, "
+              << kdb::profile::dropped_count() << " dropped." << std::endl;
+    return cmd::Success;
+}
+
+static int cmd_profile_dump(const cmd::args_t &args) {
+    if (args.size() > 3) {
+        std::cerr << "Usage: profile dump [file]" << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    if (args.size() == 2) {
+        kdb::profile::write_folded(std::cout);
+        return cmd::Success;
+    }
+    if (!kdb::profile::dump(args[2])) {
+        std::cerr << "Failed to write the folded stacks to " << args[2] << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Write " << kdb::profile::sample_count() << " samples to " << args[2] << "." << std::endl;
+    return cmd::Success;
+}
+
+static const cmd::cmd_map_t cmdMap = {
+    {"start", cmd_profile_start},
+    {"stop", cmd_profile_stop},
+    {"dump", cmd_profile_dump},
+};
+
+int cmd::profile(const args_t &args) {
+    if (args.size() < 2) {
+        std::cerr << "Usage: profile <start|stop|dump>" << std::endl;
+        return cmd::EmptyArgs;
+    }
+
+    return cmd::find_and_run(args, cmdMap, 1);
+}
@@ -0,0 +1,79 @@
+#include "kdb/cmd.hpp"
+#include "kdb/kdb.hpp"
+
+#include <iostream>
+#include <string>
+
+using namespace kxemu;
+using namespace kxemu::kdb;
+
+static int cmd_replay_record(const cmd::args_t &args) {
+    if (args.size() != 3) {
+        std::cerr << "Usage: replay record <file>" << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    if (!kdb::replay::record(args[2])) {
+        std::cerr << "Failed to record to " << args[2] << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Record to " << args[2] << "." << std::endl;
+    return cmd::Success;
+}
+
+static int cmd_replay_play(const cmd::args_t &args) {
+    if (args.size() != 3) {
+        std::cerr << "Usage: replay play <file>" << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    if (!kdb::replay::play(args[2])) {
+        std::cerr << "Failed to replay " << args[2] << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Replay " << args[2] << "." << std::endl;
+    return cmd::Success;
+}
+
+static int cmd_replay_stop(const cmd::args_t &) {
+    if (!kdb::replay::is_running()) {
+        std::cerr << "Neither recording nor replaying." << std::endl;
+        return cmd::MissingPrevOp;
+    }
+
+    bool recording = kdb::replay::is_recording();
+    uint64_t events = kdb::replay::event_count();
+    kdb::replay::stop();
+    std::cout << "Stop with " << events << " events " << (recording ? "recorded" : "replayed") << "." << std::endl;
+    return cmd::Success;
+}
+
+static int cmd_replay_info(const cmd::args_t &) {
+    if (!kdb::replay::is_running()) {
+        std::cout << "Neither recording nor replaying." << std::endl;
+        return cmd::Success;
+    }
+
+    std::cout << (kdb::replay::is_recording() ? "Recording, " : "Replaying, ")
+              << kdb::replay::event_count() << " events." << std::endl;
+    for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+        std::cout << "core " << i << ": step " << kdb::cpu->get_core(i)->get_step_count() << std::endl;
+    }
+    return cmd::Success;
+}
+
+static const cmd::cmd_map_t cmdMap = {
+    {"record", cmd_replay_record},
+    {"play", cmd_replay_play},
+    {"stop", cmd_replay_stop},
+    {"info", cmd_replay_info},
+};
+
+int cmd::replay(const args_t &args) {
+    if (args.size() < 2) {
+        std::cerr << "Usage: replay <record|play|stop|info>" << std::endl;
+        return cmd::EmptyArgs;
+    }
+
+    return cmd::find_and_run(args, cmdMap, 1);
+}
@@ -0,0 +1,67 @@
+#include "kdb/cmd.hpp"
+#include "kdb/kdb.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace kxemu;
+using namespace kxemu::kdb;
+
+static int cmd_snapshot_save(const cmd::args_t &args) {
+    if (args.size() != 3) {
+        std::cerr << "Usage: snapshot save <dir>" << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    if (!kdb::save_snapshot(args[2])) {
+        std::cerr << "Failed to save snapshot to " << args[2] << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Save snapshot to " << args[2] << " success." << std::endl;
+    return cmd::Success;
+}
+
+static int cmd_snapshot_delta(const cmd::args_t &args) {
+    if (args.size() != 3) {
+        std::cerr << "Usage: snapshot delta <dir>" << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    if (!kdb::save_snapshot_delta(args[2])) {
+        std::cerr << "Failed to save delta snapshot to " << args[2] << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Save delta snapshot to " << args[2] << " success." << std::endl;
+    return cmd::Success;
+}
+
+static int cmd_snapshot_load(const cmd::args_t &args) {
+    if (args.size() < 3) {
+        std::cerr << "Usage: snapshot load <dir> [delta-dir...]" << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    std::vector<std::string> deltas(args.begin() + 3, args.end());
+    if (!kdb::load_snapshot(args[2], deltas)) {
+        std::cerr << "Failed to load snapshot from " << args[2] << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Load snapshot from " << args[2] << " success." << std::endl;
+    return cmd::Success;
+}
+
+static const cmd::cmd_map_t cmdMap = {
+    {"save", cmd_snapshot_save},
+    {"delta", cmd_snapshot_delta},
+    {"load", cmd_snapshot_load},
+};
+
+int cmd::snapshot(const args_t &args) {
+    if (args.size() < 2) {
+        std::cerr << "Usage: snapshot <save|delta|load> <dir>" << std::endl;
+        return cmd::EmptyArgs;
+    }
+
+    return cmd::find_and_run(args, cmdMap, 1);
+}
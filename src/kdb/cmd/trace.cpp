@@ -0,0 +1,52 @@
+#include "kdb/cmd.hpp"
+#include "kdb/kdb.hpp"
+
+#include <iostream>
+#include <string>
+
+using namespace kxemu;
+using namespace kxemu::kdb;
+
+static int cmd_trace_start(const cmd::args_t &args) {
+    if (args.size() != 3) {
+        std::cerr << "Usage: trace start <file>" << std::endl;
+        return cmd::InvalidArgs;
+    }
+
+    if (!kdb::trace::start(args[2])) {
+        std::cerr << "Failed to start the trace to " << args[2] << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Trace to " << args[2] << "." << std::endl;
+    return cmd::Success;
+}
+
+static int cmd_trace_stop(const cmd::args_t &) {
+    if (!kdb::trace::is_running()) {
+        std::cerr << "The trace is not running." << std::endl;
+        return cmd::MissingPrevOp;
+    }
+
+    if (!kdb::trace::stop()) {
+        std::cerr << "Failed to write the trace, the file is truncated." << std::endl;
+        return cmd::CmdError;
+    }
+    std::cout << "Stop with " << kdb::trace::record_count() << " records in "
+              << kdb::trace::byte_count() << " bytes, the harts waited "
+              << kdb::trace::stall_count() << " times." << std::endl;
+    return cmd::Success;
+}
+
+static const cmd::cmd_map_t cmdMap = {
+    {"start", cmd_trace_start},
+    {"stop", cmd_trace_stop},
+};
+
+int cmd::trace(const args_t &args) {
+    if (args.size() < 2) {
+        std::cerr << "Usage: trace <start|stop>" << std::endl;
+        return cmd::EmptyArgs;
+    }
+
+    return cmd::find_and_run(args, cmdMap, 1);
+}
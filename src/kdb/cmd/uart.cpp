@@ -27,7 +27,7 @@ static int cmd_uart_puts(const cmd::args_t &args) {
         return cmd::InvalidArgs;
     }
     
-    if (kdb::uart::puts(index, args[3])) {
+    if (kdb::machine->uart_puts(index, args[3])) {
         return cmd::Success;
     } else {
         std::cout << "Invalid Index: " << args[2] << std::endl;
@@ -8,17 +8,15 @@
 using namespace kxemu;
 using kxemu::kdb::word_t;
 
-std::unordered_set<word_t> kdb::breakpointSet;
 bool kdb::brkTriggered = false;
 
 void kdb::reset_cpu() {
-    cpu->reset(kdb::programEntry);
+    machine->reset();
     kdb::returnCode = 0;
 }
 
 void kdb::reset_cpu(word_t entry) {
-    cpu->reset(entry);
-    kdb::programEntry = entry;
+    machine->reset(entry);
     kdb::returnCode = 0;
 }
 
@@ -45,14 +43,14 @@ static int print_halt(unsigned int coreID) {
 
 int kdb::step_core(unsigned int coreID) {
     auto core = cpu->get_core(coreID);
-    core->step();
+    machine->step(coreID);
     
     if (core->is_halt()) {
         print_halt(coreID);
     }
 
     word_t pc = core->get_pc();
-    if (breakpointSet.find(pc) != breakpointSet.end()) {
+    if (machine->get_breakpoints().contains(pc)) {
         brkTriggered = true;
     }
 
@@ -60,14 +58,7 @@ int kdb::step_core(unsigned int coreID) {
 }
 
 int kdb::run_cpu() {
-    unsigned int n = breakpointSet.size();
-    word_t *breakpoints = new word_t[n];
-    int i = 0;
-    for (auto it = breakpointSet.begin(); it != breakpointSet.end(); it++) {
-        breakpoints[i++] = *it;
-    }
-    cpu->run(true, breakpoints, n);
-    delete[] breakpoints;
+    machine->run();
 
     for (unsigned int i = 0; i < cpu->core_count(); i++) {
         print_halt(i);
@@ -77,9 +68,9 @@ int kdb::run_cpu() {
 }
 
 void kdb::add_breakpoint(word_t addr) {
-    breakpointSet.insert(addr);
+    machine->add_breakpoint(addr);
 }
 
 bool kdb::remove_breakpoint(word_t addr) {
-    return breakpointSet.erase(addr) > 0;
+    return machine->remove_breakpoint(addr);
 }
@@ -8,12 +8,14 @@
 #include <cstdint>
 #include <cstring>
 #include <elf.h>
+#include <fcntl.h>
 #include <fstream>
 #include <ios>
 #include <iostream>
 #include <map>
 #include <optional>
 #include <ostream>
+#include <unistd.h>
 #include <vector>
 
 #ifdef KXEMU_ISA64
@@ -38,8 +40,6 @@
 
 using namespace kxemu;
 
-std::map<kdb::word_t, std::string> kdb::symbolTable;
-
 static bool check_read_success(std::fstream &f, long expectedSize) {
     if (f.gcount() != expectedSize) {
         std::cerr << "An error occurred when read from file." << std::endl;
@@ -73,7 +73,7 @@ static bool check_is_valid_elf(const Elf_Ehdr &ehdr) {
     return true;
 }
 
-static bool load_program(const Elf_Phdr &phdr, std::fstream &f) {
+static bool load_program(const Elf_Phdr &phdr, int fd) {
     if (phdr.p_type != PT_LOAD) {
         return true;
     }
@@ -83,17 +83,15 @@ static bool load_program(const Elf_Phdr &phdr, std::fstream &f) {
     Elf_Word memsze = phdr.p_memsz;
 
     if (memsze == 0) return true;
-
-    f.seekg(phdr.p_offset, std::ios::beg);
     
-    // clear memory
-    if (!kdb::bus->memset(start, memsze, 0)) {
+    // clear the bss part, the rest is overwritten by the file content
+    if (memsze > filesz && !kdb::bus->memset(start + filesz, memsze - filesz, 0)) {
         std::cerr << "Faliled to clear memory, start=" <<  FMT_STREAM_WORD(start) << ", memsize=" << FMT_STREAM_WORD(memsze) << std::endl;
         return false; 
     }
     
-    // copy ELF file to memory
-    if (!kdb::bus->load_from_stream(f, start, filesz)) {
+    // copy ELF file to memory, read directly into the guest memory
+    if (!kdb::bus->load_from_fd(fd, start, phdr.p_offset, filesz)) {
         std::cerr << "Failed to load ELF file to memory, start=" <<  FMT_STREAM_WORD(start) << ", filesize=" << FMT_STREAM_WORD(filesz) << std::endl;
         return false; // clear memory
     }
@@ -108,7 +106,8 @@ static bool load_symbol_table(const Elf_Shdr &symtabShdr, const Elf_Shdr &strtab
 
     unsigned int symbolCount = symtabSize / sizeof(Elf_Sym);
 
-    kdb::symbolTable.clear();
+    auto &symbolTable = kdb::machine->get_symbol_table();
+    symbolTable.clear();
     Elf_Off offset = symtabStart;
     for (unsigned int i = 0; i < symbolCount; i++) {
         Elf_Sym sym;
@@ -126,7 +125,7 @@ static bool load_symbol_table(const Elf_Shdr &symtabShdr, const Elf_Shdr &strtab
         char name[256];
         f.seekg(strtabStart + sym.st_name, std::ios::beg);
         f.getline(name, 256, '\0');
-        kdb::symbolTable[sym.st_value] = name;
+        symbolTable[sym.st_value] = name;
     }
     return true;
 }
@@ -166,12 +165,19 @@ std::optional<kdb::word_t> kdb::load_elf(const std::string &filename) {
         phdrArray.push_back(phdr);
     }
 
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cout << "Failed to open file: " << filename << std::endl;
+        return std::nullopt;
+    }
     for (auto phdr: phdrArray) {
-        if (!load_program(phdr, f)) {
+        if (!load_program(phdr, fd)) {
             std::cout << "An error occurred when load program header." << std::endl;
+            close(fd);
             return std::nullopt;
         }
     }
+    close(fd);
 
     // read section header to load symbol table
     Elf_Shdr symtabShdr = {}, strtabShdr = {};
@@ -240,9 +246,9 @@ bool kdb::load_symbol(const std::string &filename) {
     }
 
     if (symtabFound && strtabFound) {
-        size_t before = kdb::symbolTable.size();
+        size_t before = kdb::machine->get_symbol_table().size();
         load_symbol_table(symtabShdr, strtabShdr, f);
-        size_t after = kdb::symbolTable.size();
+        size_t after = kdb::machine->get_symbol_table().size();
         std::cout << "Loaded " << (after - before) << " symbols from \"" << filename << "\"" << std::endl;
     } else {
         std::cerr << "No symbol table was founded in \"" << filename << "\"" << std::endl;
@@ -252,15 +258,16 @@ bool kdb::load_symbol(const std::string &filename) {
 }
 
 std::optional<std::string> kdb::addr_match_symbol(word_t addr, word_t &offset) {
-    if (kdb::symbolTable.empty()) {
+    const auto &symbolTable = kdb::machine->get_symbol_table();
+    if (symbolTable.empty()) {
         return std::nullopt;
     }
 
-    auto iter = kdb::symbolTable.upper_bound(addr);
-    if (iter == kdb::symbolTable.end()) {
+    auto iter = symbolTable.upper_bound(addr);
+    if (iter == symbolTable.end()) {
         iter = iter--;
     } else if (iter->first != addr) {
-        if (iter != kdb::symbolTable.begin()) {
+        if (iter != symbolTable.begin()) {
             iter--;
         } else {
             return std::nullopt;
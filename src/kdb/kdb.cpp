@@ -10,29 +10,33 @@ using namespace kxemu;
 using kxemu::cpu::CPU;
 using kxemu::kdb::word_t;
 
+Machine *kdb::machine = nullptr;
 CPU<word_t> *kdb::cpu = nullptr;
-word_t kdb::programEntry;
+device::Bus *kdb::bus = nullptr;
 int kdb::returnCode = 0;
 
 void kdb::init(unsigned int coreCount) {
-    device::init();
-
-    logFlag = DEBUG | INFO | WARN | PANIC;
-
-    isa::init();
-    cpu = isa::new_cpu();
-    cpu->init(bus, -1, coreCount);
-    cpu->reset(0x80000000);
-    kdb::programEntry = 0x80000000;
+    machine = new Machine(coreCount);
+    cpu = machine->get_cpu();
+    bus = machine->get_bus();
 
     INFO("Init %s CPU", isa::get_isa_name());
 }
 
 void kdb::deinit() {
-    delete cpu;
+    if (!perf::jsonFile.empty() && !perf::dump_json(perf::jsonFile)) {
+        WARN("Failed to write performance counters to %s", perf::jsonFile.c_str());
+    }
+    profile::stop();
+    if (!trace::stop()) {
+        WARN("Failed to write the trace, the file is truncated.");
+    }
+    replay::stop();
+
+    delete machine;
+    machine = nullptr;
     cpu = nullptr;
-    device::deinit();
-    uart::deinit();
+    bus = nullptr;
 }
 
 word_t kdb::string_to_addr(const std::string &s, bool &success) {
@@ -44,7 +48,7 @@ word_t kdb::string_to_addr(const std::string &s, bool &success) {
         return addr;
     }
     
-    for (auto iter : kdb::symbolTable) {
+    for (auto iter : kdb::machine->get_symbol_table()) {
         if (iter.second == s) {
             addr = iter.first;
             success = true;
@@ -53,3 +57,17 @@ word_t kdb::string_to_addr(const std::string &s, bool &success) {
 
     return addr;
 }
+
+std::optional<device::Bus::MemoryBacking> kdb::string_to_memory_backing(const std::string &s) {
+    using MemoryBacking = kxemu::device::Bus::MemoryBacking;
+    if (s == "anon") {
+        return MemoryBacking::ANON;
+    } else if (s == "thp") {
+        return MemoryBacking::HUGEPAGE;
+    } else if (s == "hugetlb") {
+        return MemoryBacking::HUGETLB;
+    } else if (s == "memfd") {
+        return MemoryBacking::MEMFD;
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,173 @@
+#include "kdb/kdb.hpp"
+#include "cpu/perf.hpp"
+#include "word.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace kxemu;
+using kxemu::cpu::CorePerf;
+
+std::string kdb::perf::jsonFile;
+
+static void print_ratio(std::ostream &os, const char *name, uint64_t hit, uint64_t miss) {
+    uint64_t total = hit + miss;
+    os << "  " << std::setw(12) << std::left << name << std::right
+       << " hit " << hit << ", miss " << miss;
+    if (total != 0) {
+        os << " (" << std::fixed << std::setprecision(2) << hit * 100.0 / total << "% hit)";
+        os.unsetf(std::ios::floatfield);
+    }
+    os << std::endl;
+}
+
+static void print_causes(std::ostream &os, const char *name, const utils::PerfCounter *counters) {
+    for (unsigned int i = 0; i < CorePerf::CAUSE_COUNT; i++) {
+        if (counters[i].get() != 0) {
+            os << "  " << name << " " << std::setw(2) << i << "     " << counters[i].get() << std::endl;
+        }
+    }
+}
+
+void kdb::perf::print(std::ostream &os) {
+    #ifndef CONFIG_PERF
+    os << "Performance counters are not compiled in, enable CONFIG_PERF." << std::endl;
+    #endif
+
+    for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+        CorePerf *perf = kdb::cpu->get_core(i)->get_perf();
+        if (perf == nullptr) {
+            continue;
+        }
+        os << "core " << i << ":" << std::endl;
+        os << "  " << std::setw(12) << std::left << "instret" << std::right << " " << perf->instret.get() << std::endl;
+        print_ratio(os, "icache", perf->icacheHit.get(), perf->icacheMiss.get());
+        print_ratio(os, "tlb", perf->tlbHit.get(), perf->tlbMiss.get());
+        os << "  " << std::setw(12) << std::left << "page walk" << std::right << " " << perf->pageWalk.get() << std::endl;
+        print_causes(os, "trap", perf->trap);
+        print_causes(os, "interrupt", perf->interrupt);
+    }
+
+    os << "devices:" << std::endl;
+    for (const auto &map : kdb::bus->mmioMaps) {
+        os << "  " << std::setw(4) << map->id << " " << std::setw(16) << std::left << map->dev->get_type_name() << std::right
+           << " " << FMT_STREAM_WORD(map->start) << " " << map->accesses.get() << std::endl;
+    }
+    os << "device updates " << kdb::bus->updateCount.get() << std::endl;
+}
+
+static std::vector<kxemu::cpu::InstMixEntry> sorted_inst_mix(unsigned int coreID) {
+    auto mix = kdb::cpu->get_core(coreID)->get_inst_mix();
+    std::stable_sort(mix.begin(), mix.end(), [](const auto &a, const auto &b) {
+        return a.count > b.count;
+    });
+    return mix;
+}
+
+void kdb::perf::print_inst_mix(std::ostream &os, unsigned int coreID) {
+    #ifndef CONFIG_INST_MIX
+    os << "Instruction mix is not compiled in, enable CONFIG_INST_MIX." << std::endl;
+    #endif
+
+    auto mix = sorted_inst_mix(coreID);
+    uint64_t total = 0;
+    uint64_t compressed = 0;
+    for (const auto &entry : mix) {
+        total += entry.count;
+        compressed += entry.length == 2 ? entry.count : 0;
+    }
+    if (total == 0) {
+        return;
+    }
+
+    os << "core " << coreID << ": " << total << " instructions, "
+       << std::fixed << std::setprecision(2) << compressed * 100.0 / total << "% compressed" << std::endl;
+    for (const auto &entry : mix) {
+        os << "  " << std::setw(12) << std::left << entry.name << std::right
+           << " " << entry.length * 8 << "-bit " << std::setw(16) << entry.count
+           << " " << std::setw(6) << entry.count * 100.0 / total << "%" << std::endl;
+    }
+    os.unsetf(std::ios::floatfield);
+}
+
+static void json_causes(std::ostream &os, const char *name, const utils::PerfCounter *counters) {
+    os << "\"" << name << "\": {";
+    bool first = true;
+    for (unsigned int i = 0; i < CorePerf::CAUSE_COUNT; i++) {
+        if (counters[i].get() != 0) {
+            os << (first ? "" : ", ") << "\"" << i << "\": " << counters[i].get();
+            first = false;
+        }
+    }
+    os << "}";
+}
+
+void kdb::perf::write_json(std::ostream &os) {
+    os << "{" << std::endl << "  \"cores\": [";
+    bool first = true;
+    for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+        CorePerf *perf = kdb::cpu->get_core(i)->get_perf();
+        if (perf == nullptr) {
+            continue;
+        }
+        os << (first ? "" : ",") << std::endl;
+        first = false;
+        os << "    {\"id\": " << i
+           << ", \"instret\": "     << perf->instret.get()
+           << ", \"icache_hit\": "  << perf->icacheHit.get()
+           << ", \"icache_miss\": " << perf->icacheMiss.get()
+           << ", \"tlb_hit\": "     << perf->tlbHit.get()
+           << ", \"tlb_miss\": "    << perf->tlbMiss.get()
+           << ", \"page_walk\": "   << perf->pageWalk.get() << ", ";
+        json_causes(os, "traps", perf->trap);
+        os << ", ";
+        json_causes(os, "interrupts", perf->interrupt);
+        os << ", \"inst_mix\": [";
+        bool firstEntry = true;
+        for (const auto &entry : sorted_inst_mix(i)) {
+            os << (firstEntry ? "" : ", ") << "{\"name\": \"" << entry.name
+               << "\", \"length\": " << entry.length << ", \"count\": " << entry.count << "}";
+            firstEntry = false;
+        }
+        os << "]}";
+    }
+    os << std::endl << "  ]," << std::endl << "  \"devices\": [";
+    first = true;
+    for (const auto &map : kdb::bus->mmioMaps) {
+        os << (first ? "" : ",") << std::endl;
+        os << "    {\"id\": " << map->id
+           << ", \"type\": \"" << map->dev->get_type_name()
+           << "\", \"start\": " << map->start
+           << ", \"accesses\": " << map->accesses.get() << "}";
+        first = false;
+    }
+    os << std::endl << "  ]," << std::endl;
+    os << "  \"device_updates\": " << kdb::bus->updateCount.get() << std::endl << "}" << std::endl;
+}
+
+bool kdb::perf::dump_json(const std::string &filename) {
+    std::ofstream ofs(filename);
+    if (!ofs.is_open()) {
+        return false;
+    }
+    write_json(ofs);
+    return ofs.good();
+}
+
+void kdb::perf::reset() {
+    for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+        CorePerf *perf = kdb::cpu->get_core(i)->get_perf();
+        if (perf != nullptr) {
+            perf->reset();
+        }
+        kdb::cpu->get_core(i)->reset_inst_mix();
+    }
+    for (auto &map : kdb::bus->mmioMaps) {
+        map->accesses.reset();
+    }
+    kdb::bus->updateCount.reset();
+}
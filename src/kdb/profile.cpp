@@ -0,0 +1,169 @@
+#include "kdb/kdb.hpp"
+#include "cpu/profile.hpp"
+#include "isa/isa.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kxemu;
+using kxemu::cpu::ProfileBuffer;
+using kxemu::cpu::ProfileSample;
+
+// The buffers are drained by a thread while the harts run, so a long run does not drop samples.
+static std::vector<std::unique_ptr<ProfileBuffer>> buffers;
+static std::thread drainer;
+static std::mutex drainerMtx;
+static std::condition_variable drainerCV;
+static bool stopDrainer;
+static bool running = false;
+
+// Samples with the same mode, PC and stack, the key is {mode, pc, stack...}
+static std::mutex stacksMtx;
+static std::map<std::vector<uint64_t>, uint64_t> stacks;
+static uint64_t sampleCount = 0;
+
+static void drain(ProfileBuffer &buffer) {
+    std::lock_guard<std::mutex> lock(stacksMtx);
+    const ProfileSample *samples;
+    std::size_t n;
+    while ((n = buffer.ring.front_span(samples)) != 0) {
+        for (std::size_t i = 0; i < n; i++) {
+            const ProfileSample &sample = samples[i];
+            std::vector<uint64_t> key(2 + sample.depth);
+            key[0] = sample.privMode;
+            key[1] = sample.pc;
+            std::copy(sample.stack, sample.stack + sample.depth, key.begin() + 2);
+            stacks[key]++;
+        }
+        sampleCount += n;
+        buffer.ring.consume(n);
+    }
+}
+
+static void drainer_loop() {
+    std::unique_lock<std::mutex> lock(drainerMtx);
+    while (!stopDrainer) {
+        drainerCV.wait_for(lock, std::chrono::milliseconds(10));
+        for (auto &buffer : buffers) {
+            drain(*buffer);
+        }
+    }
+}
+
+bool kdb::profile::start(unsigned int interval, unsigned int depth) {
+    if (running) {
+        kdb::profile::stop();
+    }
+    if (interval == 0) {
+        return false;
+    }
+
+    stacks.clear();
+    sampleCount = 0;
+    buffers.clear();
+    for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+        buffers.push_back(std::make_unique<ProfileBuffer>());
+        if (!kdb::cpu->get_core(i)->set_profile(buffers.back().get(), interval, depth)) {
+            for (unsigned int j = 0; j < i; j++) {
+                kdb::cpu->get_core(j)->set_profile(nullptr, 0, 0);
+            }
+            buffers.clear();
+            return false;
+        }
+    }
+
+    stopDrainer = false;
+    drainer = std::thread(drainer_loop);
+    running = true;
+    return true;
+}
+
+void kdb::profile::stop() {
+    if (!running) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+        kdb::cpu->get_core(i)->set_profile(nullptr, 0, 0);
+    }
+    {
+        std::lock_guard<std::mutex> lock(drainerMtx);
+        stopDrainer = true;
+    }
+    drainerCV.notify_one();
+    drainer.join();
+
+    // The harts do not push anymore, take the rest
+    for (auto &buffer : buffers) {
+        drain(*buffer);
+    }
+    running = false;
+}
+
+bool kdb::profile::is_running() {
+    return running;
+}
+
+uint64_t kdb::profile::sample_count() {
+    std::lock_guard<std::mutex> lock(stacksMtx);
+    return sampleCount;
+}
+
+uint64_t kdb::profile::dropped_count() {
+    uint64_t dropped = 0;
+    for (const auto &buffer : buffers) {
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+static std::string symbolize(uint64_t addr) {
+    kdb::word_t offset;
+    auto name = kdb::addr_match_symbol(addr, offset);
+    if (name.has_value()) {
+        return name.value();
+    }
+    std::ostringstream ss;
+    ss << "0x" << std::hex << addr;
+    return ss.str();
+}
+
+// One line per stack, the frames from the outermost to the PC separated by ';', then the count.
+// The first frame is the privilege mode, so the firmware, the kernel and the user space are apart.
+void kdb::profile::write_folded(std::ostream &os) {
+    std::map<std::string, uint64_t> folded;
+    {
+        std::lock_guard<std::mutex> lock(stacksMtx);
+        for (const auto &[key, count] : stacks) {
+            std::string line = isa::get_priv_name(key[0]);
+            for (std::size_t i = key.size() - 1; i >= 2; i--) {
+                // A return address is after the call, which may be the last instruction of the function
+                line += ";" + symbolize(key[i] - 1);
+            }
+            line += ";" + symbolize(key[1]);
+            folded[line] += count;
+        }
+    }
+
+    for (const auto &[line, count] : folded) {
+        os << line << " " << count << std::endl;
+    }
+}
+
+bool kdb::profile::dump(const std::string &filename) {
+    std::ofstream ofs(filename);
+    if (!ofs.is_open()) {
+        return false;
+    }
+    kdb::profile::write_folded(ofs);
+    return ofs.good();
+}
@@ -0,0 +1,65 @@
+#include "kdb/kdb.hpp"
+#include "utils/replay-log.hpp"
+#include "log.h"
+
+#include <cstdint>
+#include <string>
+
+using namespace kxemu;
+using kxemu::utils::ReplayLog;
+
+static ReplayLog replayLog;
+
+// The devices which complete requests on background threads do it in the notify instead,
+// so the DMA and the interrupts happen at the same step when recording and replaying
+static void set_devices_synchronous(bool synchronous) {
+    for (auto map : kdb::bus->mmioMaps) {
+        map->dev->set_synchronous(synchronous);
+    }
+}
+
+static bool start(bool record, const std::string &filename) {
+    kdb::replay::stop();
+
+    bool opened = record ? replayLog.open_record(filename, kdb::cpu->core_count())
+                         : replayLog.open_replay(filename, kdb::cpu->core_count());
+    if (!opened) {
+        return false;
+    }
+    if (!kdb::cpu->set_replay(&replayLog)) {
+        WARN("The CPU does not support record and replay.");
+        replayLog.close();
+        return false;
+    }
+    set_devices_synchronous(true);
+    return true;
+}
+
+bool kdb::replay::record(const std::string &filename) {
+    return start(true, filename);
+}
+
+bool kdb::replay::play(const std::string &filename) {
+    return start(false, filename);
+}
+
+void kdb::replay::stop() {
+    if (!replayLog.is_open()) {
+        return;
+    }
+    kdb::cpu->set_replay(nullptr);
+    set_devices_synchronous(false);
+    replayLog.close();
+}
+
+bool kdb::replay::is_running() {
+    return replayLog.is_open();
+}
+
+bool kdb::replay::is_recording() {
+    return replayLog.is_open() && replayLog.get_mode() == ReplayLog::RECORD;
+}
+
+uint64_t kdb::replay::event_count() {
+    return replayLog.event_count();
+}
@@ -0,0 +1,349 @@
+/***************************************************************
+ * Project Name: KXemu
+ * File Name: src/kdb/snapshot.cpp
+ * Description: Save and restore the whole machine state.
+                A full snapshot is a directory:
+                  machine.bin        - cpu and device state
+                  mem-<start>.bin    - raw content of each memory block
+                The memory images are mapped copy-on-write on restore,
+                so restoring a snapshot does not copy the guest memory.
+                A delta snapshot only has machine.bin, which contains
+                the pages written since the previous snapshot.
+ ***************************************************************/
+
+#include "kdb/kdb.hpp"
+#include "isa/isa.hpp"
+#include "device/bus.hpp"
+#include "utils/snapshot.hpp"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace kxemu;
+using kxemu::kdb::word_t;
+using MemoryBlock = kxemu::device::Bus::MemoryBlock;
+
+static const char *SNAPSHOT_MAGIC = "KXemu-snapshot";
+static constexpr uint32_t SNAPSHOT_VERSION = 4;
+
+enum SnapshotKind : uint32_t {
+    FULL  = 0,
+    DELTA = 1,
+};
+
+static std::string machine_file(const std::string &dir) {
+    return dir + "/machine.bin";
+}
+
+static std::string memory_file(const std::string &dir, word_t start) {
+    std::ostringstream ss;
+    ss << dir << "/mem-" << std::hex << start << ".bin";
+    return ss.str();
+}
+
+static void write_header(utils::SnapshotWriter &writer, SnapshotKind kind) {
+    writer.write_string(SNAPSHOT_MAGIC);
+    writer.write(SNAPSHOT_VERSION);
+    writer.write_string(isa::get_isa_name());
+    writer.write<uint32_t>(kind);
+    writer.write<uint64_t>(kdb::machine->get_entry());
+}
+
+static bool read_header(utils::SnapshotReader &reader, SnapshotKind kind, uint64_t &entry) {
+    uint32_t version;
+    if (!reader.expect_string(SNAPSHOT_MAGIC) || !reader.read(version) || version != SNAPSHOT_VERSION) {
+        WARN("Not a snapshot of this version.");
+        return false;
+    }
+    if (!reader.expect_string(isa::get_isa_name())) {
+        WARN("ISA of snapshot mismatch.");
+        return false;
+    }
+    uint32_t k;
+    if (!reader.read(k) || k != kind) {
+        WARN("Kind of snapshot mismatch, expected %s snapshot.", kind == FULL ? "full" : "delta");
+        return false;
+    }
+    return reader.read(entry);
+}
+
+// The memory blocks, the devices and the core count, checked before restoring anything
+static void write_layout(utils::SnapshotWriter &writer) {
+    writer.write<uint32_t>(kdb::bus->memoryMaps.size());
+    for (auto mem : kdb::bus->memoryMaps) {
+        writer.write<uint64_t>(mem->get_start());
+        writer.write<uint64_t>(mem->get_end() - mem->get_start());
+    }
+    writer.write<uint32_t>(kdb::bus->mmioMaps.size());
+    for (auto map : kdb::bus->mmioMaps) {
+        writer.write_string(map->dev->get_type_name());
+        writer.write<uint64_t>(map->start);
+    }
+    writer.write<uint32_t>(kdb::cpu->core_count());
+}
+
+static bool check_layout(utils::SnapshotReader &reader) {
+    uint32_t memoryCount;
+    if (!reader.read(memoryCount) || memoryCount != kdb::bus->memoryMaps.size()) {
+        WARN("Memory map of snapshot mismatch.");
+        return false;
+    }
+    for (auto mem : kdb::bus->memoryMaps) {
+        uint64_t start;
+        uint64_t size;
+        reader.read(start);
+        reader.read(size);
+        if (!reader.good() || start != mem->get_start() || size != mem->get_end() - mem->get_start()) {
+            WARN("Memory map of snapshot mismatch.");
+            return false;
+        }
+    }
+
+    uint32_t mmioCount;
+    if (!reader.read(mmioCount) || mmioCount != kdb::bus->mmioMaps.size()) {
+        WARN("MMIO map of snapshot mismatch.");
+        return false;
+    }
+    for (auto map : kdb::bus->mmioMaps) {
+        uint64_t start;
+        if (!reader.expect_string(map->dev->get_type_name()) || !reader.read(start) || start != map->start) {
+            WARN("MMIO map of snapshot mismatch.");
+            return false;
+        }
+    }
+
+    uint32_t coreCount;
+    if (!reader.read(coreCount) || coreCount != kdb::cpu->core_count()) {
+        WARN("Core count of snapshot mismatch.");
+        return false;
+    }
+    return true;
+}
+
+static bool save_machine_state(utils::SnapshotWriter &writer) {
+    for (auto map : kdb::bus->mmioMaps) {
+        if (!map->dev->save_state(writer)) {
+            WARN("Failed to save state of device %s", map->dev->get_type_name());
+            return false;
+        }
+    }
+
+    if (!kdb::cpu->save_state(writer)) {
+        WARN("Failed to save state of cpu");
+        return false;
+    }
+    return true;
+}
+
+static bool load_machine_state(utils::SnapshotReader &reader) {
+    for (auto map : kdb::bus->mmioMaps) {
+        if (!map->dev->load_state(reader)) {
+            WARN("Failed to load state of device %s", map->dev->get_type_name());
+            return false;
+        }
+    }
+
+    // The cpu is restored after devices, the cores register timers to the restored CLINT
+    if (!kdb::cpu->load_state(reader)) {
+        WARN("Failed to load state of cpu");
+        return false;
+    }
+    return true;
+}
+
+static bool finish_write(std::ofstream &fs, const std::string &filename) {
+    fs.flush();
+    if (!fs.good()) {
+        WARN("Failed to write %s", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool kdb::save_snapshot(const std::string &dir) {
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        WARN("Failed to create directory %s: %s", dir.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    std::ofstream fs(machine_file(dir), std::ios::binary | std::ios::trunc);
+    if (!fs.is_open()) {
+        WARN("Failed to open %s", machine_file(dir).c_str());
+        return false;
+    }
+    utils::SnapshotWriter writer(fs);
+    write_header(writer, FULL);
+
+    // This snapshot is the base of the following delta snapshots
+    bus->set_dirty_tracking(true);
+
+    write_layout(writer);
+    for (auto mem : bus->memoryMaps) {
+        word_t start = mem->get_start();
+        if (!bus->dump_to_file(memory_file(dir, start), start, mem->get_end() - start)) {
+            return false;
+        }
+    }
+
+    if (!save_machine_state(writer)) {
+        return false;
+    }
+    return finish_write(fs, machine_file(dir));
+}
+
+bool kdb::save_snapshot_delta(const std::string &dir) {
+    for (auto mem : bus->memoryMaps) {
+        if (!mem->is_dirty_tracking()) {
+            WARN("No base snapshot, save a full snapshot first.");
+            return false;
+        }
+    }
+
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        WARN("Failed to create directory %s: %s", dir.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    std::ofstream fs(machine_file(dir), std::ios::binary | std::ios::trunc);
+    if (!fs.is_open()) {
+        WARN("Failed to open %s", machine_file(dir).c_str());
+        return false;
+    }
+    utils::SnapshotWriter writer(fs);
+    write_header(writer, DELTA);
+
+    // Only pages written since the previous snapshot
+    write_layout(writer);
+    std::vector<std::vector<word_t>> dirtyPages;
+    for (auto mem : bus->memoryMaps) {
+        const auto &pages = dirtyPages.emplace_back(mem->take_dirty_pages());
+        writer.write<uint64_t>(pages.size());
+        for (word_t page : pages) {
+            word_t length = std::min(MemoryBlock::DIRTY_PAGE_SIZE, mem->get_end() - page);
+            writer.write<uint64_t>(page);
+            writer.write_bytes(mem->get_ptr(page), length);
+        }
+    }
+
+    if (save_machine_state(writer) && finish_write(fs, machine_file(dir))) {
+        return true;
+    }
+
+    // The pages taken are marked dirty again, so the next delta snapshot still contains them.
+    // The bitmap is cleared when the pages are taken rather than here, the pages written by
+    // device DMA while saving are then kept dirty.
+    for (std::size_t i = 0; i < dirtyPages.size(); i++) {
+        for (word_t page : dirtyPages[i]) {
+            bus->memoryMaps[i]->mark_dirty(page, MemoryBlock::DIRTY_PAGE_SIZE);
+        }
+    }
+    return false;
+}
+
+static bool apply_delta(const std::string &dir) {
+    std::ifstream fs(machine_file(dir), std::ios::binary);
+    if (!fs.is_open()) {
+        WARN("Failed to open %s", machine_file(dir).c_str());
+        return false;
+    }
+    utils::SnapshotReader reader(fs);
+
+    uint64_t entry;
+    if (!read_header(reader, DELTA, entry)) {
+        return false;
+    }
+
+    if (!check_layout(reader)) {
+        return false;
+    }
+    for (auto mem : kdb::bus->memoryMaps) {
+        uint64_t pageCount;
+        reader.read(pageCount);
+        for (uint64_t i = 0; i < pageCount; i++) {
+            uint64_t page;
+            if (!reader.read(page) || !mem->in_range(page, 1)) {
+                WARN("Invalid page in delta snapshot %s", dir.c_str());
+                return false;
+            }
+            word_t length = std::min(MemoryBlock::DIRTY_PAGE_SIZE, mem->get_end() - (word_t)page);
+            reader.read_bytes(mem->get_ptr(page), length);
+        }
+    }
+
+    if (!load_machine_state(reader)) {
+        return false;
+    }
+    kdb::machine->set_entry(entry);
+    return true;
+}
+
+// The machine must be created with the same memory and devices as the snapshot,
+// for example, by running the same kdb script without running the cpu.
+bool kdb::load_snapshot(const std::string &dir, const std::vector<std::string> &deltas) {
+    if (replay::is_running()) {
+        WARN("Stop recording or replaying before loading a snapshot.");
+        return false;
+    }
+
+    std::ifstream fs(machine_file(dir), std::ios::binary);
+    if (!fs.is_open()) {
+        WARN("Failed to open %s", machine_file(dir).c_str());
+        return false;
+    }
+    utils::SnapshotReader reader(fs);
+
+    uint64_t entry;
+    if (!read_header(reader, FULL, entry)) {
+        return false;
+    }
+
+    // Nothing is restored until the whole layout and all memory images are checked
+    if (!check_layout(reader)) {
+        return false;
+    }
+    for (auto mem : bus->memoryMaps) {
+        std::string filename = memory_file(dir, mem->get_start());
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0) {
+            WARN("Failed to stat %s: %s", filename.c_str(), std::strerror(errno));
+            return false;
+        }
+        if ((uint64_t)st.st_size != mem->get_end() - mem->get_start()) {
+            WARN("Size of memory image %s mismatch.", filename.c_str());
+            return false;
+        }
+    }
+
+    for (auto mem : bus->memoryMaps) {
+        word_t start = mem->get_start();
+        if (!bus->load_from_file(memory_file(dir, start), start, true)) {
+            return false;
+        }
+    }
+
+    if (!load_machine_state(reader)) {
+        return false;
+    }
+    kdb::machine->set_entry(entry);
+
+    // Deltas must be applied in the order they were saved
+    for (const auto &delta : deltas) {
+        if (!apply_delta(delta)) {
+            return false;
+        }
+    }
+
+    // The restored state is the base of the following delta snapshots
+    bus->set_dirty_tracking(true);
+
+    kdb::returnCode = 0;
+    return true;
+}
@@ -0,0 +1,244 @@
+#include "kdb/kdb.hpp"
+#include "cpu/trace.hpp"
+#include "log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kxemu;
+using kxemu::cpu::TraceBuffer;
+using kxemu::cpu::TraceRecord;
+
+// The format is described in docs/trace.md
+static constexpr char TRACE_MAGIC[8] = {'K', 'X', 'T', 'R', 'A', 'C', 'E', '\0'};
+static constexpr uint16_t TRACE_VERSION = 2;
+
+enum RecordHeader : uint8_t {
+    HDR_TRAP = 1 << 0,
+    HDR_JUMP = 1 << 1, // The PC is not the one after the previous record
+    HDR_PRIV = 1 << 2, // The privilege mode changes
+    HDR_RD   = 1 << 3,
+    HDR_MEM  = 1 << 4,
+};
+
+// The state of the delta encoding of a hart, kept across the blocks
+struct HartState {
+    uint64_t nextPC = 0;
+    uint64_t memAddr = 0;
+    unsigned int privMode = 0x100; // Unknown, so the first record has the privilege mode
+};
+
+static std::FILE *file = nullptr;
+static std::vector<std::unique_ptr<TraceBuffer>> buffers;
+static std::vector<HartState> states;
+static std::vector<uint8_t> block;
+static std::atomic<uint64_t> recordCount = 0;
+static std::atomic<uint64_t> byteCount = 0;
+static bool writeFailed; // Nothing is written after a failed write, the file is truncated
+
+static std::thread writer;
+static std::mutex writerMtx;
+static std::condition_variable writerCV;
+static bool stopWriter;
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(v);
+}
+
+static void put_svarint(std::vector<uint8_t> &out, int64_t v) {
+    put_varint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63)); // zigzag
+}
+
+static void encode(std::vector<uint8_t> &out, HartState &state, const TraceRecord &record) {
+    uint8_t header = 0;
+    bool trap = record.flags & TraceRecord::TRAP;
+    bool mem = !trap && (record.flags & TraceRecord::MEM);
+    if (trap)                               header |= HDR_TRAP;
+    if (record.pc != state.nextPC)          header |= HDR_JUMP;
+    if (record.privMode != state.privMode)  header |= HDR_PRIV;
+    if (!trap && record.rd != 0)            header |= HDR_RD;
+    if (mem)                                header |= HDR_MEM;
+
+    out.push_back(header);
+    if (header & HDR_JUMP) {
+        put_svarint(out, record.pc - state.nextPC);
+    }
+    if (header & HDR_PRIV) {
+        out.push_back(record.privMode);
+        state.privMode = record.privMode;
+    }
+
+    if (trap) {
+        put_varint(out, record.value);
+        put_varint(out, record.memAddr);
+        state.nextPC = record.pc;
+        return;
+    }
+
+    unsigned int instLen = (record.inst & 0x3) == 0x3 ? 4 : 2;
+    for (unsigned int i = 0; i < instLen; i++) {
+        out.push_back(record.inst >> (i * 8));
+    }
+    if (header & HDR_RD) {
+        out.push_back(record.rd);
+        put_svarint(out, record.value);
+    }
+    if (mem) {
+        put_svarint(out, record.memAddr - state.memAddr);
+        state.memAddr = record.memAddr;
+    }
+    state.nextPC = record.pc + instLen;
+}
+
+// Encode the records of a hart into a block and write it, only called by the writer
+static void drain(unsigned int hartID) {
+    TraceBuffer &buffer = *buffers[hartID];
+    const TraceRecord *records;
+    std::size_t n;
+    while ((n = buffer.ring.front_span(records)) != 0) {
+        std::vector<uint8_t> payload;
+        payload.reserve(n * 6);
+        for (std::size_t i = 0; i < n; i++) {
+            encode(payload, states[hartID], records[i]);
+        }
+        buffer.ring.consume(n);
+
+        block.clear();
+        put_varint(block, hartID);
+        put_varint(block, n);
+        put_varint(block, payload.size());
+        block.insert(block.end(), payload.begin(), payload.end());
+
+        // The records are still taken after a failure, so the harts do not wait for the writer
+        if (writeFailed) {
+            continue;
+        }
+        if (std::fwrite(block.data(), 1, block.size(), file) != block.size()) {
+            WARN("Failed to write the trace: %s", std::strerror(errno));
+            writeFailed = true;
+            continue;
+        }
+
+        recordCount += n;
+        byteCount += block.size();
+    }
+}
+
+static void writer_loop() {
+    std::unique_lock<std::mutex> lock(writerMtx);
+    while (!stopWriter) {
+        writerCV.wait_for(lock, std::chrono::milliseconds(1));
+        for (unsigned int i = 0; i < buffers.size(); i++) {
+            drain(i);
+        }
+    }
+}
+
+bool kdb::trace::start(const std::string &filename) {
+    if (file != nullptr) {
+        kdb::trace::stop();
+    }
+
+    file = std::fopen(filename.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    uint8_t header[16] = {};
+    std::copy(TRACE_MAGIC, TRACE_MAGIC + 8, header);
+    header[8] = TRACE_VERSION & 0xff;
+    header[9] = TRACE_VERSION >> 8;
+    header[10] = sizeof(word_t) * 8;
+    uint32_t coreCount = kdb::cpu->core_count();
+    for (unsigned int i = 0; i < 4; i++) {
+        header[12 + i] = coreCount >> (i * 8);
+    }
+    if (std::fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        std::fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    recordCount = 0;
+    byteCount = sizeof(header);
+    writeFailed = false;
+    buffers.clear();
+    states.assign(kdb::cpu->core_count(), HartState());
+    for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+        buffers.push_back(std::make_unique<TraceBuffer>());
+        if (!kdb::cpu->get_core(i)->set_trace(buffers.back().get())) {
+            for (unsigned int j = 0; j < i; j++) {
+                kdb::cpu->get_core(j)->set_trace(nullptr);
+            }
+            buffers.clear();
+            std::fclose(file);
+            file = nullptr;
+            return false;
+        }
+    }
+
+    stopWriter = false;
+    writer = std::thread(writer_loop);
+    return true;
+}
+
+bool kdb::trace::stop() {
+    if (file == nullptr) {
+        return true;
+    }
+
+    for (unsigned int i = 0; i < kdb::cpu->core_count(); i++) {
+        kdb::cpu->get_core(i)->set_trace(nullptr);
+    }
+    {
+        std::lock_guard<std::mutex> lock(writerMtx);
+        stopWriter = true;
+    }
+    writerCV.notify_one();
+    writer.join();
+
+    // The harts do not push anymore, take the rest
+    for (unsigned int i = 0; i < buffers.size(); i++) {
+        drain(i);
+    }
+    // The buffered blocks are written by fclose, which may fail as well
+    bool ok = std::fclose(file) == 0 && !writeFailed;
+    file = nullptr;
+    return ok;
+}
+
+bool kdb::trace::is_running() {
+    return file != nullptr;
+}
+
+uint64_t kdb::trace::record_count() {
+    return recordCount;
+}
+
+uint64_t kdb::trace::byte_count() {
+    return byteCount;
+}
+
+uint64_t kdb::trace::stall_count() {
+    uint64_t stalls = 0;
+    for (const auto &buffer : buffers) {
+        stalls += buffer->stalls.load(std::memory_order_relaxed);
+    }
+    return stalls;
+}
@@ -0,0 +1,158 @@
+#include "machine.hpp"
+#include "config/config.h"
+#include "device/bus.hpp"
+#include "device/uart.hpp"
+#include "log.h"
+
+#if defined(CONFIG_ISA_riscv32) || defined(CONFIG_ISA_riscv64)
+    #include "cpu/riscv/cpu.hpp"
+    using ISACPU = kxemu::cpu::RVCPU;
+#else
+    #include "cpu/loongarch/cpu.h"
+    using ISACPU = kxemu::cpu::LACPU;
+#endif
+
+#include <string>
+
+using namespace kxemu;
+using kxemu::device::Uart16650;
+
+Machine::Machine(unsigned int coreCount) {
+    this->bus = new device::Bus();
+    this->cpu = new ISACPU();
+    this->cpu->init(this->bus, -1, coreCount);
+    this->entry = DEFAULT_ENTRY;
+    this->cpu->reset(this->entry);
+}
+
+Machine::~Machine() {
+    // A guest started by start() may still be running, it is stopped instead of waited for
+    this->stop();
+    this->join();
+    delete this->cpu;
+    // The devices may access the memory from their own threads until they are deleted
+    for (auto dev : this->devices) {
+        delete dev;
+    }
+    delete this->bus;
+}
+
+bool Machine::add_memory(word_t base, word_t size, device::Bus::MemoryBacking backing) {
+    return this->bus->add_memory_map(base, size, backing);
+}
+
+bool Machine::add_device(unsigned int id, word_t base, word_t size, device::MMIODev *dev) {
+    if (!this->bus->add_mmio_map(id, base, size, dev)) {
+        delete dev;
+        return false;
+    }
+    this->devices.push_back(dev);
+    return true;
+}
+
+void Machine::add_device(device::MMIODev *dev) {
+    this->devices.push_back(dev);
+}
+
+bool Machine::add_uart_map(unsigned int id, word_t base, Uart16650 *uart) {
+    if (!this->add_device(id, base, UART_LENGTH, uart)) {
+        return false;
+    }
+    this->uarts.push_back(uart);
+    return true;
+}
+
+bool Machine::add_uart(unsigned int id, word_t base, std::ostream &os) {
+    Uart16650 *uart = new Uart16650();
+    uart->set_output_stream(os);
+    return this->add_uart_map(id, base, uart);
+}
+
+bool Machine::add_uart(unsigned int id, word_t base, const std::string &ip, int port) {
+    Uart16650 *uart = new Uart16650();
+    if (!uart->open_socket(ip, port)) {
+        delete uart;
+        return false;
+    }
+    return this->add_uart_map(id, base, uart);
+}
+
+bool Machine::uart_puts(std::size_t index, const std::string &s) {
+    if (index >= this->uarts.size()) {
+        return false;
+    }
+    for (char c : s) {
+        this->uarts[index]->putch(c);
+    }
+    return true;
+}
+
+bool Machine::load_image(const std::string &filename, word_t addr) {
+    return this->bus->load_from_file(filename, addr);
+}
+
+void Machine::reset() {
+    this->cpu->reset(this->entry);
+}
+
+void Machine::reset(word_t entry) {
+    this->entry = entry;
+    this->cpu->reset(entry);
+}
+
+void Machine::add_breakpoint(word_t addr) {
+    this->breakpoints.insert(addr);
+}
+
+bool Machine::remove_breakpoint(word_t addr) {
+    return this->breakpoints.erase(addr) > 0;
+}
+
+void Machine::run() {
+    this->runBreakpoints.assign(this->breakpoints.begin(), this->breakpoints.end());
+    this->cpu->run(true, this->runBreakpoints.data(), this->runBreakpoints.size());
+}
+
+void Machine::step(unsigned int coreID) {
+    this->cpu->get_core(coreID)->step();
+}
+
+void Machine::start() {
+    this->runBreakpoints.assign(this->breakpoints.begin(), this->breakpoints.end());
+    this->cpu->run(false, this->runBreakpoints.data(), this->runBreakpoints.size());
+}
+
+void Machine::join() {
+    this->cpu->join();
+}
+
+bool Machine::is_running() const {
+    return this->cpu->is_running();
+}
+
+void Machine::stop() {
+    for (unsigned int i = 0; i < this->cpu->core_count(); i++) {
+        this->cpu->get_core(i)->request_stop();
+    }
+}
+
+void Machine::set_step_limit(uint64_t n) {
+    for (unsigned int i = 0; i < this->cpu->core_count(); i++) {
+        this->cpu->get_core(i)->set_step_limit(n);
+    }
+}
+
+int Machine::get_exit_code() const {
+    for (unsigned int i = 0; i < this->cpu->core_count(); i++) {
+        auto core = this->cpu->get_core(i);
+        if (core->is_error()) {
+            return 1;
+        }
+        if (core->is_halt() && core->get_halt_code() != 0) {
+            // Only the low 8 bits reach the exit status, so a code like 256 must not read as 0
+            int code = core->get_halt_code() & 0xff;
+            return code != 0 ? code : 1;
+        }
+    }
+    return 0;
+}
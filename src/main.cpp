@@ -16,10 +16,15 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "isa/isa.hpp"
 #include "kdb/cmd.hpp"
 #include "kdb/kdb.hpp"
+#include "log.h"
 
 #include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 using namespace kxemu;
@@ -27,30 +32,74 @@ using namespace kxemu;
 static std::vector<std::string> sourceFiles;
 static unsigned int coreCount = 1;
 
-static void parse_args(int argc, char **argv) {
+// Batch mode
+static bool batchMode = false;
+static std::string kernelFile;
+static uint64_t maxInsns = 0;
+static double timeout = 0;
+
+// std::sto* stop at the first invalid character, the whole value must be a number here
+static void check_number_end(const char *s, std::size_t end) {
+    if (s[end] != '\0') {
+        throw std::invalid_argument(s);
+    }
+}
+
+static bool parse_args(int argc, char **argv) {
     static struct option options[] = {
         {"source", required_argument, 0, 's'},
         {"def"   , required_argument, 0, 'd'},
         {"cores" , required_argument, 0, 'c'},
+        {"perf-json", required_argument, 0, 'p'},
+        {"batch" , no_argument      , 0, 'b'},
+        {"kernel", required_argument, 0, 'k'},
+        {"max-insns", required_argument, 0, 'n'},
+        {"timeout", required_argument, 0, 't'},
         {0, 0, 0, 0}
     };
 
     int o;
-    while((o = getopt_long(argc, argv, "s:", options, NULL)) != -1) {
-        switch (o) {
-            case 's':
-                sourceFiles.push_back(optarg);
-                break;
-            case 'd':
-                kdb::cmd::add_define(optarg);
-                break;
-            case 'c':
-                coreCount = std::stoi(optarg);
-                break;
-            default:
-                break;
+    int index;
+    std::size_t end;
+    while((o = getopt_long(argc, argv, "s:", options, &index)) != -1) {
+        try {
+            switch (o) {
+                case 's':
+                    sourceFiles.push_back(optarg);
+                    break;
+                case 'd':
+                    kdb::cmd::add_define(optarg);
+                    break;
+                case 'c':
+                    coreCount = std::stoi(optarg, &end);
+                    check_number_end(optarg, end);
+                    break;
+                case 'p':
+                    kdb::perf::jsonFile = optarg;
+                    break;
+                case 'b':
+                    batchMode = true;
+                    break;
+                case 'k':
+                    kernelFile = optarg;
+                    break;
+                case 'n':
+                    maxInsns = std::stoull(optarg, &end, 0);
+                    check_number_end(optarg, end);
+                    break;
+                case 't':
+                    timeout = std::stod(optarg, &end);
+                    check_number_end(optarg, end);
+                    break;
+                default:
+                    break;
+            }
+        } catch (const std::logic_error &) { // std::invalid_argument or std::out_of_range
+            std::cerr << "Invalid value " << optarg << " of --" << options[index].name << std::endl;
+            return false;
         }
     }
+    return true;
 }
 
 static void output_info() {
@@ -64,11 +113,43 @@ static void output_info() {
     #endif
 }
 
+// Print nothing but the summary to the standard output, the output of the guest and the
+// commands goes to the standard error. Readline and the disassembler are not initialized.
+static int batch_main() {
+    logFlag = PANIC;
+    std::streambuf *stdoutBuf = std::cout.rdbuf(std::cerr.rdbuf());
+
+    kdb::init(coreCount);
+    for (auto sourceFileName: sourceFiles) {
+        kdb::cmd::run_source_file(sourceFileName);
+    }
+
+    int r;
+    if (!kernelFile.empty() && !kdb::batch::load_kernel(kernelFile)) {
+        std::cerr << "Failed to load " << kernelFile << std::endl;
+        r = 1;
+    } else {
+        std::ostream os(stdoutBuf);
+        r = kdb::batch::run(maxInsns, timeout, os);
+    }
+    kdb::deinit();
+
+    std::cout.rdbuf(stdoutBuf);
+    return r;
+}
+
 int main(int argc, char **argv) {
-    parse_args(argc, argv);
+    if (!parse_args(argc, argv)) {
+        return 1;
+    }
+
+    if (batchMode) {
+        return batch_main();
+    }
 
     output_info();
     
+    isa::init();
     kdb::init(coreCount);
     for (auto sourceFileName: sourceFiles) {
         kdb::cmd::run_source_file(sourceFileName);
@@ -0,0 +1,167 @@
+#include "utils/replay-log.hpp"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+using namespace kxemu::utils;
+
+static constexpr char REPLAY_MAGIC[8] = {'K', 'X', 'R', 'E', 'P', 'L', 'A', 'Y'};
+static constexpr uint16_t REPLAY_VERSION = 1;
+static constexpr std::size_t REPLAY_BUFFER_SIZE = 1 << 20;
+
+ReplayLog::~ReplayLog() {
+    this->close();
+}
+
+bool ReplayLog::open_record(const std::string &filename, unsigned int hartCount) {
+    this->close();
+    this->file = std::fopen(filename.c_str(), "wb");
+    if (this->file == nullptr) {
+        return false;
+    }
+    std::setvbuf(this->file, nullptr, _IOFBF, REPLAY_BUFFER_SIZE);
+
+    uint8_t header[16] = {};
+    std::copy(REPLAY_MAGIC, REPLAY_MAGIC + 8, header);
+    header[8]  = REPLAY_VERSION & 0xff;
+    header[9]  = REPLAY_VERSION >> 8;
+    header[10] = hartCount & 0xff;
+    header[11] = hartCount >> 8;
+    std::fwrite(header, 1, sizeof(header), this->file);
+
+    this->mode = RECORD;
+    this->hartCount = hartCount;
+    this->eventCount = 0;
+    this->states.assign(hartCount, HartState());
+    this->hasNext = false;
+    return true;
+}
+
+bool ReplayLog::open_replay(const std::string &filename, unsigned int hartCount) {
+    this->close();
+    this->file = std::fopen(filename.c_str(), "rb");
+    if (this->file == nullptr) {
+        return false;
+    }
+    std::setvbuf(this->file, nullptr, _IOFBF, REPLAY_BUFFER_SIZE);
+
+    uint8_t header[16];
+    if (std::fread(header, 1, sizeof(header), this->file) != sizeof(header) ||
+        !std::equal(REPLAY_MAGIC, REPLAY_MAGIC + 8, header)) {
+        WARN("%s is not a replay log.", filename.c_str());
+        this->close();
+        return false;
+    }
+    unsigned int version = header[8] | header[9] << 8;
+    unsigned int logHartCount = header[10] | header[11] << 8;
+    if (version != REPLAY_VERSION) {
+        WARN("Unsupported replay log version %u.", version);
+        this->close();
+        return false;
+    }
+    if (logHartCount != hartCount) {
+        WARN("The replay log is recorded with %u harts, but there are %u.", logHartCount, hartCount);
+        this->close();
+        return false;
+    }
+
+    this->mode = REPLAY;
+    this->hartCount = hartCount;
+    this->eventCount = 0;
+    this->states.assign(hartCount, HartState());
+    this->hasNext = this->read_event();
+    return true;
+}
+
+void ReplayLog::close() {
+    if (this->file != nullptr) {
+        std::fclose(this->file);
+        this->file = nullptr;
+    }
+    this->hasNext = false;
+}
+
+void ReplayLog::put_varint(uint64_t v) {
+    while (v >= 0x80) {
+        std::fputc((v & 0x7f) | 0x80, this->file);
+        v >>= 7;
+    }
+    std::fputc(v, this->file);
+}
+
+bool ReplayLog::get_varint(uint64_t &v) {
+    v = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        int c = std::fgetc(this->file);
+        if (c == EOF) {
+            return false;
+        }
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReplayLog::write(const ReplayEvent &event) {
+    HartState &state = this->states[event.hart];
+
+    std::fputc(event.type | event.arg << 2, this->file);
+    this->put_varint(event.hart);
+    this->put_varint(event.step - state.step);
+    if (event.type == ReplayEvent::TIME) {
+        int64_t delta = event.value - state.time;
+        this->put_varint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)); // zigzag
+        state.time = event.value;
+    } else {
+        this->put_varint(event.value);
+    }
+    if (event.type == ReplayEvent::MMIO) {
+        this->put_varint(event.addr);
+    }
+    state.step = event.step;
+    this->eventCount++;
+}
+
+bool ReplayLog::read_event() {
+    int header = std::fgetc(this->file);
+    if (header == EOF) {
+        return false;
+    }
+
+    ReplayEvent &event = this->nextEvent;
+    uint64_t hart, step, value;
+    event.type = header & 0x3;
+    event.arg = header >> 2;
+    if (event.type > ReplayEvent::INTERRUPT || !this->get_varint(hart) || hart >= this->hartCount ||
+        !this->get_varint(step) || !this->get_varint(value)) {
+        WARN("The replay log is truncated or corrupted after %lu events.", (unsigned long)this->eventCount);
+        return false;
+    }
+
+    HartState &state = this->states[hart];
+    event.hart = hart;
+    event.step = state.step + step;
+    state.step = event.step;
+    if (event.type == ReplayEvent::TIME) {
+        event.value = state.time + (int64_t)((value >> 1) ^ -(value & 1));
+        state.time = event.value;
+    } else {
+        event.value = value;
+    }
+    event.addr = 0;
+    if (event.type == ReplayEvent::MMIO && !this->get_varint(event.addr)) {
+        WARN("The replay log is truncated after %lu events.", (unsigned long)this->eventCount);
+        return false;
+    }
+    return true;
+}
+
+void ReplayLog::next() {
+    this->eventCount++;
+    this->hasNext = this->read_event();
+}
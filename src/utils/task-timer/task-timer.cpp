@@ -30,17 +30,20 @@ void TaskTimer::timer_thread() {
         auto &next = this->tasks.top();
         
         if (this->removedTasks.find(next.id) != this->removedTasks.end()) {
+            unsigned int id = next.id;
             this->tasks.pop();
-            this->removedTasks.erase(next.id);
+            this->removedTasks.erase(id);
             continue;
         }
         
         auto now = std::chrono::high_resolution_clock::now();
         if (next.timepoint <= now) {
+            // Take the task out before unlocking, the queue may change while it runs
+            task_t task = next.task;
+            this->tasks.pop();
             lock.unlock();
-            next.task();
+            task();
             lock.lock();
-            this->tasks.pop();
         } else {
             this->cv.wait_until(lock, next.timepoint);
         }
@@ -0,0 +1,129 @@
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+MICROBENCH_DIR = os.path.join(BENCH_DIR, 'microbench')
+BENCHMARKS = ['qsort', 'queen', 'bf', 'fib', 'sieve', '15pz', 'dinic', 'lzip', 'ssort', 'md5']
+
+parser = argparse.ArgumentParser(description="Measure the speed of KXemu running the MicroBench programs.")
+parser.add_argument("--kxemu", type=str, required=True, help="The emulator to measure")
+parser.add_argument("--isa", type=str, default="riscv64", help="The ISA of the programs")
+parser.add_argument("--baseline", type=str, default=os.path.join(BENCH_DIR, 'baseline.json'), help="The baseline JSON file")
+parser.add_argument("--budget", type=int, default=50000000, help="The instructions each benchmark runs")
+parser.add_argument("--repeat", type=int, default=3, help="Run each benchmark this many times and take the fastest")
+parser.add_argument("--threshold", type=float, default=0.1, help="Fail when a benchmark is slower than the baseline by this ratio")
+parser.add_argument("--timeout", type=float, default=300, help="Stop a run after this many seconds")
+parser.add_argument("--no-build", action="store_true", help="Use the programs built before")
+parser.add_argument("--update", action="store_true", help="Write the results into the baseline, the other benchmarks in it are kept")
+parser.add_argument("benchmarks", type=str, nargs="*", help="The benchmarks to run, all by default")
+
+args = parser.parse_args()
+benchmarks = args.benchmarks if args.benchmarks else BENCHMARKS
+
+def elf_path(name):
+    return os.path.join(MICROBENCH_DIR, 'build', 'kxemu-%s-microbench-%s.elf' % (args.isa, name))
+
+def build(name):
+    print("+ BUILD %s" % name, file=sys.stderr)
+    subprocess.run(['make', '-s', '-C', MICROBENCH_DIR, 'ISA=' + args.isa, 'BENCH=' + name, 'elf'], check=True)
+
+# Run a benchmark in batch mode, return the summary or None if it fails
+def run(name):
+    command = [
+        args.kxemu, '--batch',
+        '--source', os.path.join(MICROBENCH_DIR, 'init.kdb'),
+        '--kernel', elf_path(name),
+        '--max-insns', str(args.budget),
+        '--timeout', str(args.timeout),
+    ]
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    try:
+        summary = json.loads(result.stdout)
+    except json.JSONDecodeError:
+        print("%s: kxemu exits with %d and prints no summary" % (name, result.returncode), file=sys.stderr)
+        return None
+    # The program halts with 0 when it finishes within the budget and passes
+    if summary['status'] == 'limit' or (summary['status'] == 'halt' and summary['exit_code'] == 0):
+        return summary
+    print("%s: stops with %s, exit code %d" % (name, summary['status'], summary['exit_code']), file=sys.stderr)
+    return None
+
+def load_baseline():
+    if not os.path.exists(args.baseline):
+        return {}
+    with open(args.baseline, 'r') as f:
+        baseline = json.load(f)
+    if baseline.get('budget', args.budget) != args.budget:
+        print("The baseline is measured with a budget of %d instructions, not %d" % (baseline['budget'], args.budget), file=sys.stderr)
+        if args.update:
+            # The results of different budgets are not comparable, so they are not merged
+            print("The baseline is replaced by the results of this run", file=sys.stderr)
+            return {}
+    return baseline.get('benchmarks', {})
+
+baseline = load_baseline()
+results = {}
+errors = []
+regressions = []
+missing = []
+
+if not args.no_build:
+    for name in benchmarks:
+        build(name)
+
+print("%-8s %12s %12s %10s %10s %8s" % ("name", "insns", "host-sec", "mips", "base-mips", "ratio"))
+for name in benchmarks:
+    runs = []
+    for i in range(args.repeat):
+        summary = run(name)
+        if summary is None:
+            break
+        runs.append(summary)
+    if len(runs) != args.repeat:
+        print("%-8s %12s" % (name, "ERROR"))
+        errors.append(name)
+        continue
+
+    # The fastest run has the least noise from the host
+    best = min(runs, key=lambda r: r['host_seconds'])
+    mips = best['insns'] / best['host_seconds'] / 1e6 if best['host_seconds'] > 0 else 0.0
+    results[name] = {'insns': best['insns'], 'host_seconds': best['host_seconds'], 'mips': round(mips, 3)}
+    if name in baseline:
+        baseMIPS = baseline[name]['mips']
+        ratio = mips / baseMIPS if baseMIPS > 0 else 0.0
+        regressed = ratio < 1 - args.threshold
+        print("%-8s %12d %12.3f %10.3f %10.3f %8.3f%s" % (
+            name, best['insns'], best['host_seconds'], mips, baseMIPS, ratio, " REGRESSED" if regressed else ""))
+        if regressed:
+            regressions.append(name)
+    else:
+        print("%-8s %12d %12.3f %10.3f %10s %8s" % (name, best['insns'], best['host_seconds'], mips, "-", "-"))
+        missing.append(name)
+
+if results:
+    totalInsns = sum(r['insns'] for r in results.values())
+    totalSeconds = sum(r['host_seconds'] for r in results.values())
+    print("%-8s %12d %12.3f %10.3f" % ("total", totalInsns, totalSeconds, totalInsns / totalSeconds / 1e6 if totalSeconds > 0 else 0.0))
+
+if errors:
+    print("Failed to run: %s" % ' '.join(errors), file=sys.stderr)
+    sys.exit(1)
+
+if args.update:
+    # Only the benchmarks run are replaced
+    baseline.update(results)
+    with open(args.baseline, 'w') as f:
+        json.dump({'budget': args.budget, 'benchmarks': dict(sorted(baseline.items()))}, f, indent=2)
+        f.write('\n')
+    print("Updated %s" % args.baseline, file=sys.stderr)
+    sys.exit(0)
+
+# Not compared until a baseline is recorded for them, and reported each run
+if missing:
+    print("No baseline for: %s, record it by make bench-update" % ' '.join(missing), file=sys.stderr)
+if regressions:
+    print("Slower than the baseline by more than %d%%: %s" % (args.threshold * 100, ' '.join(regressions)), file=sys.stderr)
+    sys.exit(1)
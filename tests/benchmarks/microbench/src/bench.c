@@ -101,6 +101,10 @@ int main(const char *args) {
 
   for (int i = 0; i < LENGTH(benchmarks); i ++) {
     Benchmark *bench = &benchmarks[i];
+#ifdef BENCH_ONLY
+    // Built by the emulator benchmark harness, one benchmark per program
+    if (strcmp(bench->name, BENCH_ONLY) != 0) continue;
+#endif
     current = bench;
     setting = &bench->settings[setting_id];
     const char *msg = bench_check(bench);
@@ -0,0 +1,31 @@
+#ifndef __KXEMU_TOOLS_BENCH_HPP__
+#define __KXEMU_TOOLS_BENCH_HPP__
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace kxemu::bench {
+
+using bench_op_t = std::function<void (uint64_t n)>;
+
+// setup creates the state of the benchmark and returns the operation, which runs n times on each call.
+// The state is kept by the operation and released with it.
+struct Benchmark {
+    std::string name;
+    std::function<bench_op_t ()> setup;
+};
+
+// Keep the compiler from dropping the computation of value
+template<typename T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+void add_core_benchmarks  (std::vector<Benchmark> &list);
+void add_device_benchmarks(std::vector<Benchmark> &list);
+
+} // namespace kxemu::bench
+
+#endif
@@ -0,0 +1,263 @@
+#include "bench.hpp"
+#include "cpu/riscv/core.hpp"
+#include "cpu/riscv/cpu.hpp"
+#include "cpu/riscv/csr-field.hpp"
+#include "cpu/riscv/def.hpp"
+#include "cpu/riscv/pte.hpp"
+#include "cpu/word.hpp"
+#include "device/bus.hpp"
+#include "log.h"
+#include "word.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace kxemu;
+using namespace kxemu::cpu;
+using kxemu::bench::Benchmark;
+using kxemu::bench::bench_op_t;
+
+static constexpr word_t MEM_BASE = 0x80000000;
+static constexpr word_t MEM_SIZE = 0x10000000;
+static constexpr word_t DATA_BASE  = MEM_BASE + 0x100000; // Accessed by the loads and stores
+static constexpr word_t TABLE_BASE = MEM_BASE + 0x200000; // Page tables
+static constexpr word_t PAGE_BASE  = MEM_BASE + 0x8000000; // Mapped by the page tables
+
+// A hart with its memory, the bus must outlive the harts
+struct Hart {
+    device::Bus bus;
+    RVCPU cpu;
+    RVCore *core;
+
+    Hart() {
+        this->bus.add_memory_map(MEM_BASE, MEM_SIZE);
+        this->cpu.init(&this->bus, 0, 1);
+        this->cpu.reset(MEM_BASE);
+        this->core = this->cpu.get_core(0);
+    }
+};
+
+// Instructions without traps, the loads and stores access sp and a1
+static const std::vector<uint32_t> baseInsts = {
+    0x00130293, // addi   t0, t1, 1
+    0x007302b3, // add    t0, t1, t2
+    0x407302b3, // sub    t0, t1, t2
+    0x123452b7, // lui    t0, 0x12345
+    0x00331293, // slli   t0, t1, 3
+    0x007332b3, // sltu   t0, t1, t2
+    0x007342b3, // xor    t0, t1, t2
+    0x027302b3, // mul    t0, t1, t2
+    0x01812283, // lw     t0, 24(sp)
+    0x00512823, // sw     t0, 16(sp)
+    0x00628463, // beq    t0, t1, 8
+    0x00629463, // bne    t0, t1, 8
+    0x010000ef, // jal    ra, 16
+    0x00001297, // auipc  t0, 1
+#ifndef KXEMU_ISA32
+    0x00813283, // ld     t0, 8(sp)
+    0x00513823, // sd     t0, 16(sp)
+    0x007302bb, // addw   t0, t1, t2
+#endif
+};
+
+static const std::vector<uint32_t> compressedInsts = {
+    0x0405, // c.addi  s0, 1
+    0x8426, // c.mv    s0, s1
+    0x9426, // c.add   s0, s1
+    0x4415, // c.li    s0, 5
+    0x040e, // c.slli  s0, 3
+    0x4422, // c.lwsp  s0, 8(sp)
+    0x41c8, // c.lw    a0, 4(a1)
+    0xc588, // c.sw    a0, 8(a1)
+    0xc401, // c.beqz  s0, 8
+    0xe401, // c.bnez  s0, 8
+    0xa801, // c.j     16
+    0x8c65, // c.and   s0, s1
+    0x8009, // c.srli  s0, 2
+    0x8c05, // c.sub   s0, s1
+#ifndef KXEMU_ISA32
+    0x6422, // c.ldsp  s0, 8(sp)
+    0xe822, // c.sdsp  s0, 16(sp)
+    0x2405, // c.addiw s0, 1
+#endif
+};
+
+// Builds the page tables in the memory of a hart
+class PageTableBuilder {
+private:
+    device::Bus *bus;
+    unsigned int levels;
+    unsigned int pteSize;
+    unsigned int vpnBits;
+    word_t next = TABLE_BASE;
+
+    word_t alloc() {
+        word_t table = this->next;
+        if (table + PGSIZE > PAGE_BASE) {
+            PANIC("The synthetic page tables are too large");
+        }
+        this->next += PGSIZE;
+        this->bus->memset(table, PGSIZE, 0);
+        return table;
+    }
+
+public:
+    word_t root;
+
+    PageTableBuilder(device::Bus *bus, unsigned int levels, unsigned int pteSize, unsigned int vpnBits)
+        : bus(bus), levels(levels), pteSize(pteSize), vpnBits(vpnBits) {
+        this->root = this->alloc();
+    }
+
+    void map(word_t vaddr, word_t paddr) {
+        word_t table = this->root;
+        for (unsigned int i = this->levels - 1; i > 0; i--) {
+            word_t pteAddr = table + ((vaddr >> (PGBITS + i * this->vpnBits)) & ((1 << this->vpnBits) - 1)) * this->pteSize;
+            bool valid;
+            PTE pte = this->bus->read(pteAddr, this->pteSize, valid);
+            if (!pte.flag().v()) {
+                pte = (this->alloc() >> PGBITS) << 10 | 0x01; // V
+                this->bus->write(pteAddr, pte, this->pteSize);
+            }
+            table = pte.ppn() << PGBITS;
+        }
+        word_t pteAddr = table + ((vaddr >> PGBITS) & ((1 << this->vpnBits) - 1)) * this->pteSize;
+        this->bus->write(pteAddr, (paddr >> PGBITS) << 10 | 0xcf, this->pteSize); // V R W X A D
+    }
+};
+
+namespace kxemu::cpu {
+
+// Reaches the internals of RVCore, declared as its friend
+class RVCoreBench {
+public:
+    static bench_op_t decode(bool compressed) {
+        auto hart = std::make_shared<Hart>();
+        RVCore *core = hart->core;
+        core->set_gpr(2, DATA_BASE);         // sp
+        core->set_gpr(11, DATA_BASE + 0x40); // a1
+        const std::vector<uint32_t> &insts = compressed ? compressedInsts : baseInsts;
+        return [hart, core, &insts, compressed](uint64_t n) {
+            RVCore::DecodeInfo decodeInfo;
+            std::size_t j = 0;
+            for (uint64_t i = 0; i < n; i++) {
+                core->inst = insts[j];
+                core->npc = core->pc + (compressed ? 2 : 4);
+                RVCore::do_inst_t do_inst = compressed ? core->decode_and_exec_c(decodeInfo) : core->decode_and_exec(decodeInfo);
+                bench::do_not_optimize(do_inst);
+                if (++j == insts.size()) {
+                    j = 0;
+                }
+            }
+        };
+    }
+
+    // Walk the page tables for pageCount pages, each in its own last level table unless dense is set.
+    // If tlb is set the pages are translated with the TLB, which holds all of them.
+    static bench_op_t translate(unsigned int mode, unsigned int levels, unsigned int pteSize, unsigned int vpnBits,
+                                unsigned int pageCount, bool dense, bool tlb) {
+        auto hart = std::make_shared<Hart>();
+        RVCore *core = hart->core;
+
+        PageTableBuilder builder(&hart->bus, levels, pteSize, vpnBits);
+        word_t stride = dense ? PGSIZE : ((word_t)1 << (PGBITS + vpnBits)) + PGSIZE;
+        if (0x10000000 + (uint64_t)(pageCount - 1) * stride > (word_t)-1) {
+            PANIC("%u pages do not fit in the virtual address space", pageCount);
+        }
+        auto vaddrs = std::make_shared<std::vector<word_t>>();
+        for (unsigned int i = 0; i < pageCount; i++) {
+            word_t vaddr = 0x10000000 + i * stride;
+            builder.map(vaddr, PAGE_BASE + (i % 0x400) * PGSIZE);
+            vaddrs->push_back(vaddr + 0x10);
+        }
+
+        csr::Satp satp = builder.root >> PGBITS;
+        satp.set_mode(mode);
+        core->csr.set_csr_value(CSRAddr::SATP, satp);
+        core->privMode = PrivMode::SUPERVISOR;
+        core->update_vm_translate();
+
+        for (word_t vaddr : *vaddrs) {
+            if (!core->vaddr_translate_core(vaddr, RVCore::LOAD).has_value()) {
+                PANIC("Failed to translate " FMT_WORD " with the synthetic page tables", vaddr);
+            }
+        }
+
+        if (tlb) {
+            return [hart, core, vaddrs](uint64_t n) {
+                std::size_t j = 0;
+                for (uint64_t i = 0; i < n; i++) {
+                    bench::do_not_optimize(core->vaddr_translate_core((*vaddrs)[j], RVCore::LOAD));
+                    if (++j == vaddrs->size()) {
+                        j = 0;
+                    }
+                }
+            };
+        }
+        return [hart, core, vaddrs](uint64_t n) {
+            std::size_t j = 0;
+            for (uint64_t i = 0; i < n; i++) {
+                bench::do_not_optimize((core->*core->vaddr_translate_func)((*vaddrs)[j], RVCore::LOAD));
+                if (++j == vaddrs->size()) {
+                    j = 0;
+                }
+            }
+        };
+    }
+
+    static bench_op_t read_csr(CSRAddr addr) {
+        auto hart = std::make_shared<Hart>();
+        RVCSR *csr = &hart->core->csr;
+        return [hart, csr, addr](uint64_t n) {
+            bool valid;
+            for (uint64_t i = 0; i < n; i++) {
+                bench::do_not_optimize(csr->read_csr(addr, valid));
+            }
+        };
+    }
+
+    static bench_op_t write_csr(CSRAddr addr, word_t value) {
+        auto hart = std::make_shared<Hart>();
+        RVCSR *csr = &hart->core->csr;
+        return [hart, csr, addr, value](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                bench::do_not_optimize(csr->write_csr(addr, value ^ (i & 1)));
+            }
+        };
+    }
+};
+
+} // namespace kxemu::cpu
+
+void bench::add_core_benchmarks(std::vector<Benchmark> &list) {
+    list.push_back({"decode.base",       []() { return RVCoreBench::decode(false); }});
+    list.push_back({"decode.compressed", []() { return RVCoreBench::decode(true);  }});
+
+    // 256 pages fit in the host caches, 16384 pages do not
+#ifdef KXEMU_ISA32
+    list.push_back({"vm.sv32.walk.256",   []() { return RVCoreBench::translate(csr::Satp::SV32, 2, 4, 10, 256,   false, false); }});
+    // Sv32 has 1024 last level tables, and those from 0x10000000 take 4MiB + 4KiB each
+    list.push_back({"vm.sv32.walk.512",   []() { return RVCoreBench::translate(csr::Satp::SV32, 2, 4, 10, 512,   false, false); }});
+#else
+    list.push_back({"vm.sv39.walk.256",   []() { return RVCoreBench::translate(csr::Satp::SV39, 3, 8, 9, 256,   false, false); }});
+    list.push_back({"vm.sv39.walk.16384", []() { return RVCoreBench::translate(csr::Satp::SV39, 3, 8, 9, 16384, false, false); }});
+    list.push_back({"vm.sv48.walk.256",   []() { return RVCoreBench::translate(csr::Satp::SV48, 4, 8, 9, 256,   false, false); }});
+    list.push_back({"vm.sv57.walk.256",   []() { return RVCoreBench::translate(csr::Satp::SV57, 5, 8, 9, 256,   false, false); }});
+#endif
+#ifdef CONFIG_TLB
+    list.push_back({"vm.tlb-hit", []() {
+        #ifdef KXEMU_ISA32
+        return RVCoreBench::translate(csr::Satp::SV32, 2, 4, 10, 1 << config::TLB_SET_BITS, true, true);
+        #else
+        return RVCoreBench::translate(csr::Satp::SV39, 3, 8, 9, 1 << config::TLB_SET_BITS, true, true);
+        #endif
+    }});
+#endif
+
+    // mscratch is a plain value, sstatus is read by a function and mstatus calls back into the hart
+    list.push_back({"csr.read.mscratch",  []() { return RVCoreBench::read_csr (CSRAddr::MSCRATCH); }});
+    list.push_back({"csr.write.mscratch", []() { return RVCoreBench::write_csr(CSRAddr::MSCRATCH, 0x1234); }});
+    list.push_back({"csr.read.sstatus",   []() { return RVCoreBench::read_csr (CSRAddr::SSTATUS); }});
+    list.push_back({"csr.write.mstatus",  []() { return RVCoreBench::write_csr(CSRAddr::MSTATUS, 0x1800); }});
+}
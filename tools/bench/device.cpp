@@ -0,0 +1,153 @@
+#include "bench.hpp"
+#include "cpu/riscv/cpu.hpp"
+#include "cpu/riscv/def.hpp"
+#include "cpu/riscv/plic.hpp"
+#include "cpu/word.hpp"
+#include "device/bus.hpp"
+#include "device/mmio.hpp"
+#include "utils/task-timer.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace kxemu;
+using kxemu::bench::Benchmark;
+using kxemu::bench::bench_op_t;
+using kxemu::device::word_t;
+
+// A device which only raises interrupts
+class IrqDev : public device::MMIODev {
+public:
+    bool pending = false;
+
+    word_t read(word_t offset, word_t size, bool &valid) override {
+        valid = true;
+        return offset;
+    }
+
+    bool write(word_t offset, word_t data, word_t size) override {
+        return true;
+    }
+
+    bool interrupt_pending() override {
+        return this->pending;
+    }
+
+    void clear_interrupt() override {
+        this->pending = false;
+    }
+};
+
+struct BusState {
+    std::vector<std::unique_ptr<IrqDev>> devs;
+    device::Bus bus;
+    word_t addr; // In the last region, the bus matches the regions in order
+};
+
+static constexpr word_t REGION_BASE = 0x10000000;
+static constexpr word_t REGION_SIZE = 0x1000;
+static constexpr word_t REGION_STRIDE = 0x10000;
+
+static std::shared_ptr<BusState> new_bus(unsigned int regionCount, bool mmio) {
+    auto state = std::make_shared<BusState>();
+    for (unsigned int i = 0; i < regionCount; i++) {
+        word_t base = REGION_BASE + i * REGION_STRIDE;
+        if (mmio) {
+            state->devs.push_back(std::make_unique<IrqDev>());
+            state->bus.add_mmio_map(base, REGION_SIZE, state->devs.back().get());
+        } else {
+            state->bus.add_memory_map(base, REGION_SIZE);
+        }
+    }
+    state->addr = REGION_BASE + (regionCount - 1) * REGION_STRIDE;
+    return state;
+}
+
+static bench_op_t bus_read(unsigned int regionCount, bool mmio) {
+    auto state = new_bus(regionCount, mmio);
+    return [state](uint64_t n) {
+        bool valid;
+        for (uint64_t i = 0; i < n; i++) {
+            bench::do_not_optimize(state->bus.read(state->addr + (i & 0xff) * 8, 8, valid));
+        }
+    };
+}
+
+static bench_op_t bus_write(unsigned int regionCount, bool mmio) {
+    auto state = new_bus(regionCount, mmio);
+    return [state](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            bench::do_not_optimize(state->bus.write(state->addr + (i & 0xff) * 8, i, 8));
+        }
+    };
+}
+
+struct PLICState {
+    std::vector<std::unique_ptr<IrqDev>> devs;
+    device::Bus bus;
+    cpu::RVCPU cpu;
+    device::PLIC *plic;
+};
+
+static constexpr word_t PLIC_CLAIM = cpu::PLIC.BASE + 0x200004; // Context 0, the M-mode of hart 0
+
+// A device raises its interrupt, the hart updates the devices, claims and completes it
+static bench_op_t plic_claim(unsigned int sourceCount) {
+    auto state = std::make_shared<PLICState>();
+    state->cpu.init(&state->bus, 0, 1);
+    state->plic = static_cast<device::PLIC *>(state->bus.match_mmio(cpu::PLIC.BASE)->dev);
+    for (unsigned int i = 0; i < sourceCount; i++) {
+        unsigned int source = i + 1;
+        state->devs.push_back(std::make_unique<IrqDev>());
+        state->bus.add_mmio_map(source, REGION_BASE + i * REGION_STRIDE, REGION_SIZE, state->devs.back().get());
+        state->bus.write(cpu::PLIC.BASE + source * 4, 1, 4);
+        bool valid;
+        word_t enable = state->bus.read(cpu::PLIC.BASE + 0x2000 + source / 32 * 4, 4, valid);
+        state->bus.write(cpu::PLIC.BASE + 0x2000 + source / 32 * 4, enable | 1u << (source % 32), 4);
+    }
+
+    return [state, sourceCount](uint64_t n) {
+        unsigned int j = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            state->devs[j]->pending = true;
+            state->plic->scan_and_set_interrupt();
+            bool valid;
+            word_t source = state->bus.read(PLIC_CLAIM, 4, valid);
+            state->bus.write(PLIC_CLAIM, source, 4);
+            if (++j == sourceCount) {
+                j = 0;
+            }
+        }
+    };
+}
+
+// The ACLINT moves a timer by removing its task and adding a new one before it expires
+static bench_op_t timer_add_remove() {
+    auto timer = std::make_shared<utils::TaskTimer>();
+    timer->start_timer();
+    return [timer](uint64_t n) {
+        unsigned int id = timer->add_task(10000000, []() {});
+        for (uint64_t i = 0; i < n; i++) {
+            timer->remove_task(id);
+            id = timer->add_task(10000000, []() {});
+        }
+        timer->remove_task(id);
+    };
+}
+
+void bench::add_device_benchmarks(std::vector<Benchmark> &list) {
+    for (unsigned int regionCount : {1, 8, 64}) {
+        std::string suffix = "." + std::to_string(regionCount);
+        list.push_back({"bus.read.mem"   + suffix, [=]() { return bus_read (regionCount, false); }});
+        list.push_back({"bus.write.mem"  + suffix, [=]() { return bus_write(regionCount, false); }});
+        list.push_back({"bus.read.mmio"  + suffix, [=]() { return bus_read (regionCount, true);  }});
+        list.push_back({"bus.write.mmio" + suffix, [=]() { return bus_write(regionCount, true);  }});
+    }
+
+    list.push_back({"plic.claim.1",  []() { return plic_claim(1);  }});
+    list.push_back({"plic.claim.32", []() { return plic_claim(32); }});
+
+    list.push_back({"timer.add-remove", []() { return timer_add_remove(); }});
+}
@@ -0,0 +1,137 @@
+#include "bench.hpp"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <string>
+#include <vector>
+
+using namespace kxemu;
+using bench::Benchmark;
+
+static unsigned int sampleCount = 30;
+static double sampleTime = 0.01; // Seconds
+static std::vector<std::string> filters;
+static bool listOnly = false;
+
+static void usage(const char *name) {
+    std::printf("Usage: %s [--samples n] [--sample-ms ms] [--list] [filter...]\n", name);
+    std::printf("Run the benchmarks whose names contain any of the filters, all by default.\n");
+}
+
+static void parse_args(int argc, char **argv) {
+    static struct option options[] = {
+        {"samples"  , required_argument, 0, 'n'},
+        {"sample-ms", required_argument, 0, 't'},
+        {"list"     , no_argument      , 0, 'l'},
+        {"help"     , no_argument      , 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int o;
+    while ((o = getopt_long(argc, argv, "n:t:lh", options, NULL)) != -1) {
+        switch (o) {
+            case 'n': sampleCount = std::max(2ul, std::strtoul(optarg, nullptr, 0)); break;
+            case 't': sampleTime = std::strtod(optarg, nullptr) / 1000; break;
+            case 'l': listOnly = true; break;
+            case 'h': usage(argv[0]); std::exit(0);
+            default:  usage(argv[0]); std::exit(1);
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        filters.push_back(argv[i]);
+    }
+}
+
+static bool selected(const std::string &name) {
+    if (filters.empty()) {
+        return true;
+    }
+    return std::any_of(filters.begin(), filters.end(), [&](const std::string &f) {
+        return name.find(f) != std::string::npos;
+    });
+}
+
+static double time_run(const bench::bench_op_t &op, uint64_t n) {
+    auto start = std::chrono::steady_clock::now();
+    op(n);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The two-sided 97.5% quantile of Student's t-distribution, by the degrees of freedom
+static double t_quantile(unsigned int df) {
+    static const double table[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+        2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df < sizeof(table) / sizeof(table[0])) {
+        return table[df];
+    }
+    return df < 60 ? 2.021 : df < 120 ? 2.000 : 1.960;
+}
+
+static void run_benchmark(const Benchmark &b) {
+    bench::bench_op_t op = b.setup();
+
+    // Warm up and find the number of operations filling a sample
+    uint64_t n = 1;
+    double t;
+    while ((t = time_run(op, n)) < sampleTime / 10) {
+        n *= t < sampleTime / 1000 ? 16 : 2;
+    }
+    n = std::max<uint64_t>(1, n * sampleTime / t);
+
+    std::vector<double> ns(sampleCount);
+    for (unsigned int i = 0; i < sampleCount; i++) {
+        ns[i] = time_run(op, n) * 1e9 / n;
+    }
+
+    double mean = 0;
+    for (double x : ns) {
+        mean += x;
+    }
+    mean /= sampleCount;
+    double var = 0;
+    for (double x : ns) {
+        var += (x - mean) * (x - mean);
+    }
+    double stddev = std::sqrt(var / (sampleCount - 1));
+    double ci = t_quantile(sampleCount - 1) * stddev / std::sqrt(sampleCount);
+    std::sort(ns.begin(), ns.end());
+    double median = sampleCount % 2 ? ns[sampleCount / 2] : (ns[sampleCount / 2 - 1] + ns[sampleCount / 2]) / 2;
+
+    std::printf("%-28s %10.2f %9.2f %6.1f%% %10.2f %10.2f %12lu\n",
+                b.name.c_str(), mean, ci, mean > 0 ? ci / mean * 100 : 0.0, median, ns[0], (unsigned long)n);
+    std::fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    parse_args(argc, argv);
+    logFlag = PANIC;
+
+    std::vector<Benchmark> list;
+    bench::add_core_benchmarks(list);
+    bench::add_device_benchmarks(list);
+
+    if (listOnly) {
+        for (const auto &b : list) {
+            std::printf("%s\n", b.name.c_str());
+        }
+        return 0;
+    }
+
+    // The mean with the half-width of its 95% confidence interval, the median and the fastest sample
+    std::printf("%-28s %10s %9s %7s %10s %10s %12s\n", "benchmark", "ns/op", "ci95", "", "median", "min", "ops/sample");
+    for (const auto &b : list) {
+        if (selected(b.name)) {
+            run_benchmark(b);
+        }
+    }
+    return 0;
+}
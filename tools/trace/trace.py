@@ -0,0 +1,177 @@
+# Decode a binary execution trace written by `trace start` in kdb.
+# The format is described in docs/trace.md.
+#
+#   python3 tools/trace/trace.py <file> [--hart N] [--limit N] [--stats]
+
+import argparse
+import sys
+
+MAGIC = b"KXTRACE\0"
+VERSION = 2
+
+HDR_TRAP = 1 << 0
+HDR_JUMP = 1 << 1
+HDR_PRIV = 1 << 2
+HDR_RD   = 1 << 3
+HDR_MEM  = 1 << 4
+
+PRIV_NAMES = {0: "U", 1: "S", 3: "M"}
+
+GPR_NAMES = [
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+]
+
+
+class TraceError(Exception):
+    pass
+
+
+class Reader:
+    def __init__(self, data, pos=0):
+        self.data = data
+        self.pos = pos
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise TraceError("unexpected end of trace")
+        b = self.data[self.pos]
+        self.pos += 1
+        return b
+
+    def bytes(self, n):
+        if self.pos + n > len(self.data):
+            raise TraceError("unexpected end of trace")
+        b = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return b
+
+    def varint(self):
+        v = 0
+        shift = 0
+        while True:
+            b = self.byte()
+            v |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    def svarint(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+
+class HartState:
+    def __init__(self):
+        self.next_pc = 0
+        self.mem_addr = 0
+        self.priv = None
+
+
+def decode(data):
+    """Yield the records as dicts in the order of the file."""
+    if data[:8] != MAGIC:
+        raise TraceError("not a KXemu trace")
+    version = data[8] | data[9] << 8
+    if version != VERSION:
+        raise TraceError(f"unsupported version {version}")
+    xlen = data[10]
+    mask = (1 << xlen) - 1
+
+    states = {}
+    r = Reader(data, 16)
+    while r.pos < len(data):
+        hart = r.varint()
+        count = r.varint()
+        length = r.varint()
+        end = r.pos + length
+        state = states.setdefault(hart, HartState())
+        for _ in range(count):
+            header = r.byte()
+            pc = state.next_pc
+            if header & HDR_JUMP:
+                pc = (pc + r.svarint()) & mask
+            if header & HDR_PRIV:
+                state.priv = r.byte()
+            record = {"hart": hart, "pc": pc, "priv": state.priv}
+
+            if header & HDR_TRAP:
+                record["cause"] = r.varint()
+                record["tval"] = r.varint()
+                state.next_pc = pc
+                yield record
+                continue
+
+            low = r.bytes(2)
+            if low[0] & 0x3 == 0x3:
+                inst = int.from_bytes(low + r.bytes(2), "little")
+                state.next_pc = (pc + 4) & mask
+            else:
+                inst = int.from_bytes(low, "little")
+                state.next_pc = (pc + 2) & mask
+            record["inst"] = inst
+            if header & HDR_RD:
+                record["rd"] = r.byte()
+                record["value"] = r.svarint() & mask
+            if header & HDR_MEM:
+                state.mem_addr = (state.mem_addr + r.svarint()) & mask
+                record["mem"] = state.mem_addr
+            yield record
+        if r.pos != end:
+            raise TraceError(f"block of hart {hart} ends at {r.pos}, expected {end}")
+
+
+def format_record(record, width):
+    priv = PRIV_NAMES.get(record["priv"], "?")
+    line = f"{record['hart']} {priv} {record['pc']:0{width}x}"
+    if "cause" in record:
+        return line + f" trap cause={record['cause']:#x} tval={record['tval']:#x}"
+    inst = record["inst"]
+    line += f" {inst:08x}" if inst & 0x3 == 0x3 else f" {inst:04x}    "
+    if "rd" in record:
+        line += f" {GPR_NAMES[record['rd']]}={record['value']:#x}"
+    if "mem" in record:
+        line += f" mem={record['mem']:#x}"
+    return line
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a KXemu binary execution trace")
+    parser.add_argument("file")
+    parser.add_argument("--hart", type=int, help="only the records of this hart")
+    parser.add_argument("--limit", type=int, help="stop after this number of records")
+    parser.add_argument("--stats", action="store_true", help="print the counts instead of the records")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    width = data[10] // 4 if len(data) > 10 else 16
+
+    records = traps = 0
+    try:
+        for record in decode(data):
+            if args.hart is not None and record["hart"] != args.hart:
+                continue
+            if args.limit is not None and records + traps >= args.limit:
+                break
+            if "cause" in record:
+                traps += 1
+            else:
+                records += 1
+            if not args.stats:
+                print(format_record(record, width))
+    except TraceError as e:
+        print(f"error: {e}", file=sys.stderr)
+        sys.exit(1)
+    except BrokenPipeError:
+        sys.exit(0)
+
+    if args.stats:
+        print(f"{records} instructions, {traps} traps, {len(data)} bytes, "
+              f"{len(data) / max(records + traps, 1):.2f} bytes per record")
+
+
+if __name__ == "__main__":
+    main()